@@ -0,0 +1,168 @@
+/* File:     adaptive.c
+ * Purpose:  The server side of the adaptive integration
+ * Note:
+ |    1.  The computed subintervals live in a max-heap by the error,
+ |        the ones to compute next are in the pending stack
+ |    2.  The totals include the subintervals in flight with their
+ |        provisional estimates: the parent ones split in halves
+ |    3.  The subintervals narrower than ADAPTIVE_MIN_WIDTH are retired:
+ |        they stay in the totals but are not bisected any more
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+//==============================================================================
+// INCLUDE SECTION
+//==============================================================================
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "alerts.h"
+#include "adaptive.h"
+
+//==============================================================================
+// HEAP SECTION
+//==============================================================================
+
+static void push(struct interval** arr, unsigned* len, unsigned* size,
+                 const struct interval* it) {
+    if (*len == *size) {
+        *size = *size ? *size * 2 : 64;
+        if (!(*arr = realloc(*arr, *size * sizeof(struct interval))))
+            PRINT_ERR("Memory allocation");
+    }
+    (*arr)[(*len)++] = *it;
+}
+
+static void heap_push(struct adaptive* a, const struct interval* it) {
+    struct interval* heap;
+    push(&a->heap, &a->heap_len, &a->heap_size, it);
+    heap = a->heap;
+    for (unsigned i = a->heap_len - 1; i; i = (i - 1) / 2) {
+        struct interval tmp = heap[i];
+        if (heap[(i - 1) / 2].error >= tmp.error)
+            break;
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = tmp;
+    }
+}
+
+static struct interval heap_pop(struct adaptive* a) {
+    struct interval* heap = a->heap;
+    unsigned heap_len = --a->heap_len;
+    struct interval top = heap[0];
+    heap[0] = heap[heap_len];
+    for (unsigned i = 0, max; ; i = max) {
+        unsigned l = 2 * i + 1, r = l + 1;
+        max = i;
+        if (l < heap_len && heap[l].error > heap[max].error)
+            max = l;
+        if (r < heap_len && heap[r].error > heap[max].error)
+            max = r;
+        if (max == i)
+            break;
+        struct interval tmp = heap[i];
+        heap[i] = heap[max];
+        heap[max] = tmp;
+    }
+    return top;
+}
+
+//==============================================================================
+// REFINEMENT SECTION
+//==============================================================================
+
+void adaptive_start(struct adaptive* a, long double from, long double to,
+                    unsigned pieces, long double abs, long double rel) {
+    a->heap_len = a->pending_len = 0;
+    a->total_value = a->total_error = a->retired_value = a->retired_error = 0;
+    a->abs_tol = abs;
+    a->rel_tol = rel;
+    a->min_width = fabsl(to - from) * ADAPTIVE_MIN_WIDTH;
+
+    long double width = (to - from) / pieces;
+    for (unsigned i = 0; i < pieces; ++i) {
+        struct interval it = {from + width * i, from + width * (i + 1), 0, 0};
+        if (i == pieces - 1)
+            it.to = to;
+        push(&a->pending, &a->pending_len, &a->pending_size, &it);
+    }
+    a->intervals = pieces;
+}
+
+static long double tolerance(const struct adaptive* a) {
+    return fmaxl(a->abs_tol, a->rel_tol * fabsl(a->total_value));
+}
+
+int adaptive_converged(const struct adaptive* a) {
+    return a->total_error <= tolerance(a);
+}
+
+int adaptive_next(struct adaptive* a, struct interval* task) {
+    while (!a->pending_len) {
+        // The retired error cannot be refined, so it is not waited for
+        if (!a->heap_len || a->total_error - a->retired_error <= tolerance(a) ||
+            a->intervals >= ADAPTIVE_MAX_INTERVALS)
+            return 0;
+
+        // Bisect the worst subinterval, the halves get the halves
+        // of its estimates until they are computed
+        struct interval worst = heap_pop(a);
+        if (fabsl(worst.to - worst.from) < a->min_width) {
+            a->retired_value += worst.value;
+            a->retired_error += worst.error;
+            continue;
+        }
+
+        long double mid = (worst.from + worst.to) / 2;
+        struct interval left  = {worst.from, mid, worst.value / 2, worst.error / 2},
+                        right = {mid, worst.to, worst.value / 2, worst.error / 2};
+        push(&a->pending, &a->pending_len, &a->pending_size, &right);
+        push(&a->pending, &a->pending_len, &a->pending_size, &left);
+        ++a->intervals;
+    }
+
+    *task = a->pending[--a->pending_len];
+    return 1;
+}
+
+void adaptive_requeue(struct adaptive* a, const struct interval* task) {
+    // Its provisional estimates are still in the totals
+    push(&a->pending, &a->pending_len, &a->pending_size, task);
+}
+
+int adaptive_finished(struct adaptive* a) {
+    // The bisected subinterval goes back to the pending ones
+    struct interval task;
+    if (!adaptive_next(a, &task))
+        return 1;
+    ++a->pending_len;
+    return 0;
+}
+
+void adaptive_result(struct adaptive* a, const struct interval* task,
+                     long double value, long double error) {
+    struct interval it = {task->from, task->to, value, error};
+    a->total_value += value - task->value;
+    a->total_error += error - task->error;
+    heap_push(a, &it);
+}
+
+long double adaptive_value(const struct adaptive* a, long double* error,
+                           unsigned* count) {
+    // Summed again: the running totals collect the rounding errors
+    long double value = a->retired_value;
+    *error = a->retired_error;
+    for (unsigned i = 0; i < a->heap_len; ++i) {
+        value += a->heap[i].value;
+        *error += a->heap[i].error;
+    }
+    *count = a->intervals;
+    return value;
+}
+
+void adaptive_free(struct adaptive* a) {
+    free(a->heap);
+    free(a->pending);
+    a->heap = a->pending = NULL;
+    a->heap_len = a->heap_size = a->pending_len = a->pending_size = 0;
+}
@@ -0,0 +1,69 @@
+/* File:     adaptive.h
+ * Purpose:  The server side of the adaptive integration:
+ |           the subintervals, their estimates and the refinement
+ * Note:
+ |    1.  The clients integrate the subintervals with Gauss-Kronrod
+ |        and return the integral and the error estimates
+ |    2.  The subinterval with the largest error is bisected until the sum
+ |        of the errors meets max(abs_tol, rel_tol * |integral|)
+ |    3.  Every job has its own struct adaptive, so the jobs in the
+ |        pipeline are refined independently
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+#define ADAPTIVE_MAX_INTERVALS  1000000 // refinement limit
+#define ADAPTIVE_MIN_WIDTH      1e-12L  // relative to the whole interval
+
+//==============================================================================
+// INTERVAL STRUCTURE SECTION
+//==============================================================================
+
+struct interval {
+    long double from, to,
+                value, error;   // the estimates, provisional until computed
+};
+
+struct adaptive {
+    struct interval *heap,      // computed, the worst one on top
+                    *pending;   // to be sent to the clients
+    unsigned heap_len, heap_size,
+             pending_len, pending_size,
+             intervals;         // the total number of subintervals
+    long double total_value, total_error,
+                retired_value, retired_error,
+                abs_tol, rel_tol, min_width;
+};
+
+//==============================================================================
+// FUNCTION PROTOTYPES SECTION
+//==============================================================================
+
+    void adaptive_start(struct adaptive* a, long double from, long double to,
+                        unsigned pieces, long double abs_tol, long double rel_tol);
+    // PURPOSE:     Forget the previous job, cut [from, to] into pieces
+    int adaptive_next(struct adaptive* a, struct interval* task);
+    // PURPOSE:     Get the next subinterval to compute, 0 if there is
+    //              nothing to compute until more results come
+    void adaptive_requeue(struct adaptive* a, const struct interval* task);
+    // PURPOSE:     Give back the task got from adaptive_next() not computed
+    int adaptive_finished(struct adaptive* a);
+    // PURPOSE:     1 if there is nothing to compute when no task is in flight
+    void adaptive_result(struct adaptive* a, const struct interval* task,
+                         long double value, long double error);
+    // PURPOSE:     Take the estimates of the task got from adaptive_next()
+    int adaptive_converged(const struct adaptive* a);
+    // PURPOSE:     1 if the tolerance is met
+    long double adaptive_value(const struct adaptive* a, long double* error,
+                               unsigned* intervals);
+    // PURPOSE:     The integral, its error estimate and the number
+    //              of the subintervals
+    void adaptive_free(struct adaptive* a);
+    // PURPOSE:     Free the subintervals
+
+#endif // ADAPTIVE_H
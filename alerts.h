@@ -6,75 +6,52 @@
 #include <unistd.h>
 #include <errno.h>
 
-// Messages
-#define ERR    "ERROR:  "
+#include "logger.h"
 
-char __ALERTS_BUFFER1[BUFSIZ],
-     __ALERTS_BUFFER2[BUFSIZ];
-
-#ifdef  MSGPID
-  #define PRINT_ERR(...)\
-  {\
-    sprintf(__ALERTS_BUFFER1, "PID %d:  " ERR "@%d  ", getpid(), __LINE__);\
-    sprintf(__ALERTS_BUFFER2, __VA_ARGS__);\
-    fprintf(stderr, "%s%s\n", __ALERTS_BUFFER1, __ALERTS_BUFFER2);\
-    exit   (EXIT_FAILURE);\
-  }
-
-  #define PRINT_ERRV(...)\
-  {\
-    sprintf(__ALERTS_BUFFER1,"PID %d:  " ERR "@%d   ", getpid(), __LINE__);\
-    sprintf(__ALERTS_BUFFER2, __VA_ARGS__);\
-    fprintf(stderr, "%s%s\n- %s\n", __ALERTS_BUFFER1, __ALERTS_BUFFER2, strerror(errno));\
-    exit   (EXIT_FAILURE);\
-  }
-
-  #define PRINT(...)\
-    {\
-      sprintf(__ALERTS_BUFFER1, "PID %d:  ", getpid());\
-      sprintf(__ALERTS_BUFFER2, __VA_ARGS__);\
-      fprintf(stdout, "%s%s", __ALERTS_BUFFER1, __ALERTS_BUFFER2);\
-    }
-
-#else  // MSGPID
-  #define PRINT_ERR(...)\
-  {\
-    sprintf(__ALERTS_BUFFER1, ERR "@%d  ", __LINE__);\
-    sprintf(__ALERTS_BUFFER2, __VA_ARGS__);\
-    fprintf(stderr, "%s%s\n", __ALERTS_BUFFER1, __ALERTS_BUFFER2);\
-    exit   (EXIT_FAILURE);\
-  }
+// The messages go through the asynchronous log (see logger.h): nothing is
+// formatted above the level and no I/O is done on the calling thread.
+// The errors are written at once and exit
 
+#define PRINT_ERR(...)\
+{\
+  log_fatal(__LINE__, 0, __VA_ARGS__);\
+}
 
-  #define PRINT_ERRV(...)\
-  {\
-    sprintf(__ALERTS_BUFFER1, ERR "@%d  ", __LINE__);\
-    sprintf(__ALERTS_BUFFER2, __VA_ARGS__);\
-    fprintf(stderr, "%s%s\n- %s\n", __ALERTS_BUFFER1, __ALERTS_BUFFER2, strerror(errno));\
-    exit   (EXIT_FAILURE);\
-  }
+#define PRINT_ERRV(...)\
+{\
+  log_fatal(__LINE__, errno, __VA_ARGS__);\
+}
 
-  #define PRINT(...)\
-  {\
-    sprintf(__ALERTS_BUFFER2,  __VA_ARGS__);\
-    fprintf(stdout, "%s", __ALERTS_BUFFER2);\
-  }
+#define PRINT_WARN(...)\
+{\
+  if (log_level >= LOG_WARN)\
+    log_print(LOG_WARN, 1, __VA_ARGS__);\
+}
 
-#endif // MSGPID
+#define PRINT(...)\
+{\
+  if (log_level >= LOG_INFO)\
+    log_print(LOG_INFO, 0, __VA_ARGS__);\
+}
 
-#define PRINT_LINE(...) \
+#define PRINT_LINE(...)\
 {\
-  PRINT(__VA_ARGS__); \
-  fprintf(stdout, "\n");\
-  fflush(stdout);\
+  if (log_level >= LOG_INFO)\
+    log_print(LOG_INFO, 1, __VA_ARGS__);\
 }
 
 
+// The debug messages are not even compiled without DEBUG ("make DEBUG=1"),
+// either way DBG_PRINT is one statement
 #ifdef DEBUG
-    #define DBG_PRINT(...) PRINT_LINE(__VA_ARGS__)
+    #define DBG_PRINT(...)\
+    do {\
+      if (log_level >= LOG_DEBUG)\
+        log_print(LOG_DEBUG, 1, __VA_ARGS__);\
+    } while (0)
 #else  // DEBUG
-    #define DBG_PRINT(...)
-#endif // DEGUG
+    #define DBG_PRINT(...) do {} while (0)
+#endif // DEBUG
 
 
 #define TRY_TO(...) \
@@ -0,0 +1,330 @@
+/* File:     bench.c
+ * Purpose:  Benchmark of the Simpson kernels and of the whole system
+ |           on the local host
+ * Output:   JSON: the kernel rates for every kernel and number of threads,
+ |           the phase times of the loopback runs for every number of clients
+ * Compile:  Better to compile via makefile ("make bench" runs it)
+ * Usage:    ./benchmark [-t seconds] [-c clients] [-s steps]
+ * Note:
+ |    1.  The kernel part runs the kernels the way the client threads do:
+ |        pinned by the client placement (see topology.c), every thread
+ |        integrates its own part. The steps are calibrated so one thread
+ |        runs about the given seconds, every thread count computes the
+ |        same steps per thread
+ |    2.  "expr" is the bytecode kernel of the builtin FUNCTION, the one
+ |        the clients run for "./server -f"
+ |    3.  The loopback part starts ./client 1 for 1, 2, 4... clients up to
+ |        -c, each one allowed on its own CPU, then ./server -t with the job
+ |        of -s steps, and takes the phase times from the stats dump
+ |        the server prints after the job (see metrics.h)
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+//==============================================================================
+// INCLUDE SECTION
+//==============================================================================
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "alerts.h"
+#include "simpson.h"
+#include "expr.h"
+#include "topology.h"
+// used macros: PRINT_ERR   - print error with code line and exit
+//              TRY_TO      - if (... == -1) then ERROR it
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+// Define kernel benchmark parameters
+#define BENCH_SECONDS       0.5             // one thread runs about this long
+#define CALIBRATE_STEPS     (1 << 16)       // the first guess
+
+// Define loopback benchmark parameters
+#define BENCH_CLIENTS       4               // the most clients started
+#define BENCH_STEPS         200000000ULL    // steps of the loopback job
+#define CLIENT_HEAD_START   200000          // us the clients get to listen
+
+//==============================================================================
+// BENCHMARK STRUCTURE SECTION
+//==============================================================================
+
+struct bench_thread {
+    const struct simpson_kernel* kernel;    // NULL for the bytecode
+    int cpu;                                // -1 if not pinned
+    long double from, distance;
+    unsigned long long steps;
+    long double res;
+};
+
+struct phases {
+    double discovery, handshake, compute, reduction, wall;
+};
+
+//==============================================================================
+// FUNCTION PROTOTYPES SECTION
+//==============================================================================
+
+    double now();
+    // PURPOSE:     monotonic time in seconds
+    void* kernelThread(void* arg);
+    // PURPOSE:     pin itself and integrate its part after the barrier
+    double runKernel(const struct simpson_kernel* kernel, unsigned threads,
+                     unsigned long long steps);
+    // PURPOSE:     seconds for the threads to integrate steps each
+    void benchKernels(double seconds);
+    // PURPOSE:     print the kernel rates for every kernel and thread count
+    pid_t spawn(char* const argv[], int cpu, int out);
+    // PURPOSE:     start the program with stdout to out (-1 for /dev/null)
+    //              allowed on the cpu only (-1 for any)
+    int runLoopback(int clients, unsigned long long steps, struct phases* ph);
+    // PURPOSE:     one server and the clients on the local host,
+    //              0 if the server did not dump the stats
+    void benchLoopback(int clients_max, unsigned long long steps);
+    // PURPOSE:     print the phase times for 1, 2, 4... clients
+
+//==============================================================================
+// GLOBAL VARIABLES
+//==============================================================================
+
+    struct expr func;           // the builtin FUNCTION as bytecode
+    pthread_barrier_t start;    // the threads and the timer start together
+    int cpus_num;               // CPUs online
+
+//==============================================================================
+// MAIN CODE SECTION
+//==============================================================================
+
+int main(int argc, char** argv) {
+    // ARGS CHECK
+    double seconds = BENCH_SECONDS;
+    int clients_max = BENCH_CLIENTS;
+    unsigned long long steps = BENCH_STEPS;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:c:s:")) != -1) {
+        if (opt == 't' && sscanf(optarg, "%lf", &seconds) == 1 && seconds > 0)
+            continue;
+        else if (opt == 'c' && sscanf(optarg, "%d", &clients_max) == 1 && clients_max >= 0)
+            continue;
+        else if (opt == 's' && sscanf(optarg, "%llu", &steps) == 1 && steps > 0)
+            continue;
+        else
+            PRINT_ERR("USAGE: %s [-t seconds] [-c clients] [-s steps]", argv[0]);
+    }
+
+    TRY_TO(cpus_num = sysconf(_SC_NPROCESSORS_ONLN));
+    if (expr_compile("x*x*x/(x*x + x + 1/x - 2)", &func) >= 0)
+        PRINT_ERR("Cannot compile FUNCTION");
+
+    printf("{\n");
+    printf("  \"cpus\": %d,\n", cpus_num);
+    benchKernels(seconds);
+    printf(",\n");
+    benchLoopback(clients_max, steps);
+    printf("\n}\n");
+    return 0;
+}
+
+//==============================================================================
+// KERNEL BENCHMARK SECTION
+//==============================================================================
+
+void* kernelThread(void* arg) {
+    struct bench_thread* t = arg;
+    if (t->cpu >= 0)
+        topology_pin(t->cpu);
+    pthread_barrier_wait(&start);
+
+    if (t->kernel)
+        t->res = t->kernel->integrate(t->from, t->distance, t->steps);
+    else
+        t->res = simpson_expr(&func, t->from, t->distance, t->steps);
+    return NULL;
+}
+
+double runKernel(const struct simpson_kernel* kernel, unsigned threads,
+                 unsigned long long steps) {
+    struct bench_thread data[threads];
+    pthread_t tids[threads];
+    int cpus[threads];
+    struct placement placement;
+    topology_plan(threads, cpus, &placement);
+
+    // The threads integrate [0:1] together
+    long double distance = 1.0L / steps / threads;
+    for (unsigned i = 0; i < threads; ++i) {
+        data[i] = (struct bench_thread) {
+            .kernel = kernel,
+            .cpu = cpus[i],
+            .from = i * steps * distance,
+            .distance = distance,
+            .steps = steps,
+        };
+    }
+
+    if (pthread_barrier_init(&start, NULL, threads + 1))
+        PRINT_ERR("Cannot create the barrier");
+    for (unsigned i = 0; i < threads; ++i)
+        if (pthread_create(&tids[i], NULL, &kernelThread, &data[i]))
+            PRINT_ERR("Cannot create thread");
+    pthread_barrier_wait(&start);
+    double begin = now();
+    for (unsigned i = 0; i < threads; ++i)
+        pthread_join(tids[i], NULL);
+    double end = now();
+    pthread_barrier_destroy(&start);
+    return end - begin;
+}
+
+void benchKernels(double seconds) {
+    // The supported kernels from the widest one and the bytecode
+    char names[BUFSIZ];
+    simpson_list(names, sizeof(names));
+    strncat(names, "|expr", sizeof(names) - strlen(names) - 1);
+
+    printf("  \"kernels\": [");
+    int first = 1;
+    for (char* name = strtok(names, "|"); name; name = strtok(NULL, "|")) {
+        const struct simpson_kernel* kernel = strcmp(name, "expr") ? simpson_select(name) : NULL;
+        const char* precision = (kernel && kernel->width == 1) ? "long double" : "double";
+
+        // Grow the steps until one thread runs a tenth of the time
+        unsigned long long steps = CALIBRATE_STEPS;
+        double time;
+        while ((time = runKernel(kernel, 1, steps)) < seconds / 10)
+            steps *= 4;
+        steps = steps * (seconds / time);
+
+        // 1, 2, 4... threads and all the CPUs
+        for (int threads = 1, next; threads <= cpus_num; threads = next) {
+            next = (threads < cpus_num && 2 * threads > cpus_num) ? cpus_num : 2 * threads;
+            time = runKernel(kernel, threads, steps);
+            double evals = (double)SIMPSON_POINTS * steps * threads;
+            printf("%s\n    {\"kernel\": \"%s\", \"precision\": \"%s\", \"width\": %u, "
+                   "\"threads\": %d, \"evals\": %.0f, \"seconds\": %.6f, "
+                   "\"evals_per_sec_per_core\": %.6g}",
+                   first ? "" : ",", name, precision, kernel ? kernel->width : 1,
+                   threads, evals, time, evals / time / threads);
+            fflush(stdout);
+            first = 0;
+        }
+    }
+    printf("\n  ]");
+}
+
+//==============================================================================
+// LOOPBACK BENCHMARK SECTION
+//==============================================================================
+
+pid_t spawn(char* const argv[], int cpu, int out) {
+    pid_t pid;
+    TRY_TO(pid = fork());
+    if (pid)
+        return pid;
+
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+    if (out == -1)
+        TRY_TO(out = open("/dev/null", O_WRONLY));
+    TRY_TO(dup2(out, STDOUT_FILENO));
+    execv(argv[0], argv);
+    PRINT_ERRV("Cannot run %s", argv[0]);
+}
+
+int runLoopback(int clients, unsigned long long steps, struct phases* ph) {
+    // The job of the server
+    char job_path[64], clients_arg[16];
+    snprintf(job_path, sizeof(job_path), "/tmp/netintegral_bench_%d.job", (int)getpid());
+    snprintf(clients_arg, sizeof(clients_arg), "%d", clients);
+    FILE* job = fopen(job_path, "w");
+    if (!job)
+        PRINT_ERRV("Cannot create %s", job_path);
+    fprintf(job, "0 1 steps %llu\n", steps);
+    fclose(job);
+
+    // The clients listen to the broadcast before the server starts
+    pid_t pids[clients];
+    char* client_argv[] = {"./client", "1", NULL};
+    for (int i = 0; i < clients; ++i)
+        pids[i] = spawn(client_argv, i % cpus_num, -1);
+    usleep(CLIENT_HEAD_START);
+
+    int pipe_fd[2];
+    TRY_TO(pipe(pipe_fd));
+    char* server_argv[] = {"./server", "-t", "-j", job_path, clients_arg, NULL};
+    double begin = now();
+    pid_t server = spawn(server_argv, -1, pipe_fd[1]);
+    close(pipe_fd[1]);
+
+    // Read the whole output, so the server never blocks on it
+    char line[BUFSIZ], phase[16];
+    double value;
+    int found = 0;
+    FILE* out = fdopen(pipe_fd[0], "r");
+    while (fgets(line, sizeof(line), out)) {
+        if (sscanf(line, "netintegral_phase_seconds{phase=\"%15[^\"]\"} %lf", phase, &value) == 2 ||
+            sscanf(line, "netintegral_job_phase_seconds{job=\"%*u\",phase=\"%15[^\"]\"} %lf", phase, &value) == 2) {
+            if (!strcmp(phase, "discovery"))
+                ph->discovery = value;
+            else if (!strcmp(phase, "handshake"))
+                ph->handshake = value;
+            else if (!strcmp(phase, "compute"))
+                ph->compute = value;
+            else if (!strcmp(phase, "reduction"))
+                ph->reduction = value;
+        }
+        else if (!strcmp(line, "# EOF\n"))
+            found = 1;
+    }
+    fclose(out);
+
+    waitpid(server, NULL, 0);
+    ph->wall = now() - begin;
+    for (int i = 0; i < clients; ++i) {
+        if (!found)
+            kill(pids[i], SIGTERM);
+        waitpid(pids[i], NULL, 0);
+    }
+    unlink(job_path);
+    return found;
+}
+
+void benchLoopback(int clients_max, unsigned long long steps) {
+    struct phases ph;
+    printf("  \"loopback\": [");
+    for (int clients = 1; clients <= clients_max; clients *= 2) {
+        if (!runLoopback(clients, steps, &ph))
+            PRINT_ERR("The server with %d clients did not finish", clients);
+        printf("%s\n    {\"clients\": %d, \"steps\": %llu, \"discovery\": %.6f, "
+               "\"handshake\": %.6f, \"compute\": %.6f, \"reduction\": %.6f, "
+               "\"wall\": %.6f}",
+               (clients == 1) ? "" : ",", clients, steps, ph.discovery,
+               ph.handshake, ph.compute, ph.reduction, ph.wall);
+        fflush(stdout);
+    }
+    printf("\n  ]");
+}
+
+//==============================================================================
+// SUPPORT FUNCTIONS SECTION
+//==============================================================================
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
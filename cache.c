@@ -0,0 +1,248 @@
+/* File:     cache.c
+ * Purpose:  Persistent cache of the results and the partial sums
+ * Note:
+ |    1.  The file is the header and the table of the entries, the set
+ |        of a key is its hash modulo CACHE_BUCKETS. A file of another
+ |        layout is cleared, so the cache is only lost, never misread
+ |    2.  The clock of the header counts the uses, the entry keeps the
+ |        clock of its last one for the eviction
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+//==============================================================================
+// INCLUDE SECTION
+//==============================================================================
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+#define CACHE_MAGIC     0x4E49434143484531ull   // "NICACHE1"
+#define CACHE_VERSION   2
+
+//==============================================================================
+// CACHE STRUCTURE SECTION
+//==============================================================================
+
+struct cache_header {
+    uint64_t magic;
+    uint32_t version, buckets, ways, entry_size;
+    uint64_t clock;
+};
+
+struct cache_entry {
+    uint64_t hash,              // of the key, 0 if the entry is free
+             used;              // the clock of the last use
+    struct cache_key key;
+    struct cache_range range;
+    uint32_t intervals, converged;
+};
+
+//==============================================================================
+// GLOBAL VARIABLES
+//==============================================================================
+
+static int cache_fd = -1;
+static struct cache_header* cache_head;
+static struct cache_entry* cache_table;
+
+//==============================================================================
+// TABLE SECTION
+//==============================================================================
+
+#define CACHE_SIZE  (sizeof(struct cache_header) + \
+                     (size_t)CACHE_BUCKETS * CACHE_WAYS * sizeof(struct cache_entry))
+
+int cache_open(const char* path) {
+    struct stat st;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1)
+        return 0;
+    flock(fd, LOCK_EX);
+    if (fstat(fd, &st) == -1 || ((size_t)st.st_size != CACHE_SIZE && ftruncate(fd, CACHE_SIZE) == -1)) {
+        close(fd);
+        return 0;
+    }
+    void* map = mmap(NULL, CACHE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+
+    struct cache_header* head = map;
+    if (head->magic != CACHE_MAGIC || head->version != CACHE_VERSION ||
+        head->buckets != CACHE_BUCKETS || head->ways != CACHE_WAYS ||
+        head->entry_size != sizeof(struct cache_entry)) {
+        memset(map, 0, CACHE_SIZE);
+        head->magic = CACHE_MAGIC;
+        head->version = CACHE_VERSION;
+        head->buckets = CACHE_BUCKETS;
+        head->ways = CACHE_WAYS;
+        head->entry_size = sizeof(struct cache_entry);
+    }
+    flock(fd, LOCK_UN);
+
+    cache_fd = fd;
+    cache_head = head;
+    cache_table = (struct cache_entry*)(head + 1);
+    return 1;
+}
+
+static uint64_t key_hash(const struct cache_key* key) {
+    // FNV-1a, zero is the free entry
+    const unsigned char* p = (const unsigned char*)key;
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < sizeof(struct cache_key); ++i)
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    return h ? h : 1;
+}
+
+static struct cache_entry* key_set(uint64_t hash) {
+    flock(cache_fd, LOCK_EX);
+    ++cache_head->clock;
+    return &cache_table[(hash % CACHE_BUCKETS) * CACHE_WAYS];
+}
+
+static int key_match(const struct cache_entry* e, uint64_t hash, const struct cache_key* key) {
+    return e->hash == hash && !memcmp(&e->key, key, sizeof(struct cache_key));
+}
+
+static struct cache_entry* set_victim(struct cache_entry* set) {
+    // A free entry or the least recently used one
+    struct cache_entry* victim = set;
+    for (unsigned w = 0; w < CACHE_WAYS && victim->hash; ++w)
+        if (!set[w].hash || set[w].used < victim->used)
+            victim = &set[w];
+    return victim;
+}
+
+//==============================================================================
+// RANGES SECTION
+//==============================================================================
+
+static int range_order(const void* a, const void* b) {
+    // By the first step, the longer range first
+    const struct cache_range *x = a, *y = b;
+    if (x->first != y->first)
+        return (x->first > y->first) - (x->first < y->first);
+    return (x->steps < y->steps) - (x->steps > y->steps);
+}
+
+unsigned cache_ranges(const struct cache_key* key, struct cache_range* r, unsigned max) {
+    struct cache_range found[CACHE_WAYS];
+    unsigned n = 0, len = 0;
+    if (cache_fd == -1)
+        return 0;
+
+    uint64_t hash = key_hash(key);
+    struct cache_entry* set = key_set(hash);
+    for (unsigned w = 0; w < CACHE_WAYS; ++w) {
+        if (key_match(&set[w], hash, key) && set[w].range.steps) {
+            set[w].used = cache_head->clock;
+            found[n++] = set[w].range;
+        }
+    }
+    flock(cache_fd, LOCK_UN);
+
+    // The ranges of another server may overlap, the first ones win
+    qsort(found, n, sizeof(struct cache_range), range_order);
+    unsigned long long end = 0;
+    for (unsigned i = 0; i < n && len < max; ++i) {
+        if (len && found[i].first < end)
+            continue;
+        r[len++] = found[i];
+        end = found[i].first + found[i].steps;
+    }
+    return len;
+}
+
+void cache_put_range(const struct cache_key* key, const struct cache_range* r) {
+    if (cache_fd == -1 || !r->steps)
+        return;
+
+    uint64_t hash = key_hash(key);
+    struct cache_entry* set = key_set(hash);
+    for (unsigned w = 0; w < CACHE_WAYS; ++w) {
+        struct cache_entry* e = &set[w];
+        if (key_match(e, hash, key) && e->range.first <= r->first &&
+            r->first + r->steps <= e->range.first + e->range.steps) {
+            // Known already
+            e->used = cache_head->clock;
+            flock(cache_fd, LOCK_UN);
+            return;
+        }
+    }
+
+    // The ranges it covers are its children
+    for (unsigned w = 0; w < CACHE_WAYS; ++w) {
+        struct cache_entry* e = &set[w];
+        if (key_match(e, hash, key) && e->range.steps && r->first <= e->range.first &&
+            e->range.first + e->range.steps <= r->first + r->steps)
+            e->hash = 0;
+    }
+
+    struct cache_entry* e = set_victim(set);
+    e->hash = hash;
+    e->used = cache_head->clock;
+    e->key = *key;
+    e->range = *r;
+    e->intervals = e->converged = 0;
+    flock(cache_fd, LOCK_UN);
+}
+
+//==============================================================================
+// RESULTS SECTION
+//==============================================================================
+
+int cache_get_result(const struct cache_key* key, struct cache_range* r,
+                     unsigned* intervals, int* converged) {
+    int found = 0;
+    if (cache_fd == -1)
+        return 0;
+
+    uint64_t hash = key_hash(key);
+    struct cache_entry* set = key_set(hash);
+    for (unsigned w = 0; w < CACHE_WAYS && !found; ++w) {
+        if (key_match(&set[w], hash, key) && !set[w].range.steps) {
+            set[w].used = cache_head->clock;
+            *r = set[w].range;
+            *intervals = set[w].intervals;
+            *converged = set[w].converged;
+            found = 1;
+        }
+    }
+    flock(cache_fd, LOCK_UN);
+    return found;
+}
+
+void cache_put_result(const struct cache_key* key, const struct cache_range* r,
+                      unsigned intervals, int converged) {
+    if (cache_fd == -1)
+        return;
+
+    uint64_t hash = key_hash(key);
+    struct cache_entry* set = key_set(hash);
+    struct cache_entry* e = NULL;
+    for (unsigned w = 0; w < CACHE_WAYS && !e; ++w)
+        if (key_match(&set[w], hash, key) && !set[w].range.steps)
+            e = &set[w];
+    if (!e)
+        e = set_victim(set);
+    e->hash = hash;
+    e->used = cache_head->clock;
+    e->key = *key;
+    e->range = *r;
+    e->range.steps = 0;
+    e->intervals = intervals;
+    e->converged = converged;
+    flock(cache_fd, LOCK_UN);
+}
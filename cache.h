@@ -0,0 +1,70 @@
+/* File:     cache.h
+ * Purpose:  Persistent cache of the results and the partial sums
+ * Note:
+ |    1.  The cache is a file mapped into the memory of the server,
+ |        so the results live between the runs. Its size is fixed:
+ |        CACHE_BUCKETS sets of CACHE_WAYS entries
+ |    2.  An entry is keyed by the integral: the digest of f(x), the bounds,
+ |        the steps, the dimensions, the method and the QMC seed. All the
+ |        entries of a key are in one set, the least recently used one
+ |        of the set is evicted
+ |    3.  The entries of the Simpson, cubature and QMC jobs are the sums
+ |        of the ranges of their steps: the nodes of the tree of reduce.h,
+ |        a node drops the ones it covers. A finished job (a QMC scramble)
+ |        is one entry. The entry of an adaptive job is its whole result
+ |    4.  Every call takes flock() on the file, so the servers of one
+ |        host may share the cache
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+
+#include "reduce.h"
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+#define CACHE_BUCKETS   4096    // sets of the entries
+#define CACHE_WAYS      16      // entries of a set, the most ranges of a key
+
+//==============================================================================
+// CACHE STRUCTURE SECTION
+//==============================================================================
+
+// Fixed-width fields without padding, the key is compared as bytes
+struct cache_key {
+    uint64_t func;              // digest of the bytecode or the builtin FUNCTION
+    uint64_t steps, grid, seed;
+    double from[2], to[2];      // the long doubles as the value and the rest
+    double abs_tol, rel_tol;
+    uint32_t method, dims;
+};
+
+struct cache_range {
+    unsigned long long first, steps;    // steps == 0 for a whole adaptive result
+    struct dsum value, error;           // the bits the clients sent
+};
+
+//==============================================================================
+// FUNCTION PROTOTYPES SECTION
+//==============================================================================
+
+    int cache_open(const char* path);
+    // PURPOSE:     Map the cache file, made if there is none. 0 if failed,
+    //              the other calls do nothing then
+    unsigned cache_ranges(const struct cache_key* key, struct cache_range* r, unsigned max);
+    // PURPOSE:     The cached ranges of the key sorted and not overlapping,
+    //              returns how many
+    void cache_put_range(const struct cache_key* key, const struct cache_range* r);
+    // PURPOSE:     Keep the sum of the range, the ranges it covers are dropped
+    int cache_get_result(const struct cache_key* key, struct cache_range* r,
+                         unsigned* intervals, int* converged);
+    // PURPOSE:     The whole result of the adaptive job, 0 if not cached
+    void cache_put_result(const struct cache_key* key, const struct cache_range* r,
+                          unsigned intervals, int converged);
+    // PURPOSE:     Keep the whole result of the adaptive job
+
+#endif // CACHE_H
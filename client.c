@@ -4,13 +4,74 @@
  | Output:   Estimate of the integral at selected interval of FUNCTION
  |           using the Simpson formula
  * Compile:  Better to compile via makefile
- * Usage:    ./client <number of threads>
+ * Usage:    ./client [-d] [-k kernel] [-p progress_ms] [-l level] [-P port]
+ |                    [-M group] [-S host[:port],...] <number of threads>
  * Note:
- |    1.  f(x) is hardcoded as FUNCTION (predefined)
- |    2.  Number of steps is NUM_STEPS (hardcoded)
+ |    1.  f(x) is the builtin FUNCTION (see simpson.h) or the expression
+ |        bytecode the server sends with MSG_FUNC before every job
+ |    2.  The steps are the server's: every MSG_TASK gives the range
+ |        [local_from, local_to], its number of steps (the panels, cells,
+ |        points or records of the other methods) and the step width,
+ |        the threads split the steps among themselves
  |    3.  TurboBoost avoidance is realized using sort of crutch
  |        by setting taskss for other cores unused in computation.
  |        These taskss are the same as the first one, only to get cores busy.
+ |    4.  The Simpson kernel is the widest SIMD one supported by the CPU,
+ |        "-k ldouble" selects the reference long double kernel
+ |    5.  The threads are created once and parked between the tasks,
+ |        "-d" keeps the client running: after the server says MSG_BYE
+ |        or goes away the client waits for a broadcast again
+ |    6.  The tasks of the adaptive jobs are Gauss-Kronrod panels,
+ |        the client returns the error estimate along with the sum
+ |    7.  Every thread is pinned to its CPU: the physical cores first,
+ |        spread over the sockets, then the hyperthreads (see topology.c).
+ |        The thread allocates its task itself after pinning, so the
+ |        memory is local to its NUMA node. The placement is reported
+ |        to the server in the handshake
+ |    8.  The messages go in the frames (see wire.c). The results of all the
+ |        tasks of one frame are sent back in one frame
+ |    9.  The threads integrate their part in slices and publish the sum
+ |        after every slice, the main thread sends it to the server every
+ |        progress_ms ("-p 0" turns it off) and watches the socket for
+ |        MSG_CANCEL: the threads stop after their current slice
+ |    10. Every thread counts its steps, evaluations of f(x), the time
+ |        it computes and the time it waits for the other threads of
+ |        the task. The counters go to the server in MSG_STATS before
+ |        the client waits for the next tasks
+ |    11. The messages go through the asynchronous log (see logger.h),
+ |        the threads never wait for the output. "-l" sets the most
+ |        verbose level printed
+ |    12. At the first connect the threads integrate the builtin FUNCTION
+ |        for a few ms, the measured evaluations per second go to the
+ |        server in MSG_HELLO with the SIMD width at every connect, the
+ |        server sizes the tasks by them
+ |    13. "-P" listens to the broadcasts on another port, so the client
+ |        finds a relay server (see server.c) instead of the root one
+ |    14. The tasks of the multi-dimensional jobs are the numbered cells
+ |        or points of the cube (see cubature.h), a thread takes its
+ |        numbers and needs nothing from the others
+ |    15. The tasks of the Romberg levels are the midpoint sums of their
+ |        intervals, the nodes are the ones the levels before summed
+ |    16. The client finds the server by itself (see discovery.h): the
+ |        servers of "-S" are connected at once, then the probes go to the
+ |        broadcast address and to the multicast group of "-M"
+ |    17. SIGTERM or SIGINT drains the client: it sends MSG_DRAIN, computes
+ |        the tasks it has and leaves when the server says MSG_BYE, the
+ |        daemon too. A second signal or one before the server is found
+ |        quits at once
+ |    18. The tasks are cut into the blocks of the reduction tree, the
+ |        threads take their blocks and the sums of the blocks go up
+ |        the tree after all of them are done (see reduce.h). So the result
+ |        of a task has the same bits for any number of the threads
+ |    19. The records of a sweep come in MSG_SWEEP after its f(x, p), a task
+ |        is a range of them. A block of SWEEP_BLOCK records is integrated
+ |        together (see sweep.h), the integral of every record goes back
+ |        in MSG_VALUE before the result of the task
+ |    20. Every thread starts with an equal share of the blocks, takes them
+ |        one by one from the front and a thread left without blocks steals
+ |        the back half of the share of the thread with the most blocks
+ |        left. So a throttled or shared core takes fewer blocks instead
+ |        of holding up the task, the sums are the same whoever computes
  * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
 */
 /*==============================================================================
@@ -22,17 +83,32 @@
 // INCLUDE SECTION
 //==============================================================================
 #include <stdio.h>
+#include <time.h>
+#include <poll.h>
 #include <netdb.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <pthread.h>
+#include <signal.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 
 #include "alerts.h"
+#include "simpson.h"
+#include "net_msg.h"
+#include "expr.h"
+#include "kronrod.h"
+#include "cubature.h"
+#include "sweep.h"
+#include "topology.h"
+#include "wire.h"
+#include "discovery.h"
+#include "metrics.h"
 // used macros: PRINT_ERR   - print error with code line and exit
 //              TRY_TO      - if (... == -1) then ERROR it
 //              PRINT       - printf macro
@@ -42,9 +118,16 @@
 // DEFINE SECTION
 //==============================================================================
 
-// Define integral parameters
-#define FUNCTION(x)    x*x*x/(x*x + x + 1/x -2)
-#define NUM_STEPS      4790016000   // 12! * 10 rectangles
+// Define streaming parameters
+#define SLICE_STEPS     (1 << 20)   // Simpson steps between the publications
+#define SLICE_PANELS    (1 << 10)   // Kronrod panels between the publications
+#define PROGRESS_MS     500         // default progress period
+#define CANCEL_POLL_MS  10          // the socket is checked this often
+#define CANCEL_MEMORY   16          // cancelled jobs remembered
+
+// Define calibration parameters
+#define CALIBRATE_STEPS     (1 << 16)   // the first try, per thread
+#define CALIBRATE_SECONDS   0.005       // the run long enough to trust
 
 // Define errors
 #define ERROR_INPUT             -1
@@ -54,22 +137,21 @@
 #define ERROR_MEMORY_ALLOC      -5
 
 // Debug definitions
-#define DEBUG
 #define LINE "===========================================\n"
 
-// Define network parameters
-#define BROADCAST_PORT  31123
-
 //==============================================================================
 // CLIENT TASK STRUCTURE SECTION
 //==============================================================================
 
-struct net_msg {
-    int tcp_port;
-    unsigned cores, steps;
-    long double local_from,
-                local_to,
-                distance;
+struct thread_task {
+    long double res,        // thread partial sum
+                err;        // thread error estimate for the Kronrod tasks
+    pthread_mutex_t lock;       // guards block and end, the others steal
+    unsigned long long block,   // its next block of the task
+                       end;     // the block after its last one
+    unsigned long long done;    // the steps summed up in res so far
+    struct thread_stats stats;  // the totals since the start
+    double finished;            // the time the thread finished its part
 };
 
 //==============================================================================
@@ -77,13 +159,53 @@ struct net_msg {
 //==============================================================================
 
 
-    void waitBroadcast();
-    // PURPOSE:     Receive broadcast from the server
-    void waitTask();
-    // PURPOSE:     Wait for task to calculate from the server
-    void* integrateThread(void* data);
-    // PURPOSE:     The same thread integration function
-    //              as in the previous Lunev's problem
+    void connectServer();
+    // PURPOSE:     Find the server, connect to it and report the number of threads
+    int waitTask();
+    // PURPOSE:     Wait for the next message from the server, returns its type.
+    //              The queued results are sent before waiting
+    void sendFrames();
+    // PURPOSE:     Write all the queued frames to the server
+    void onSignal(int sig);
+    // PURPOSE:     Ask for the drain, quit if asked already
+    void sendDrain();
+    // PURPOSE:     Tell the server the client leaves
+    void watchServer();
+    // PURPOSE:     Read what has come without waiting and look for MSG_CANCEL
+    void sendProgress();
+    // PURPOSE:     Send the partial sum of the task being computed
+    int isCancelled(unsigned job);
+    // PURPOSE:     1 if the job was cancelled by the server
+    void putStats();
+    // PURPOSE:     Queue the counters of the threads for the server
+    double calibrate();
+    // PURPOSE:     Evaluations of the builtin FUNCTION per second
+    //              the threads make together
+    double now();
+    // PURPOSE:     Monotonic time in seconds
+    void serveServer();
+    // PURPOSE:     Calculate the tasks until the server says MSG_BYE
+    void receiveFunc();
+    // PURPOSE:     Receive the integrand bytecode after MSG_FUNC
+    void receiveSweep();
+    // PURPOSE:     Receive the records of the sweep after MSG_SWEEP
+    void putValues();
+    // PURPOSE:     Queue the integrals of the records of the sweep task
+    int checkTask();
+    // PURPOSE:     1 if the kernels can compute the task with f(x)
+    unsigned long long stepPoints();
+    // PURPOSE:     Evaluations of f(x) per step of the task
+    long double calculate();
+    // PURPOSE:     Split the task among the threads and sum them up
+    int takeBlock(struct thread_task* task, unsigned long long* b);
+    // PURPOSE:     The next block of the thread from the front of its share,
+    //              or the first of the back half it steals from the thread
+    //              with the most blocks left. 0 if no thread has blocks left
+    long double blockSum(unsigned long long b, long double* err, unsigned long long* n);
+    // PURPOSE:     The sum of the block b of the task, its steps go to n
+    void* integrateThread(void* arg);
+    // PURPOSE:     The worker of the thread pool, waits for the tasks
+    //              from calculate() until the pool is stopped
 
 //==============================================================================
 // GLOBAL VARIABLES
@@ -97,12 +219,52 @@ struct net_msg {
     // Network variables
     int sock, bytes;
     socklen_t addr_len = sizeof(struct sockaddr_in);
+    struct wire_buf in, out;    // received and queued frames
+    struct wire_frame frame;    // the frame being served
+    long frame_size;            // its size, 0 if none
+    unsigned frame_next;        // its next record
 
     // Calculation process variables and parameters
-    long double distance, distance2;
-    long double* data;
+    long double distance;
+    unsigned long long block;   // steps of a block of the task
+    struct dsum *leaves,        // the sums of the blocks
+                *leaf_errors;
+    unsigned long long leaves_size;
+    struct sweep_record* records;   // of the sweep, SWEEP_MAX_RECORDS
+    unsigned records_len;
+    struct dsum* values;        // the integrals of the records of the task
+    const struct simpson_kernel* kernel;    // Simpson kernel for the threads
+    struct expr func;       // integrand, func.ops == 0 for the builtin FUNCTION
+    struct thread_task** data;  // allocated by the threads themselves
     pthread_t* threads;
+    int* cpus;                  // CPU for every thread, -1 if not pinned
+    struct placement placement;
+    double rate = 0;        // calibrated evaluations per second, 0 until the first connect
     int num_threads_req;    // Number of threads required from the server
+    int daemon_mode = 0;    // Serve the servers until killed
+    int progress_ms = PROGRESS_MS;  // 0 for no progress messages
+    struct discovery discovery;     // the port, the group and the servers
+
+    // Cancel variables
+    unsigned cancelled[CANCEL_MEMORY];  // the last cancelled jobs
+    unsigned cancelled_next;
+
+    // The thread counters changed since they were sent
+    int stats_dirty = 0;
+
+    // Drain variables
+    volatile sig_atomic_t serving = 0;  // connected to the server
+    volatile sig_atomic_t drain = 0;    // 1 once signalled, 2 once MSG_DRAIN is sent
+
+    // Thread pool variables
+    pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t  pool_start = PTHREAD_COND_INITIALIZER,
+                    pool_done  = PTHREAD_COND_INITIALIZER;
+    unsigned pool_round  = 0;   // incremented for every task
+    unsigned pool_active = 0;   // threads taking part in the current round
+    unsigned pool_left   = 0;   // threads still calculating
+    int pool_stop = 0;
+    int pool_cancel = 0;        // the threads stop after the current slice
 
 //==============================================================================
 // MAIN CODE SECTION
@@ -110,145 +272,684 @@ struct net_msg {
 
 int main(int argc, char** argv) {
     // ARGS CHECK
-    if (argc != 2)
+    char kernels[BUFSIZ];
+    const char* kernel_name = NULL;
+    int opt;
+    simpson_list(kernels, sizeof(kernels));
+    discovery_init(&discovery, BROADCAST_PORT);
+    while ((opt = getopt(argc, argv, "dk:p:l:P:M:S:")) != -1) {
+        if (opt == 'k')
+            kernel_name = optarg;
+        else if (opt == 'd')
+            daemon_mode = 1;
+        else if (opt == 'p' && sscanf(optarg, "%d", &progress_ms) == 1 && progress_ms >= 0)
+            continue;
+        else if (opt == 'l' && (log_level = log_parse(optarg)) >= 0)
+            continue;
+        else if (opt == 'P' && sscanf(optarg, "%d", &discovery.port) == 1 &&
+                 discovery.port > 0 && discovery.port < 65536)
+            continue;
+        else if (opt == 'M' && discovery_group(&discovery, optarg))
+            continue;
+        else if (opt == 'S' && discovery_servers(&discovery, optarg))
+            continue;
+        else {
+            printf("USAGE: %s [-d] [-k %s] [-p progress_ms] [-l error|warn|info|debug] [-P port] [-M group] [-S host[:port],...] [NUMBER OF THREADS]\n", argv[0], kernels);
+            exit(ERROR_INPUT);
+        }
+    }
+
+    if (optind != argc - 1)
     {
-        printf("USAGE: %s [NUMBER OF THREADS]", argv[0]);
+        printf("USAGE: %s [-d] [-k %s] [-p progress_ms] [-l error|warn|info|debug] [-P port] [-M group] [-S host[:port],...] [NUMBER OF THREADS]\n", argv[0], kernels);
         exit(ERROR_INPUT);
     }
 
-    if (!sscanf(argv[1], "%d", &num_threads_req))
+    if (sscanf(argv[optind], "%d", &num_threads_req) != 1 || num_threads_req <= 0)
     {
         printf("ERROR: The number of clients should be positive integer");
         exit(ERROR_INPUT);
     }
 
-    // Get interval via net from the server
-    waitBroadcast();
-    waitTask();
-
-    // Calculating integral
-    if (!(threads = malloc(msg.cores * sizeof(pthread_t))) ||
-        !(data = malloc(msg.cores * sizeof(long double))))
+    if (!(kernel = simpson_select(kernel_name)))
+    {
+        printf("ERROR: The kernel is not supported, try one of %s\n", kernels);
+        exit(ERROR_INPUT);
+    }
+    PRINT_LINE("Simpson kernel: %s", kernel->name);
+
+    // Start the thread pool
+    if (!(threads = malloc(num_threads_req * sizeof(pthread_t))) ||
+        !(records = malloc(SWEEP_MAX_RECORDS * sizeof(struct sweep_record))) ||
+        !(values = malloc(SWEEP_MAX_RECORDS * sizeof(struct dsum))) ||
+        !(data = calloc(num_threads_req, sizeof(struct thread_task*))) ||
+        !(cpus = malloc(num_threads_req * sizeof(int))))
         PRINT_ERR("Memory allocation failed");
 
-    distance = msg.distance;
-    distance2 = distance / 2;
-    long double local_from = msg.local_from,
-                local_dist = (msg.local_to - msg.local_from) / msg.cores;
-
-    PRINT_LINE("Calculating integral at [%.6Lf:%.6Lf] with %u steps)", msg.local_from, msg.local_to, msg.steps);
-
-    for (unsigned i = 0; i < msg.cores; ++i, local_from += local_dist) {
-        data[i] = local_from;
-        if (pthread_create(&threads[i], NULL, &integrateThread, &data[i]))
-            PRINT_ERR("Cannot create thread");
+    if (topology_plan(num_threads_req, cpus, &placement)) {
+        PRINT_LINE("Placement: %u physical cores + %u hyperthreads, %u socket%s, %u NUMA node%s",
+                   placement.phys, placement.smt, placement.sockets, (placement.sockets > 1) ? "s" : "",
+                   placement.nodes, (placement.nodes > 1) ? "s" : "");
     }
-
-    long double S = 0, *r;
-    for (unsigned i = 0; i < msg.cores; ++i) {
-        if (pthread_join(threads[i], (void**) &r))
+    else
+        PRINT_LINE("CPU topology is unknown, the threads are not pinned");
+
+    // Wait for all the threads to get pinned and allocate their tasks,
+    // the signals come to the main thread only
+    sigset_t drain_signals, old_mask;
+    sigemptyset(&drain_signals);
+    sigaddset(&drain_signals, SIGTERM);
+    sigaddset(&drain_signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &drain_signals, &old_mask);
+    pool_left = num_threads_req;
+    for (int i = 0; i < num_threads_req; ++i)
+        if (pthread_create(&threads[i], NULL, &integrateThread, (void*)(intptr_t)i))
+            PRINT_ERR("Cannot create thread");
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    // No SA_RESTART: the read waiting for the tasks wakes up to send the drain
+    struct sigaction action;
+    memset(&action, 0, sizeof(struct sigaction));
+    action.sa_handler = onSignal;
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+    pthread_mutex_lock(&pool_mutex);
+    while (pool_left)
+        pthread_cond_wait(&pool_done, &pool_mutex);
+    pthread_mutex_unlock(&pool_mutex);
+
+    // Find the server via net and serve it
+    do {
+        connectServer();
+        serving = 1;
+        serveServer();
+        serving = 0;
+
+        shutdown(sock, SHUT_RDWR);
+        close(sock);
+    } while (daemon_mode && !drain);
+
+    // Stop the thread pool
+    pthread_mutex_lock(&pool_mutex);
+    pool_stop = 1;
+    pthread_cond_broadcast(&pool_start);
+    pthread_mutex_unlock(&pool_mutex);
+    for (int i = 0; i < num_threads_req; ++i)
+        if (pthread_join(threads[i], NULL))
             PRINT_ERR("Cannot join thread");
-        S += *r;
-    }
-    PRINT_LINE("Partial sum == %.6Lf", S);
-
-    msg.distance = S;
-    TRY_TO(bytes = write(sock, &msg, sizeof(struct net_msg)));
-        if (bytes != sizeof(struct net_msg))
-            PRINT_ERR("Cannot send net_msg");
 
-    shutdown(sock, SHUT_RDWR);
-    close(sock);
+    for (int i = 0; i < num_threads_req; ++i) {
+        pthread_mutex_destroy(&data[i]->lock);
+        free(data[i]);
+    }
     free(threads);
     free(data);
+    free(cpus);
+    free(leaves);
+    free(leaf_errors);
+    free(records);
+    free(values);
+    wire_free(&in);
+    wire_free(&out);
     exit(EXIT_SUCCESS);
 }
 
 
-void waitBroadcast() {
-    // Prepare for socket creation
-    int bsock, recv_bytes;
-    socklen_t baddr_len = sizeof(struct sockaddr_in);
+void connectServer() {
+
+    // Find the server and connect to it via TCP
+    sock = discovery_connect(&discovery, &addr);
+    getsockname(sock, (struct sockaddr*)&baddr, &addr_len);
+    PRINT_LINE("Connected to server via port %d", ntohs(baddr.sin_port));
+
+    // A new connection starts with no frames and the builtin f(x)
+    in.len = out.len = 0;
+    frame_size = frame_next = 0;
+    cancelled_next = 0;
+    func.ops = 0;
+    records_len = 0;
+
+    // The machine is the same on the reconnects of the daemon
+    if (!rate) {
+        rate = calibrate();
+        PRINT_LINE("Calibrated: %.3g evaluations of f(x) per second", rate);
+    }
+    memset(&msg, 0, sizeof(struct net_msg));
+    msg.type = MSG_HELLO;
+    msg.cores = num_threads_req;
+    msg.placement = placement;
+    msg.rate = rate;
+    msg.width = kernel->width;
+    wire_put(&out, &msg);
+    sendFrames();
+    PRINT_LINE("Waiting for the task to calculate");
+}
+
+
+int waitTask() {
+    if (drain == 1)
+        sendDrain();
+    while (!frame_size || frame_next == frame.count) {
+        wire_consume(&in, frame_size);
+        frame_next = 0;
+
+        // Read until the frame is complete, the results go first
+        while (!(frame_size = wire_frame(in.data, in.len, &frame))) {
+            if (stats_dirty)
+                putStats();
+            if (drain == 1)
+                sendDrain();
+            sendFrames();
+            bytes = read(sock, wire_space(&in, BUFSIZ), BUFSIZ);
+            if (bytes == -1 && errno == EINTR)
+                continue;
+            TRY_TO(bytes);
+            if (!bytes && daemon_mode) {
+                PRINT_LINE("The connection is closed");
+                return MSG_BYE;
+            }
+            if (!bytes)
+                PRINT_ERR("The connection is closed");
+            in.len += bytes;
+        }
+        if (frame_size < 0)
+            PRINT_ERR("Cannot receive the frame");
+
+        // The integrand and the sweep are one message of the whole frame
+        if (frame.type == MSG_FUNC || frame.type == MSG_SWEEP) {
+            frame_next = frame.count;
+            return frame.type;
+        }
+    }
 
-    // Create a socket
-    TRY_TO(bsock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP));
-    baddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    baddr.sin_port = htons(BROADCAST_PORT);
-    baddr.sin_family = AF_INET;
+    wire_record(&frame, frame_next++, &msg);
+    return msg.type;
+}
 
-    // Try to bind a socket to the port if it is available
-    int ld1 = 1;
-    TRY_TO(setsockopt(bsock, SOL_SOCKET, SO_REUSEPORT, &ld1, sizeof(ld1)));
-    TRY_TO(bind(bsock, (struct sockaddr*)&baddr, baddr_len));
 
-    PRINT_LINE("Waiting for server...");
+void sendFrames() {
+    unsigned long done = 0;
+    wire_seal(&out);
+    while (done < out.len) {
+        bytes = write(sock, out.data + done, out.len - done);
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        TRY_TO(bytes);
+        done += bytes;
+    }
+    wire_consume(&out, done);
+}
 
-    // Receive net_msg from the server
-    TRY_TO(recv_bytes = recvfrom(bsock, &msg, sizeof(struct net_msg),
-        0, (struct sockaddr *)&baddr, &baddr_len));
-    if (recv_bytes != sizeof(struct net_msg))
-        PRINT_ERR("Cannot receive net_msg");
-    PRINT_LINE("Received %d bytes from server port %d", recv_bytes, msg.tcp_port);
-    baddr.sin_port = msg.tcp_port;
 
-    // Close the broadcast socket gently
-    shutdown(bsock, SHUT_RDWR);
-    close(bsock);
+void onSignal(int sig) {
+    (void)sig;
+    if (drain || !serving)
+        _exit(EXIT_FAILURE);
+    drain = 1;
 }
 
 
-void waitTask() {
+void sendDrain() {
+    struct net_msg leave;
+    memset(&leave, 0, sizeof(struct net_msg));
+    leave.type = MSG_DRAIN;
+    wire_put(&out, &leave);
+    sendFrames();
+    drain = 2;
+    PRINT_LINE("Draining: the tasks given are computed, then the client leaves");
+}
 
-    // Try to create a TCP socket
-    TRY_TO(sock = socket(PF_INET, SOCK_STREAM, 0));
-    memset(&addr, 0, addr_len);
-    addr.sin_addr.s_addr = baddr.sin_addr.s_addr;
-    addr.sin_port = baddr.sin_port;
-    addr.sin_family = AF_INET;
 
-    // Try to connect to the server via TCP
-    int ld1 = 1;
-    TRY_TO(setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &ld1, sizeof(ld1)));
-    TRY_TO(connect(sock, (struct sockaddr*)&addr, addr_len));
-    getsockname(sock, (struct sockaddr*)&baddr, &addr_len);
-    PRINT_LINE("Connected to server via port %d", ntohs(baddr.sin_port));
+void serveServer() {
+    int type;
+    while ((type = waitTask()) != MSG_BYE) {
+        if (type == MSG_DONE) {
+            PRINT_LINE("The job is done, waiting for the next one");
+            continue;
+        }
+        if (type == MSG_FUNC) {
+            receiveFunc();
+            continue;
+        }
+        if (type == MSG_SWEEP) {
+            receiveSweep();
+            continue;
+        }
+        if (type == MSG_CANCEL) {
+            if (!isCancelled(msg.job))
+                cancelled[cancelled_next++ % CANCEL_MEMORY] = msg.job;
+            continue;
+        }
+
+        // The bytecode and the task come from the net
+        if (!checkTask())
+            PRINT_ERR("The task of the job %u does not fit f(x) or the kernels", msg.job);
+
+        // The tasks of a cancelled job are answered at once
+        watchServer();
+        if (isCancelled(msg.job)) {
+            msg.distance = msg.error = 0;
+            msg.node_sum = msg.node_error = (struct dsum) {0, 0};
+            PRINT_LINE("The task of the cancelled job %u is dropped", msg.job);
+        }
+        else {
+            msg.distance = calculate();
+            if (msg.method == METHOD_SWEEP && !isCancelled(msg.job))
+                putValues();
+        }
+        if (msg.method == METHOD_KRONROD)
+            DBG_PRINT("Partial sum == %.6Lf +- %.3Le", msg.distance, msg.error);
+        else
+            PRINT_LINE("Partial sum == %.6Lf", msg.distance);
+
+        // The result is also a request for the next chunk,
+        // unless the drain goes before it
+        if (drain == 1)
+            sendDrain();
+        msg.type = MSG_RESULT;
+        wire_put(&out, &msg);
+    }
+    PRINT_LINE("No more tasks");
+}
 
-    msg.cores = num_threads_req;
-    TRY_TO(bytes = write(sock, &msg, sizeof(struct net_msg)));
-    if (bytes != sizeof(struct net_msg))
-        PRINT_ERR("Cannot send net_msg")
+
+void receiveFunc() {
+    // The records of the last sweep are not the ones of the new f(x)
+    records_len = 0;
+    if (!wire_func(&frame, &func))
+        PRINT_ERR("f(x) bytecode is broken");
+    if (!func.ops)
+        PRINT_LINE("f(x) is the builtin one, %s kernel", kernel->name)
     else
-        PRINT_LINE("Waiting for the task to calculate");
-
-    TRY_TO(bytes = read(sock, &msg, sizeof(struct net_msg)));
-    if (!bytes)
-        PRINT_ERR("The connection is closed")
-    else if (bytes != sizeof(struct net_msg))
-        PRINT_ERR("Cannot receive net_msg");
-}
-
-
-void* integrateThread(void* data) {
-    long double local_dist  = distance;
-    long double local_dist2 = distance2;
-    long double srt         = *(long double*)data;
-    long double mid         = srt + local_dist2;
-    long double end         = srt + local_dist;
-    long double f_srt       = FUNCTION(srt);
-    long double f_end;
-    long double local_res   = 0;
-    unsigned stepsPerThread = msg.steps / msg.cores;
-
-    PRINT_LINE("Hello thread at [%.6Lf:%.6Lf] with %u steps", srt, srt + distance * stepsPerThread, stepsPerThread);
-    for (unsigned i = 0; i < stepsPerThread; ++i) {
-        f_end = FUNCTION(end);
-        local_res += f_srt + 4 * FUNCTION(mid) + f_end;
-        f_srt = f_end;          // next dx
-        srt = end;              //
-        mid += local_dist;      //
-        end += local_dist;      //
-    }
-
-    *(long double*)data = local_res * distance / 6;
-    pthread_exit(data);
+        PRINT_LINE("f(x) is %u ops of bytecode", func.ops);
+}
+
+
+void receiveSweep() {
+    if (!wire_sweep(&frame, records))
+        PRINT_ERR("The sweep has more than %d records", SWEEP_MAX_RECORDS);
+    records_len = frame.count;
+    PRINT_LINE("The sweep has %u records", records_len);
+}
+
+
+void putValues() {
+    struct net_msg value;
+    memset(&value, 0, sizeof(struct net_msg));
+    value.type = MSG_VALUE;
+    value.job = msg.job;
+    for (unsigned long long r = 0; r < msg.steps; ++r) {
+        value.first = msg.first + r;
+        value.node_sum = values[r];
+        wire_put(&out, &value);
+    }
+}
+
+
+int checkTask() {
+    unsigned max_dims = (msg.method == METHOD_CUBATURE) ? CUBATURE_MAX_DIM : EXPR_MAX_DIM;
+    if (msg.method == METHOD_SIMPSON || msg.method == METHOD_KRONROD || msg.method == METHOD_ROMBERG)
+        return msg.dims == 1 && expr_dims(&func) == 1;
+    if (msg.method == METHOD_SWEEP)
+        return func.ops && expr_dims(&func) <= 2 && msg.grid && msg.steps &&
+               msg.first <= records_len && msg.steps <= records_len - msg.first;
+    if (msg.method != METHOD_CUBATURE && msg.method != METHOD_QMC)
+        return 0;
+    return func.ops && msg.grid && msg.dims >= expr_dims(&func) && msg.dims <= max_dims &&
+           (msg.method == METHOD_CUBATURE || msg.grid <= QMC_MAX_POINTS);
+}
+
+
+unsigned long long stepPoints() {
+    switch (msg.method) {
+        case METHOD_KRONROD:    return KRONROD_POINTS;
+        case METHOD_CUBATURE:   return cubature_points(msg.dims);
+        case METHOD_QMC:        return 1;
+        case METHOD_ROMBERG:    return 1;
+        case METHOD_SWEEP:      return SIMPSON_POINTS * msg.grid;
+        default:                return SIMPSON_POINTS;
+    }
+}
+
+
+void watchServer() {
+    struct pollfd p = {sock, POLLIN, 0};
+    while (poll(&p, 1, 0) == 1 && (p.revents & POLLIN)) {
+        int got = recv(sock, wire_space(&in, BUFSIZ), BUFSIZ, MSG_DONTWAIT);
+        if (got <= 0)
+            break;  // waitTask() sees it
+        in.len += got;
+    }
+
+    // The frame being served may have moved, the cancels are looked for
+    // among the frames after it
+    long size, used = frame_size;
+    struct wire_frame next;
+    if (frame_size)
+        wire_frame(in.data, in.len, &frame);
+    while ((size = wire_frame(in.data + used, in.len - used, &next)) > 0) {
+        for (unsigned i = 0; next.type == MSG_CANCEL && i < next.count; ++i) {
+            struct net_msg cancel;
+            wire_record(&next, i, &cancel);
+            if (!isCancelled(cancel.job))
+                cancelled[cancelled_next++ % CANCEL_MEMORY] = cancel.job;
+        }
+        used += size;
+    }
+
+    if (isCancelled(msg.job)) {
+        pthread_mutex_lock(&pool_mutex);
+        pool_cancel = 1;
+        pthread_mutex_unlock(&pool_mutex);
+    }
+}
+
+
+void sendProgress() {
+    struct net_msg progress;
+    memset(&progress, 0, sizeof(struct net_msg));
+    progress.type = MSG_PROGRESS;
+
+    pthread_mutex_lock(&pool_mutex);
+    for (unsigned i = 0; i < pool_active; ++i) {
+        progress.steps += data[i]->done;
+        progress.distance += data[i]->res;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    wire_put(&out, &progress);
+    sendFrames();
+}
+
+
+int isCancelled(unsigned job) {
+    for (unsigned i = 0; i < CANCEL_MEMORY && i < cancelled_next; ++i)
+        if (cancelled[i] == job)
+            return 1;
+    return 0;
+}
+
+
+void putStats() {
+    struct net_msg stats;
+    memset(&stats, 0, sizeof(struct net_msg));
+    stats.type = MSG_STATS;
+
+    // The threads are parked, nobody writes the counters
+    for (int i = 0; i < num_threads_req; ++i) {
+        stats.stats = data[i]->stats;
+        stats.stats.thread = i;
+        wire_put(&out, &stats);
+    }
+    stats_dirty = 0;
+}
+
+
+double calibrate() {
+    // The run is not the work of a job: no progress, no counters
+    struct thread_stats saved[num_threads_req];
+    for (int i = 0; i < num_threads_req; ++i)
+        saved[i] = data[i]->stats;
+    int saved_ms = progress_ms;
+    progress_ms = 0;
+
+    // The steps grow until the run is long enough
+    unsigned long long steps = CALIBRATE_STEPS;
+    double elapsed;
+    while (1) {
+        memset(&msg, 0, sizeof(struct net_msg));
+        msg.type = MSG_TASK;
+        msg.method = METHOD_SIMPSON;
+        msg.cores = num_threads_req;
+        msg.steps = steps * num_threads_req;
+        msg.local_from = 1;
+        msg.distance = 1.0L / msg.steps;
+
+        double start = now();
+        calculate();
+        elapsed = now() - start;
+        if (elapsed >= CALIBRATE_SECONDS)
+            break;
+
+        // Straight to the length by the rate of this run, with a margin
+        double grow = (elapsed > 0) ? 1.25 * CALIBRATE_SECONDS / elapsed : 64;
+        steps *= (grow < 64) ? grow : 64;
+    }
+
+    for (int i = 0; i < num_threads_req; ++i)
+        data[i]->stats = saved[i];
+    stats_dirty = 0;
+    progress_ms = saved_ms;
+    return (double)SIMPSON_POINTS * steps * num_threads_req / elapsed;
+}
+
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+long double calculate() {
+    if (msg.cores > (unsigned)num_threads_req)
+        msg.cores = num_threads_req;
+    msg.placement = placement;
+
+    distance = msg.distance;
+
+    DBG_PRINT("Calculating integral at [%.6Lf:%.6Lf] with %llu steps", msg.local_from, msg.local_to, msg.steps);
+
+    // The task is cut into the blocks of the reduction tree (see reduce.h),
+    // every thread starts with an equal share, the first ones take the
+    // remainder, the idle ones steal later. The records of a sweep are
+    // integrated by blocks of their own
+    block = (msg.method == METHOD_SWEEP) ? SWEEP_BLOCK : reduce_block(stepPoints());
+    unsigned long long blocks = (msg.steps + block - 1) / block,
+                       share = blocks / msg.cores,
+                       extra = blocks % msg.cores,
+                       first = 0;
+    if (blocks > leaves_size) {
+        leaves_size = blocks;
+        if (!(leaves = realloc(leaves, leaves_size * sizeof(struct dsum))) ||
+            !(leaf_errors = realloc(leaf_errors, leaves_size * sizeof(struct dsum))))
+            PRINT_ERR("Memory allocation failed");
+    }
+    memset(leaves, 0, blocks * sizeof(struct dsum));
+    memset(leaf_errors, 0, blocks * sizeof(struct dsum));
+    for (unsigned i = 0; i < msg.cores; ++i) {
+        data[i]->block = first;
+        first += share + (i < extra);
+        data[i]->end = first;
+    }
+
+    // Wake up the parked threads and wait for all of them to finish,
+    // looking at the socket and reporting the progress meanwhile
+    struct timespec until, last;
+    clock_gettime(CLOCK_MONOTONIC, &last);
+    pthread_mutex_lock(&pool_mutex);
+    pool_active = pool_left = msg.cores;
+    pool_cancel = 0;
+    ++pool_round;
+    pthread_cond_broadcast(&pool_start);
+    while (pool_left) {
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += CANCEL_POLL_MS * 1000000L;
+        until.tv_sec += until.tv_nsec / 1000000000L;
+        until.tv_nsec %= 1000000000L;
+        if (!pthread_cond_timedwait(&pool_done, &pool_mutex, &until) || !pool_left)
+            continue;
+        pthread_mutex_unlock(&pool_mutex);
+
+        watchServer();
+        if (drain == 1)
+            sendDrain();
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        if (progress_ms && (t.tv_sec - last.tv_sec) * 1000 + (t.tv_nsec - last.tv_nsec) / 1000000 >= progress_ms) {
+            sendProgress();
+            last = t;
+        }
+        pthread_mutex_lock(&pool_mutex);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    // The threads done early waited for the last one
+    double end = now();
+    for (unsigned i = 0; i < msg.cores; ++i)
+        data[i]->stats.idle += end - data[i]->finished;
+    stats_dirty = 1;
+
+    // The blocks go up the tree the way the server joins the tasks
+    msg.node_sum = dsum_tree(leaves, blocks);
+    msg.node_error = dsum_tree(leaf_errors, blocks);
+    msg.error = dsum_value(msg.node_error);
+    return dsum_value(msg.node_sum);
+}
+
+
+int takeBlock(struct thread_task* task, unsigned long long* b) {
+    pthread_mutex_lock(&task->lock);
+    int own = task->block < task->end;
+    if (own)
+        *b = task->block++;
+    pthread_mutex_unlock(&task->lock);
+    if (own)
+        return 1;
+
+    while (1) {
+        struct thread_task* victim = NULL;
+        unsigned long long most = 0, left;
+        for (unsigned i = 0; i < pool_active; ++i) {
+            pthread_mutex_lock(&data[i]->lock);
+            left = data[i]->end - data[i]->block;
+            pthread_mutex_unlock(&data[i]->lock);
+            if (left > most) {
+                most = left;
+                victim = data[i];
+            }
+        }
+        if (!victim)
+            return 0;
+
+        // The victim may have taken them meanwhile, then look again
+        pthread_mutex_lock(&victim->lock);
+        left = victim->end - victim->block;
+        unsigned long long from = victim->end - (left + 1) / 2,
+                           end = victim->end;
+        victim->end = from;
+        pthread_mutex_unlock(&victim->lock);
+        if (!left)
+            continue;
+
+        pthread_mutex_lock(&task->lock);
+        task->block = from + 1;
+        task->end = end;
+        pthread_mutex_unlock(&task->lock);
+        *b = from;
+        return 1;
+    }
+}
+
+
+long double blockSum(unsigned long long b, long double* err, unsigned long long* n) {
+    unsigned long long first = msg.first + b * block;
+    long double from = msg.local_from + distance * first;
+    *n = (msg.steps - b * block < block) ? msg.steps - b * block : block;
+    *err = 0;
+    if (msg.method == METHOD_KRONROD)
+        return kronrod_integrate(&func, from, distance, *n, err);
+    if (msg.method == METHOD_CUBATURE)
+        return cubature_integrate(&func, msg.dims, msg.local_from, msg.local_to, msg.grid,
+                                  first, *n, err);
+    if (msg.method == METHOD_QMC)
+        return qmc_integrate(&func, msg.dims, msg.local_from, msg.local_to, msg.grid,
+                             msg.seed, first, *n);
+    if (msg.method == METHOD_SWEEP)
+        return dsum_value(sweep_integrate(&func, records + first, *n, msg.grid,
+                                          values + b * block));
+    if (msg.method == METHOD_ROMBERG)
+        return func.ops ? midpoint_expr(&func, from, distance, *n)
+                        : kernel->midpoint(from, distance, *n);
+    if (func.ops)
+        return simpson_expr(&func, from, distance, *n);
+    return kernel->integrate(from, distance, *n);
+}
+
+
+void* integrateThread(void* arg) {
+    unsigned id = (intptr_t)arg,
+             seen = 0;
+
+    // Pin first: the task is then allocated on the local NUMA node
+    topology_pin(cpus[id]);
+    struct thread_task* task;
+    if (posix_memalign((void**)&task, 64, sizeof(struct thread_task)))
+        PRINT_ERR("Memory allocation failed");
+    memset(task, 0, sizeof(struct thread_task));
+    pthread_mutex_init(&task->lock, NULL);
+    data[id] = task;
+
+    pthread_mutex_lock(&pool_mutex);
+    if (!--pool_left)
+        pthread_cond_signal(&pool_done);
+    while (1) {
+        // Parked until calculate() starts a new round
+        while (pool_round == seen && !pool_stop)
+            pthread_cond_wait(&pool_start, &pool_mutex);
+        if (pool_stop)
+            break;
+        seen = pool_round;
+        if (id >= pool_active)
+            continue;
+        pthread_mutex_unlock(&pool_mutex);
+
+        DBG_PRINT("Hello thread at the block %llu with %llu blocks", task->block, task->end - task->block);
+        pthread_mutex_lock(&pool_mutex);
+        task->res = task->err = 0;
+        task->done = 0;
+        pthread_mutex_unlock(&pool_mutex);
+        double start = now();
+
+        // The blocks are summed one by one, each from its own first step,
+        // the sum is published after every slice and at the end
+        unsigned long long slice = (msg.method == METHOD_KRONROD || msg.method == METHOD_CUBATURE) ?
+                                   SLICE_PANELS : (msg.method == METHOD_SWEEP) ? 1 : SLICE_STEPS,
+                           pending = 0, b;
+        long double pending_res = 0, pending_err = 0;
+        int stop = 0, more = 1;
+        while (!stop && more) {
+            if ((more = takeBlock(task, &b))) {
+                long double err;
+                unsigned long long n;
+                long double part = blockSum(b, &err, &n);
+                leaves[b] = dsum_of(part);
+                leaf_errors[b] = dsum_of(err);
+                pending += n;
+                pending_res += part;
+                pending_err += err;
+                if (pending < slice)
+                    continue;
+            }
+            pthread_mutex_lock(&pool_mutex);
+            task->res += pending_res;
+            task->err += pending_err;
+            task->done += pending;
+            stop = pool_cancel;
+            pthread_mutex_unlock(&pool_mutex);
+            pending = 0;
+            pending_res = pending_err = 0;
+        }
+
+        pthread_mutex_lock(&pool_mutex);
+        task->finished = now();
+        task->stats.busy += task->finished - start;
+        task->stats.steps += task->done;
+        task->stats.evals += task->done * stepPoints();
+        if (!--pool_left)
+            pthread_cond_signal(&pool_done);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    return NULL;
 }
@@ -0,0 +1,253 @@
+/* File:     cubature.c
+ * Purpose:  Kernels of the multi-dimensional integrals over the hypercube
+ * Note:
+ |    1.  The points of several cells are evaluated as one block,
+ |        the same way kronrod_integrate() does it, a cell of many
+ |        points may span several blocks
+ |    2.  The Sobol direction numbers are the ones of Joe and Kuo
+ |        (new-joe-kuo-6.21201), the points go in the Gray code order,
+ |        so the next point is one XOR per dimension
+ |    3.  The scramble is the hash-based nested uniform one of Burley
+ |        ("Practical Hash-based Owen Scrambling", 2020): the bits of
+ |        the coordinate are reversed, hashed with the seed of the
+ |        replicate and dimension and reversed back
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+//==============================================================================
+// INCLUDE SECTION
+//==============================================================================
+
+#include <math.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "expr.h"
+#include "cubature.h"
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+#define SOBOL_BITS      32      // bits of a coordinate
+
+// 3-point Gauss-Legendre rule on [-1, 1]
+static const double gauss_node[CUBATURE_NODES] = {
+    -0.774596669241483377035853079956480, 0, 0.774596669241483377035853079956480
+};
+static const double gauss_weight[CUBATURE_NODES] = {
+    0.555555555555555555555555555555556,
+    0.888888888888888888888888888888889,
+    0.555555555555555555555555555555556
+};
+
+// The primitive polynomials and the initial direction numbers
+// of the dimensions 2 ... EXPR_MAX_DIM
+static const struct {
+    unsigned degree, coeffs, m[5];
+} sobol_poly[EXPR_MAX_DIM - 1] = {
+    {1, 0, {1}},
+    {2, 1, {1, 3}},
+    {3, 1, {1, 3, 1}},
+    {3, 2, {1, 1, 1}},
+    {4, 1, {1, 1, 3, 3}},
+    {4, 4, {1, 3, 5, 13}},
+    {5, 2, {1, 1, 5, 5, 17}},
+    {5, 4, {1, 1, 5, 5, 5}},
+    {5, 7, {1, 1, 7, 11, 19}},
+};
+
+//==============================================================================
+// CUBATURE SECTION
+//==============================================================================
+
+unsigned long long cubature_points(unsigned dims) {
+    unsigned long long points = 1;
+    while (dims--)
+        points *= CUBATURE_NODES;
+    return points;
+}
+
+// The points of the block and the cells they belong to
+struct cubature_block {
+    double x[CUBATURE_MAX_DIM * EXPR_BLOCK], y[EXPR_BLOCK], w[EXPR_BLOCK];
+    unsigned long long cell[EXPR_BLOCK];
+    int center[EXPR_BLOCK];
+    unsigned n;
+
+    unsigned long long current;     // the cell being summed
+    long double gauss, mid,         // its rules so far
+                sum, error;
+};
+
+static void cubature_close(struct cubature_block* b, long double scale, long double volume) {
+    long double cell = scale * b->gauss;
+    b->sum += cell;
+    b->error += fabsl(cell - volume * b->mid);
+    b->gauss = b->mid = 0;
+}
+
+static void cubature_flush(const struct expr* f, struct cubature_block* b,
+                           long double scale, long double volume) {
+    expr_eval(f, b->x, b->y, b->n);
+    for (unsigned k = 0; k < b->n; ++k) {
+        if (b->cell[k] != b->current) {
+            cubature_close(b, scale, volume);
+            b->current = b->cell[k];
+        }
+        b->gauss += b->w[k] * b->y[k];
+        if (b->center[k])
+            b->mid = b->y[k];
+    }
+    b->n = 0;
+}
+
+long double cubature_integrate(const struct expr* f, unsigned dims,
+                               long double from, long double to,
+                               unsigned long long grid,
+                               unsigned long long first,
+                               unsigned long long cells,
+                               long double* error) {
+    struct cubature_block b;
+    double h = (to - from) / grid, half = h / 2, center[CUBATURE_MAX_DIM];
+    unsigned long long per_cell = cubature_points(dims);
+    long double scale = powl(half, dims),     // the Gauss weights of a cell
+                volume = powl(h, dims);     // the weight of its center
+    b.n = 0;
+    b.current = 0;
+    b.gauss = b.mid = b.sum = b.error = 0;
+
+    for (unsigned long long c = 0; c < cells; ++c) {
+        // The center of the cell by the digits of its number
+        unsigned long long index = first + c;
+        for (unsigned d = 0; d < dims; ++d) {
+            center[d] = from + h * (index % grid + 0.5);
+            index /= grid;
+        }
+
+        // The point p is the node p % 3 in the first dimension and so on,
+        // the center is the middle node in all of them
+        for (unsigned long long p = 0; p < per_cell; ++p) {
+            unsigned long long q = p;
+            double weight = 1;
+            for (unsigned d = 0; d < dims; ++d, q /= CUBATURE_NODES) {
+                b.x[d * EXPR_BLOCK + b.n] = center[d] + half * gauss_node[q % CUBATURE_NODES];
+                weight *= gauss_weight[q % CUBATURE_NODES];
+            }
+            b.w[b.n] = weight;
+            b.cell[b.n] = c;
+            b.center[b.n] = (p == per_cell / 2);
+            if (++b.n == EXPR_BLOCK)
+                cubature_flush(f, &b, scale, volume);
+        }
+    }
+    if (b.n)
+        cubature_flush(f, &b, scale, volume);
+    if (cells)
+        cubature_close(&b, scale, volume);
+
+    *error = b.error;
+    return b.sum;
+}
+
+//==============================================================================
+// QUASI-MONTE CARLO SECTION
+//==============================================================================
+
+// The direction numbers, the last one of every dimension is zero
+static uint32_t sobol_v[EXPR_MAX_DIM][SOBOL_BITS + 1];
+static pthread_once_t sobol_once = PTHREAD_ONCE_INIT;
+
+static void sobol_init() {
+    // The first dimension is the van der Corput sequence
+    for (unsigned k = 0; k < SOBOL_BITS; ++k)
+        sobol_v[0][k] = 1u << (SOBOL_BITS - 1 - k);
+
+    for (unsigned d = 1; d < EXPR_MAX_DIM; ++d) {
+        unsigned s = sobol_poly[d - 1].degree,
+                 a = sobol_poly[d - 1].coeffs;
+        uint32_t m[SOBOL_BITS];
+        for (unsigned k = 0; k < SOBOL_BITS; ++k) {
+            if (k < s) {
+                m[k] = sobol_poly[d - 1].m[k];
+                continue;
+            }
+            m[k] = m[k - s] ^ (m[k - s] << s);
+            for (unsigned j = 1; j < s; ++j)
+                if ((a >> (s - 1 - j)) & 1)
+                    m[k] ^= m[k - j] << j;
+        }
+        for (unsigned k = 0; k < SOBOL_BITS; ++k)
+            sobol_v[d][k] = m[k] << (SOBOL_BITS - 1 - k);
+    }
+}
+
+static uint32_t reverse_bits(uint32_t v) {
+    v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+    v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+    v = ((v >> 4) & 0x0F0F0F0Fu) | ((v & 0x0F0F0F0Fu) << 4);
+    v = ((v >> 8) & 0x00FF00FFu) | ((v & 0x00FF00FFu) << 8);
+    return (v >> 16) | (v << 16);
+}
+
+static uint32_t scramble(uint32_t v, uint32_t seed) {
+    v = reverse_bits(v);
+    v += seed;
+    v ^= v * 0x6c50b47cu;
+    v ^= v * 0xb82f1e52u;
+    v ^= v * 0xc7afe638u;
+    v ^= v * 0x8d22f6e6u;
+    return reverse_bits(v);
+}
+
+// The seed of the dimension of the replicate, splitmix64
+static uint32_t scramble_seed(unsigned long long seed, unsigned replicate, unsigned d) {
+    uint64_t z = seed + 0x9E3779B97F4A7C15ull * (1 + replicate * EXPR_MAX_DIM + d);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return (z ^ (z >> 31)) >> 32;
+}
+
+long double qmc_integrate(const struct expr* f, unsigned dims,
+                          long double from, long double to,
+                          unsigned long long points,
+                          unsigned long long seed,
+                          unsigned long long first,
+                          unsigned long long n) {
+    double x[EXPR_MAX_DIM * EXPR_BLOCK], y[EXPR_BLOCK];
+    double width = to - from;
+    uint32_t state[EXPR_MAX_DIM], shift[EXPR_MAX_DIM];
+    unsigned replicate = first / points;
+    uint64_t i = first % points,
+             gray = i ^ (i >> 1);
+    long double sum = 0;
+    pthread_once(&sobol_once, sobol_init);
+
+    // The first point from its number, the next ones by the Gray code
+    for (unsigned d = 0; d < dims; ++d) {
+        shift[d] = scramble_seed(seed, replicate, d);
+        state[d] = 0;
+        for (unsigned k = 0; k < SOBOL_BITS; ++k)
+            if ((gray >> k) & 1)
+                state[d] ^= sobol_v[d][k];
+    }
+
+    for (unsigned long long done = 0; done < n; ) {
+        unsigned m = (n - done < EXPR_BLOCK) ? n - done : EXPR_BLOCK;
+        for (unsigned k = 0; k < m; ++k, ++i) {
+            unsigned bit = __builtin_ctzll(i + 1);
+            for (unsigned d = 0; d < dims; ++d) {
+                x[d * EXPR_BLOCK + k] = from + width * ((scramble(state[d], shift[d]) + 0.5) * 0x1p-32);
+                state[d] ^= sobol_v[d][bit];
+            }
+        }
+        expr_eval(f, x, y, m);
+
+        double block = 0;
+        for (unsigned k = 0; k < m; ++k)
+            block += y[k];
+        sum += block;
+        done += m;
+    }
+
+    return sum * powl(width, dims) / points / QMC_REPLICATES;
+}
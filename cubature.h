@@ -0,0 +1,56 @@
+/* File:     cubature.h
+ * Purpose:  Kernels of the multi-dimensional integrals over the hypercube
+ * Note:
+ |    1.  The cube [from, to]^dims is cut into grid^dims equal cells,
+ |        numbered with the first coordinate changing fastest. Every cell
+ |        gets the tensor product of the 3-point Gauss rules, its center
+ |        (the 1-point rule) gives the error estimate
+ |    2.  The quasi-Monte Carlo integral is QMC_REPLICATES independent
+ |        scrambles of the first points of the Sobol sequence. The point
+ |        of any number is computed from the number, so the threads and
+ |        the clients share no state. The points of one call are in
+ |        one replicate, the number of the point tells which one
+ |    3.  f is the expression of the variables x1 ... xdims, the builtin
+ |        FUNCTION is one-dimensional
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+#ifndef CUBATURE_H
+#define CUBATURE_H
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+#define CUBATURE_NODES      3       // Gauss nodes per dimension of a cell
+#define CUBATURE_MAX_DIM    6       // 3^6 points per cell, QMC is for more
+#define QMC_REPLICATES      8       // independent scrambles of a QMC job
+#define QMC_MAX_POINTS      (1ULL << 32)    // points of one replicate
+
+struct expr;
+
+//==============================================================================
+// FUNCTION PROTOTYPES SECTION
+//==============================================================================
+
+    unsigned long long cubature_points(unsigned dims);
+    // PURPOSE:     Evaluations of f in one cell
+    long double cubature_integrate(const struct expr* f, unsigned dims,
+                                   long double from, long double to,
+                                   unsigned long long grid,
+                                   unsigned long long first,
+                                   unsigned long long cells,
+                                   long double* error);
+    // PURPOSE:     Sum of the cells first ... first + cells - 1 of the
+    //              grid, the sum of their error estimates goes to error
+    long double qmc_integrate(const struct expr* f, unsigned dims,
+                              long double from, long double to,
+                              unsigned long long points,
+                              unsigned long long seed,
+                              unsigned long long first,
+                              unsigned long long n);
+    // PURPOSE:     The share of the points first ... first + n - 1 in the
+    //              mean of the replicate estimates. The point number k is
+    //              the point k % points of the replicate k / points
+    //              scrambled by the seed
+
+#endif // CUBATURE_H
@@ -0,0 +1,228 @@
+/* File:     discovery.c
+ * Purpose:  How the clients and the relays find their server
+ * Note:
+ |    1.  The announcements come to the port every client of the host
+ |        binds with SO_REUSEPORT, so the answers to the probes go to the
+ |        socket the probe came from, not to the port: the answer to one
+ |        client is never taken by another one
+ |    2.  The datagrams that are not a frame of the expected type
+ |        are skipped, the port is shared with the other programs
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+//==============================================================================
+// INCLUDE SECTION
+//==============================================================================
+
+#include <poll.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "alerts.h"
+#include "wire.h"
+#include "discovery.h"
+
+//==============================================================================
+// SETUP SECTION
+//==============================================================================
+
+void discovery_init(struct discovery* d, int port) {
+    memset(d, 0, sizeof(struct discovery));
+    d->port = port;
+    d->group.s_addr = htonl(INADDR_ANY);
+}
+
+int discovery_group(struct discovery* d, const char* group) {
+    return inet_aton(group, &d->group) && IN_MULTICAST(ntohl(d->group.s_addr));
+}
+
+int discovery_servers(struct discovery* d, const char* list) {
+    char buf[BUFSIZ], *save, *host;
+    snprintf(buf, sizeof(buf), "%s", list);
+
+    for (host = strtok_r(buf, ",", &save); host; host = strtok_r(NULL, ",", &save)) {
+        struct addrinfo hints, *res;
+        int port = 0;
+        char* colon = strchr(host, ':');
+        if (colon) {
+            *colon = '\0';
+            if (sscanf(colon + 1, "%d", &port) != 1 || port <= 0 || port >= 65536)
+                return 0;
+        }
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (d->servers_len == DISCOVERY_MAX_SERVERS || getaddrinfo(host, NULL, &hints, &res))
+            return 0;
+        d->servers[d->servers_len] = *(struct sockaddr_in*)res->ai_addr;
+        d->servers[d->servers_len++].sin_port = htons(port);
+        freeaddrinfo(res);
+    }
+    return 1;
+}
+
+static int open_udp(int port, struct in_addr group) {
+    struct sockaddr_in addr;
+    int sock, yes = 1;
+    TRY_TO(sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP));
+    TRY_TO(setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)));
+    TRY_TO(setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &yes, sizeof(yes)));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    TRY_TO(bind(sock, (struct sockaddr*)&addr, sizeof(addr)));
+
+    if (port && group.s_addr != htonl(INADDR_ANY)) {
+        struct ip_mreq mreq;
+        mreq.imr_multiaddr = group;
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        TRY_TO(setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)));
+    }
+    TRY_TO(fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK));
+    return sock;
+}
+
+static void send_all(int sock, const struct discovery* d, const struct wire_buf* frame) {
+    // Nobody may listen yet, the errors are not fatal
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(d->port);
+    addr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+    sendto(sock, frame->data, frame->len, 0, (struct sockaddr*)&addr, sizeof(addr));
+    if (d->group.s_addr != htonl(INADDR_ANY)) {
+        addr.sin_addr = d->group;
+        sendto(sock, frame->data, frame->len, 0, (struct sockaddr*)&addr, sizeof(addr));
+    }
+}
+
+//==============================================================================
+// CLIENT SECTION
+//==============================================================================
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+static int try_connect(const struct sockaddr_in* server) {
+    // Not blocking, so a server of the list that is down costs little
+    int sock, err = 0;
+    socklen_t len = sizeof(err);
+    struct pollfd p;
+    TRY_TO(sock = socket(PF_INET, SOCK_STREAM, 0));
+    TRY_TO(fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK));
+    if (connect(sock, (const struct sockaddr*)server, sizeof(struct sockaddr_in)) == -1) {
+        p.fd = sock;
+        p.events = POLLOUT;
+        if (errno != EINPROGRESS || poll(&p, 1, DISCOVERY_CONNECT_MS) != 1 ||
+            getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err) {
+            close(sock);
+            return -1;
+        }
+    }
+    TRY_TO(fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK));
+    return sock;
+}
+
+static int take_port(int sock, struct sockaddr_in* server) {
+    unsigned char buf[BUFSIZ];
+    struct wire_frame frame;
+    struct net_msg msg;
+    socklen_t len = sizeof(struct sockaddr_in);
+    long bytes;
+    while ((bytes = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr*)server, &len)) >= 0) {
+        if (wire_frame(buf, bytes, &frame) != bytes || frame.type != MSG_PORT)
+            continue;
+        wire_record(&frame, 0, &msg);
+        server->sin_port = htons(msg.tcp_port);
+        return 1;
+    }
+    return 0;
+}
+
+int discovery_connect(const struct discovery* d, struct sockaddr_in* server) {
+    int listen_sock = open_udp(d->port, d->group),
+        probe_sock = open_udp(0, d->group),
+        sock = -1;
+    struct wire_buf probe;
+    struct net_msg msg;
+    memset(&probe, 0, sizeof(struct wire_buf));
+    memset(&msg, 0, sizeof(struct net_msg));
+    msg.type = MSG_PROBE;
+    wire_put(&probe, &msg);
+    PRINT_LINE("Looking for the server on port %d", d->port);
+
+    for (unsigned pause = DISCOVERY_FIRST_MS; sock == -1; ) {
+        for (unsigned i = 0; i < d->servers_len && sock == -1; ++i) {
+            *server = d->servers[i];
+            if (!server->sin_port)
+                server->sin_port = htons(d->port);
+            sock = try_connect(server);
+        }
+        if (sock != -1)
+            break;
+
+        // Probe and wait for the answer or the announcement
+        send_all(probe_sock, d, &probe);
+        struct pollfd p[2] = {{listen_sock, POLLIN, 0}, {probe_sock, POLLIN, 0}};
+        double until = now_ms() + pause;
+        for (double left = pause; sock == -1 && left > 0; left = until - now_ms()) {
+            if (poll(p, 2, left + 1) <= 0)
+                continue;
+            if (take_port(probe_sock, server) || take_port(listen_sock, server))
+                sock = try_connect(server);
+        }
+        if (pause < DISCOVERY_MAX_MS)
+            pause *= 2;
+    }
+
+    PRINT_LINE("Found the server [%s:%d]", inet_ntoa(server->sin_addr), ntohs(server->sin_port));
+    close(listen_sock);
+    close(probe_sock);
+    wire_free(&probe);
+    return sock;
+}
+
+//==============================================================================
+// SERVER SECTION
+//==============================================================================
+
+int discovery_listen(const struct discovery* d) {
+    return open_udp(d->port, d->group);
+}
+
+void discovery_answer(int sock, const struct net_msg* port) {
+    unsigned char buf[BUFSIZ];
+    struct sockaddr_in from;
+    socklen_t len = sizeof(from);
+    struct wire_frame frame;
+    struct wire_buf answer;
+    long bytes;
+    memset(&answer, 0, sizeof(struct wire_buf));
+    wire_put(&answer, port);
+
+    while ((bytes = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr*)&from, &len)) >= 0) {
+        if (wire_frame(buf, bytes, &frame) != bytes || frame.type != MSG_PROBE)
+            continue;
+        DBG_PRINT("Probe from [%s:%d]", inet_ntoa(from.sin_addr), ntohs(from.sin_port));
+        sendto(sock, answer.data, answer.len, 0, (struct sockaddr*)&from, len);
+        len = sizeof(from);
+    }
+    wire_free(&answer);
+}
+
+void discovery_announce(int sock, const struct discovery* d, const struct net_msg* port) {
+    struct wire_buf frame;
+    memset(&frame, 0, sizeof(struct wire_buf));
+    wire_put(&frame, port);
+    send_all(sock, d, &frame);
+    wire_free(&frame);
+}
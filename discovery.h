@@ -0,0 +1,64 @@
+/* File:     discovery.h
+ * Purpose:  How the clients and the relays find their server
+ * Note:
+ |    1.  The servers of the static list (-S) are tried first: they listen
+ |        on the TCP port of the broadcasts unless it is taken, so the
+ |        client connects without a datagram
+ |    2.  Then the client probes: MSG_PROBE goes to the broadcast address
+ |        and to the multicast group (-M) from a socket of its own, the
+ |        server answers with MSG_PORT at once. The probes are repeated
+ |        with the doubling pauses, so a client started before the server
+ |        finds it as soon as it is up
+ |    3.  The announcements the server sends every second are heard
+ |        as well, the clients of the older servers find them this way
+ |    4.  The multicast group is for the networks that filter the
+ |        all-ones broadcast, the server sends and listens to both
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+#include <netinet/in.h>
+
+#include "net_msg.h"
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+#define DISCOVERY_FIRST_MS      2       // the pause after the first probe
+#define DISCOVERY_MAX_MS        256     // the pauses double up to this
+#define DISCOVERY_CONNECT_MS    50      // a server of the list is down after this
+#define DISCOVERY_MAX_SERVERS   16      // the static list
+
+//==============================================================================
+// DISCOVERY STRUCTURE SECTION
+//==============================================================================
+
+struct discovery {
+    int port;                           // of the broadcasts and the probes
+    struct in_addr group;               // INADDR_ANY if no multicast
+    struct sockaddr_in servers[DISCOVERY_MAX_SERVERS];  // port 0 is the port
+    unsigned servers_len;
+};
+
+//==============================================================================
+// FUNCTION PROTOTYPES SECTION
+//==============================================================================
+
+    void discovery_init(struct discovery* d, int port);
+    // PURPOSE:     No group and no static servers
+    int discovery_group(struct discovery* d, const char* group);
+    // PURPOSE:     Set the multicast group, 0 if it is not one
+    int discovery_servers(struct discovery* d, const char* list);
+    // PURPOSE:     Add the servers of "host[:port],...", 0 if one is bad
+    int discovery_connect(const struct discovery* d, struct sockaddr_in* server);
+    // PURPOSE:     Find a server and connect to it, returns the TCP socket
+    int discovery_listen(const struct discovery* d);
+    // PURPOSE:     The non-blocking socket of the probes for the server
+    void discovery_answer(int sock, const struct net_msg* port);
+    // PURPOSE:     Answer the probes that came with the MSG_PORT
+    void discovery_announce(int sock, const struct discovery* d, const struct net_msg* port);
+    // PURPOSE:     Send the MSG_PORT to the broadcast address and the group
+
+#endif // DISCOVERY_H
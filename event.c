@@ -0,0 +1,152 @@
+/* File:     event.c
+ * Purpose:  Readiness notification for the server event loop
+ * Note:
+ |    1.  The epoll registration asks for the reads and the writes at once,
+ |        edge-triggered, so nothing is changed while the descriptor lives
+ |    2.  A hangup or an error is reported as readable: the following
+ |        read() returns 0 or -1 and the handler sees the reason
+ |    3.  event_del() of a descriptor that is not registered does nothing
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+//==============================================================================
+// INCLUDE SECTION
+//==============================================================================
+
+#include <string.h>
+
+#include "alerts.h"
+#include "event.h"
+
+#ifdef LINUX
+    #include <sys/epoll.h>
+#else  // LINUX
+    #include <poll.h>
+#endif // LINUX
+
+//==============================================================================
+// EPOLL SECTION
+//==============================================================================
+
+#ifdef LINUX
+
+    static int epfd = -1;
+
+void event_init() {
+    TRY_TO(epfd = epoll_create1(0));
+}
+
+void event_add(int fd, void* ptr) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = ptr;
+    TRY_TO(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev));
+}
+
+void event_del(int fd) {
+    // The descriptor removed once already is not an error
+    if (epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL) == -1 && errno != ENOENT)
+        PRINT_ERRV("LINE: [epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL)]");
+}
+
+void event_want_out(int fd, int on) {
+    // Edge-triggered epoll is always subscribed for the writes
+    (void)fd;
+    (void)on;
+}
+
+void event_want_in(int fd, int on) {
+    // The end of the stream is one edge, it is not reported again
+    (void)fd;
+    (void)on;
+}
+
+int event_wait(struct event* events, int max, int timeout) {
+    struct epoll_event evs[max];
+    int n = epoll_wait(epfd, evs, max, timeout);
+    if (n == -1 && errno == EINTR)
+        return 0;
+    TRY_TO(n);
+
+    for (int i = 0; i < n; ++i) {
+        events[i].ptr = evs[i].data.ptr;
+        events[i].in  = !!(evs[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR));
+        events[i].out = !!(evs[i].events & EPOLLOUT);
+    }
+    return n;
+}
+
+//==============================================================================
+// POLL SECTION
+//==============================================================================
+
+#else  // LINUX
+
+    static struct pollfd fds[EVENT_MAX_FDS];
+    static void* ptrs[EVENT_MAX_FDS];
+    static int nfds;
+
+static int find(int fd) {
+    for (int i = 0; i < nfds; ++i)
+        if (fds[i].fd == fd)
+            return i;
+    return -1;
+}
+
+void event_init() {
+    nfds = 0;
+}
+
+void event_add(int fd, void* ptr) {
+    if (nfds == EVENT_MAX_FDS)
+        PRINT_ERR("Too many descriptors to poll");
+    fds[nfds] = (struct pollfd) {fd, POLLIN, 0};
+    ptrs[nfds++] = ptr;
+}
+
+void event_del(int fd) {
+    int i = find(fd);
+    if (i < 0)
+        return;
+    fds[i] = fds[--nfds];
+    ptrs[i] = ptrs[nfds];
+}
+
+void event_want_out(int fd, int on) {
+    int i = find(fd);
+    if (i < 0)
+        return;
+    if (on)
+        fds[i].events |= POLLOUT;
+    else
+        fds[i].events &= ~POLLOUT;
+}
+
+void event_want_in(int fd, int on) {
+    int i = find(fd);
+    if (i < 0)
+        return;
+    if (on)
+        fds[i].events |= POLLIN;
+    else
+        fds[i].events &= ~POLLIN;
+}
+
+int event_wait(struct event* events, int max, int timeout) {
+    int n = poll(fds, nfds, timeout);
+    if (n == -1 && errno == EINTR)
+        return 0;
+    TRY_TO(n);
+
+    n = 0;
+    for (int i = 0; i < nfds && n < max; ++i)
+        if (fds[i].revents) {
+            events[n].ptr = ptrs[i];
+            events[n].in  = !!(fds[i].revents & (POLLIN | POLLHUP | POLLERR));
+            events[n].out = !!(fds[i].revents & POLLOUT);
+            ++n;
+        }
+    return n;
+}
+
+#endif // LINUX
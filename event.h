@@ -0,0 +1,48 @@
+/* File:     event.h
+ * Purpose:  Readiness notification for the server event loop
+ * Note:
+ |    1.  Linux gets edge-triggered epoll: the handlers must read, write
+ |        and accept until EAGAIN
+ |    2.  Elsewhere it is level-triggered poll() with the same interface,
+ |        so the same handlers work; the write interest is switched on
+ |        only while there is something to write
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+#ifndef EVENT_H
+#define EVENT_H
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+#define EVENT_MAX_FDS   65536   // descriptors the poll() fallback can watch
+
+//==============================================================================
+// EVENT STRUCTURE SECTION
+//==============================================================================
+
+struct event {
+    void* ptr;          // registered with the descriptor
+    int in, out;        // readable (or closed), writable
+};
+
+//==============================================================================
+// FUNCTION PROTOTYPES SECTION
+//==============================================================================
+
+    void event_init();
+    // PURPOSE:     Create the event queue
+    void event_add(int fd, void* ptr);
+    // PURPOSE:     Watch the non-blocking descriptor
+    void event_del(int fd);
+    // PURPOSE:     Stop watching the descriptor
+    void event_want_out(int fd, int on);
+    // PURPOSE:     Ask for the writability events (the poll() fallback)
+    void event_want_in(int fd, int on);
+    // PURPOSE:     Ask for the readability events (the poll() fallback),
+    //              off for the descriptor read to the end and still written
+    int event_wait(struct event* events, int max, int timeout);
+    // PURPOSE:     Wait for the events up to timeout ms (-1 forever),
+    //              returns the number of them
+
+#endif // EVENT_H
@@ -0,0 +1,285 @@
+/* File:     expr.c
+ * Purpose:  Integrand expressions compiled into a bytecode
+ * Note:
+ |    1.  The compiler is a recursive descent parser emitting postfix code:
+ |            sum     := product (('+' | '-') product)*
+ |            product := unary (('*' | '/') unary)*
+ |            unary   := '-' unary | power
+ |            power   := primary ('^' unary)?
+ |            primary := number | x | xN | p | pi | e | name '(' sum ')' | '(' sum ')'
+ |    2.  The evaluator runs every operation over the whole block,
+ |        so the dispatch costs once per block and the loops vectorize
+ |    3.  The bytecode comes from the net, so the clients expr_check() it
+ |        before running. A constant that is not finite (a NaN or a literal
+ |        out of the double range) is refused
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+//==============================================================================
+// INCLUDE SECTION
+//==============================================================================
+
+#include <math.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "expr.h"
+
+//==============================================================================
+// COMPILER SECTION
+//==============================================================================
+
+struct parser {
+    const char* pos;    // current position in the string
+    struct expr* e;     // the bytecode being emitted
+    int failed;
+};
+
+static const struct {
+    const char* name;
+    int code;
+} functions[] = {
+    {"sin",  OP_SIN},  {"cos",  OP_COS},  {"tan",  OP_TAN},
+    {"asin", OP_ASIN}, {"acos", OP_ACOS}, {"atan", OP_ATAN},
+    {"sinh", OP_SINH}, {"cosh", OP_COSH}, {"tanh", OP_TANH},
+    {"exp",  OP_EXP},  {"log",  OP_LOG},  {"log10", OP_LOG10},
+    {"sqrt", OP_SQRT}, {"abs",  OP_ABS},
+};
+
+static void parse_sum(struct parser* p);
+
+static void skip_spaces(struct parser* p) {
+    while (isspace((unsigned char)*p->pos))
+        ++p->pos;
+}
+
+static void emit(struct parser* p, int code, double value) {
+    if (p->e->ops == EXPR_MAX_OPS) {
+        p->failed = 1;
+        return;
+    }
+    p->e->op[p->e->ops++] = (struct expr_op) {code, value};
+}
+
+static void parse_primary(struct parser* p) {
+    skip_spaces(p);
+    if (*p->pos == '(') {
+        ++p->pos;
+        parse_sum(p);
+        skip_spaces(p);
+        if (*p->pos != ')') {
+            p->failed = 1;
+            return;
+        }
+        ++p->pos;
+        return;
+    }
+
+    if (isdigit((unsigned char)*p->pos) || *p->pos == '.') {
+        char* end;
+        double value = strtod(p->pos, &end);
+        if (end == p->pos) {
+            p->failed = 1;
+            return;
+        }
+        p->pos = end;
+        emit(p, OP_CONST, value);
+        return;
+    }
+
+    // Names: the variables, constants and functions
+    unsigned len = 0;
+    while (isalnum((unsigned char)p->pos[len]))
+        ++len;
+    if (!len) {
+        p->failed = 1;
+        return;
+    }
+
+    int var;
+    if (len == 1 && *p->pos == 'x')
+        emit(p, OP_X, 0);
+    else if (*p->pos == 'x' && len <= 3 && p->pos[1] != '0' &&
+             strspn(p->pos + 1, "0123456789") == len - 1 &&
+             (var = atoi(p->pos + 1)) <= EXPR_MAX_DIM)
+        emit(p, OP_X, var - 1);
+    else if (len == 1 && *p->pos == 'p')
+        emit(p, OP_X, 1);
+    else if (len == 2 && !strncmp(p->pos, "pi", 2))
+        emit(p, OP_CONST, M_PI);
+    else if (len == 1 && *p->pos == 'e')
+        emit(p, OP_CONST, M_E);
+    else {
+        for (unsigned i = 0; i < sizeof(functions) / sizeof(functions[0]); ++i)
+            if (strlen(functions[i].name) == len &&
+                !strncmp(p->pos, functions[i].name, len)) {
+                p->pos += len;
+                skip_spaces(p);
+                if (*p->pos != '(') {
+                    p->failed = 1;
+                    return;
+                }
+                parse_primary(p);
+                emit(p, functions[i].code, 0);
+                return;
+            }
+        p->failed = 1;
+        return;
+    }
+    p->pos += len;
+}
+
+static void parse_unary(struct parser* p);
+
+static void parse_power(struct parser* p) {
+    parse_primary(p);
+    skip_spaces(p);
+    if (!p->failed && *p->pos == '^') {
+        ++p->pos;
+        parse_unary(p);
+        emit(p, OP_POW, 0);
+    }
+}
+
+static void parse_unary(struct parser* p) {
+    skip_spaces(p);
+    if (*p->pos == '-') {
+        ++p->pos;
+        parse_unary(p);
+        emit(p, OP_NEG, 0);
+    }
+    else
+        parse_power(p);
+}
+
+static void parse_product(struct parser* p) {
+    parse_unary(p);
+    skip_spaces(p);
+    while (!p->failed && (*p->pos == '*' || *p->pos == '/')) {
+        int code = (*p->pos++ == '*') ? OP_MUL : OP_DIV;
+        parse_unary(p);
+        emit(p, code, 0);
+        skip_spaces(p);
+    }
+}
+
+static void parse_sum(struct parser* p) {
+    parse_product(p);
+    skip_spaces(p);
+    while (!p->failed && (*p->pos == '+' || *p->pos == '-')) {
+        int code = (*p->pos++ == '+') ? OP_ADD : OP_SUB;
+        parse_product(p);
+        emit(p, code, 0);
+        skip_spaces(p);
+    }
+}
+
+int expr_compile(const char* str, struct expr* e) {
+    struct parser p = {str, e, 0};
+    memset(e, 0, sizeof(struct expr));
+
+    parse_sum(&p);
+    skip_spaces(&p);
+    if (p.failed || *p.pos || !expr_check(e))
+        return p.pos - str;
+    return -1;
+}
+
+//==============================================================================
+// EVALUATION SECTION
+//==============================================================================
+
+int expr_check(const struct expr* e) {
+    int depth = 0;
+    if (e->ops == 0 || e->ops > EXPR_MAX_OPS)
+        return 0;
+
+    for (unsigned i = 0; i < e->ops; ++i) {
+        int code = e->op[i].code;
+        if (code < 0 || code >= OP_CODES)
+            return 0;
+        // the value is finite and in range before it is cast
+        if ((code == OP_X || code == OP_CONST) && !isfinite(e->op[i].value))
+            return 0;
+        if (code == OP_X && (e->op[i].value < 0 || e->op[i].value >= EXPR_MAX_DIM ||
+                             e->op[i].value != (int)e->op[i].value))
+            return 0;
+        if (code == OP_X || code == OP_CONST)
+            ++depth;
+        else if (code >= OP_ADD && code <= OP_POW)
+            --depth;
+        // the unary ones keep the depth but need an operand
+        if (depth < 1 || depth > EXPR_MAX_STACK)
+            return 0;
+    }
+    return depth == 1;
+}
+
+unsigned expr_dims(const struct expr* e) {
+    unsigned dims = 1;
+    for (unsigned i = 0; i < e->ops; ++i)
+        if (e->op[i].code == OP_X && e->op[i].value >= dims)
+            dims = e->op[i].value + 1;
+    return dims;
+}
+
+#define UNARY(FUNC)                         \
+    a = stack[sp];                          \
+    for (unsigned k = 0; k < n; ++k)        \
+        a[k] = FUNC(a[k]);                  \
+    break
+
+#define BINARY(FUNC)                        \
+    a = stack[sp - 1];                      \
+    b = stack[sp--];                        \
+    for (unsigned k = 0; k < n; ++k)        \
+        a[k] = FUNC(a[k], b[k]);            \
+    break
+
+#define ADD(a, b)   ((a) + (b))
+#define SUB(a, b)   ((a) - (b))
+#define MUL(a, b)   ((a) * (b))
+#define DIV(a, b)   ((a) / (b))
+#define NEG(a)      (-(a))
+
+// Cloned for the wider ISAs, the loader picks the one the CPU supports
+__attribute__((target_clones("avx512f", "avx2", "default")))
+void expr_eval(const struct expr* e, const double* x, double* y, unsigned n) {
+    double stack[EXPR_MAX_STACK][EXPR_BLOCK];
+    double *a, *b;
+    int sp = -1;
+
+    for (unsigned i = 0; i < e->ops; ++i) {
+        switch (e->op[i].code) {
+            case OP_X:
+                memcpy(stack[++sp], x + (int)e->op[i].value * EXPR_BLOCK, n * sizeof(double));
+                break;
+            case OP_CONST:
+                a = stack[++sp];
+                for (unsigned k = 0; k < n; ++k)
+                    a[k] = e->op[i].value;
+                break;
+            case OP_ADD:    BINARY(ADD);
+            case OP_SUB:    BINARY(SUB);
+            case OP_MUL:    BINARY(MUL);
+            case OP_DIV:    BINARY(DIV);
+            case OP_POW:    BINARY(pow);
+            case OP_NEG:    UNARY(NEG);
+            case OP_SIN:    UNARY(sin);
+            case OP_COS:    UNARY(cos);
+            case OP_TAN:    UNARY(tan);
+            case OP_ASIN:   UNARY(asin);
+            case OP_ACOS:   UNARY(acos);
+            case OP_ATAN:   UNARY(atan);
+            case OP_SINH:   UNARY(sinh);
+            case OP_COSH:   UNARY(cosh);
+            case OP_TANH:   UNARY(tanh);
+            case OP_EXP:    UNARY(exp);
+            case OP_LOG:    UNARY(log);
+            case OP_LOG10:  UNARY(log10);
+            case OP_SQRT:   UNARY(sqrt);
+            case OP_ABS:    UNARY(fabs);
+        }
+    }
+    memcpy(y, stack[0], n * sizeof(double));
+}
@@ -0,0 +1,70 @@
+/* File:     expr.h
+ * Purpose:  Integrand expressions compiled into a bytecode
+ |           the server ships to the clients
+ * Note:
+ |    1.  The syntax is the usual infix one with the variable x,
+ |        + - * / ^, unary minus, parentheses, constants pi and e
+ |        and the functions sin cos tan asin acos atan sinh cosh tanh
+ |        exp log log10 sqrt abs
+ |    2.  The bytecode is the postfix form of the expression, so it is
+ |        evaluated by a stack machine over a whole block of x at once
+ |    3.  The integrands of several variables name them x1 ... x10,
+ |        x is the same as x1. The block of every variable follows
+ |        the block of the previous one in the input of expr_eval()
+ |    4.  p is the parameter of a sweep (see sweep.h), the same variable
+ |        as x2
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+#ifndef EXPR_H
+#define EXPR_H
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+#define EXPR_MAX_OPS    64      // bytecode length limit
+#define EXPR_MAX_STACK  16      // stack machine depth limit
+#define EXPR_BLOCK      256     // the number of x evaluated at once
+#define EXPR_MAX_DIM    10      // variables of f(x1, ..., xn)
+
+// Define operation codes
+enum expr_code {
+    OP_X, OP_CONST,
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_POW, OP_NEG,
+    OP_SIN, OP_COS, OP_TAN, OP_ASIN, OP_ACOS, OP_ATAN,
+    OP_SINH, OP_COSH, OP_TANH,
+    OP_EXP, OP_LOG, OP_LOG10, OP_SQRT, OP_ABS,
+    OP_CODES
+};
+
+//==============================================================================
+// EXPRESSION STRUCTURE SECTION
+//==============================================================================
+
+struct expr_op {
+    int code;           // enum expr_code
+    double value;       // the constant for OP_CONST, the variable for OP_X
+};
+
+struct expr {
+    unsigned ops;                       // bytecode length
+    struct expr_op op[EXPR_MAX_OPS];    // postfix bytecode
+};
+
+//==============================================================================
+// FUNCTION PROTOTYPES SECTION
+//==============================================================================
+
+    int expr_compile(const char* str, struct expr* e);
+    // PURPOSE:     Compile the string into the bytecode.
+    //              Returns -1 on success or the position of the error
+    int expr_check(const struct expr* e);
+    // PURPOSE:     Check the received bytecode can be run safely, 0 if not
+    unsigned expr_dims(const struct expr* e);
+    // PURPOSE:     The number of the variables the expression may use:
+    //              the last one it names, 1 for none
+    void expr_eval(const struct expr* e, const double* x, double* y, unsigned n);
+    // PURPOSE:     y[i] = f(x[i]) for n <= EXPR_BLOCK values, the variable k
+    //              is x[k * EXPR_BLOCK + i]
+
+#endif // EXPR_H
@@ -0,0 +1,220 @@
+/* File:     job.c
+ * Purpose:  The integral jobs the server coordinates
+ * Note:
+ |    1.  Only the integral is parsed here, the queue and the progress
+ |        are the business of the server
+ |    2.  The builtin FUNCTION has one variable, so the cube needs f
+ |    3.  The key of the builtin FUNCTION is the digest of its text,
+ |        so the cache forgets it when simpson.h changes it
+ |    4.  The sweep is an integral of the line, p is the second
+ |        variable of its f(x, p)
+ |    5.  The records of the sweep lines are read into the job, its from
+ |        and to are the widest bounds of them, for the reports only
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+//==============================================================================
+// INCLUDE SECTION
+//==============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "net_msg.h"
+#include "simpson.h"
+#include "job.h"
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+#define STRINGIFY(x)    #x
+#define TEXT(x)         STRINGIFY(x)
+
+//==============================================================================
+// PARSE SECTION
+//==============================================================================
+
+const char* job_parse(const char* line, struct job* job) {
+    char mode[8];
+    double steps, records;
+    int used = 0, header = 0;
+    const char* err;
+    memset(job, 0, sizeof(struct job));
+
+    // The header of the records on the next lines has no bounds
+    if (sscanf(line, " %7s%n", mode, &used) == 1 && !strcmp(mode, "sweep"))
+        header = 1;
+    else if (sscanf(line, "%Lf %Lf %7s%n", &job->from, &job->to, mode, &used) != 3)
+        return "expected <from> <to> steps|tol|romberg|cube|qmc|sweep";
+    line += used;
+
+    job->dims = 1;
+    if (!strcmp(mode, "steps")) {
+        job->method = METHOD_SIMPSON;
+        if (sscanf(line, "%lf%n", &steps, &used) != 1 || steps < 1 || steps > 1e18)
+            return "expected the number of steps";
+        job->steps = steps;
+    }
+    else if (!strcmp(mode, "tol") || !strcmp(mode, "romberg")) {
+        job->method = (*mode == 't') ? METHOD_KRONROD : METHOD_ROMBERG;
+        if (job->method == METHOD_ROMBERG)
+            job->steps = ROMBERG_FIRST_STEPS;
+        if (sscanf(line, "%Lf %Lf%n", &job->abs_tol, &job->rel_tol, &used) != 2 ||
+            job->abs_tol < 0 || job->rel_tol < 0 || (!job->abs_tol && !job->rel_tol))
+            return "expected <abs_tol> <rel_tol>, one of them positive";
+    }
+    else if (!strcmp(mode, "cube") || !strcmp(mode, "qmc")) {
+        unsigned dims;
+        if (sscanf(line, "%u %lf%n", &dims, &steps, &used) != 2)
+            return "expected <dims> <cells> or <dims> <points>";
+        if ((err = job_cube(job, (*mode == 'c') ? METHOD_CUBATURE : METHOD_QMC, dims, steps)))
+            return err;
+    }
+    else if (!strcmp(mode, "sweep")) {
+        job->method = METHOD_SWEEP;
+        if (header && sscanf(line, "%lf %lf%n", &steps, &records, &used) != 2)
+            return "expected sweep <steps> <records>";
+        if (!header && sscanf(line, "%lf %lf %Lf %Lf%n", &steps, &records, &job->param_first,
+                              &job->param_last, &used) != 4)
+            return "expected <steps> <records> <p_first> <p_last>";
+        if (steps < 1 || steps > 1e18)
+            return "expected the number of steps";
+        if (records < 1 || records > SWEEP_MAX_RECORDS)
+            return "expected 1 to " TEXT(SWEEP_MAX_RECORDS) " records";
+        job->grid = steps;
+        job->steps = records;
+    }
+    else
+        return "expected steps, tol, romberg, cube, qmc or sweep";
+    line += used;
+
+    // The rest of the line is the integrand
+    line += strspn(line, " \t");
+    if (*line && *line != '\n' && expr_compile(line, &job->func) >= 0)
+        return "cannot compile f(x)";
+    if ((err = job_check(job)))
+        return err;
+    if (header && !(job->records = malloc(job->steps * sizeof(struct sweep_record))))
+        return "cannot allocate the records";
+    return NULL;
+}
+
+const char* job_record(const char* line, struct job* job) {
+    struct sweep_record* r = &job->records[job->records_len];
+    long double from, to;
+    int used = 0;
+    if (sscanf(line, "%Lf %Lf %lf %n", &from, &to, &r->param, &used) != 3 || line[used] ||
+        !isfinite(from) || !isfinite(to) || !isfinite(r->param))
+        return "expected the record <from> <to> <p>";
+    r->from = from;
+    r->to = to;
+
+    // The bounds of the job are the widest ones
+    if (!job->records_len++ || from < job->from)
+        job->from = from;
+    if (job->records_len == 1 || to > job->to)
+        job->to = to;
+    return NULL;
+}
+
+int job_incomplete(const struct job* job) {
+    return job->method == METHOD_SWEEP && job->records && job->records_len < job->steps;
+}
+
+const char* job_cube(struct job* job, int method, unsigned dims, double grid) {
+    job->method = method;
+    job->dims = dims;
+    if (method == METHOD_CUBATURE) {
+        if (dims < 1 || dims > CUBATURE_MAX_DIM)
+            return "the cubature takes 1 to 6 dimensions, qmc takes more";
+        if (grid < 1 || pow(grid, dims) > 1e18)
+            return "expected 1 to 1e18 cells in all";
+        job->grid = grid;
+        job->steps = 1;
+        for (unsigned d = 0; d < dims; ++d)
+            job->steps *= job->grid;
+    }
+    else {
+        if (dims < 1 || dims > EXPR_MAX_DIM)
+            return "qmc takes 1 to 10 dimensions";
+        if (grid < 1 || grid > QMC_MAX_POINTS)
+            return "expected 1 to 2^32 points";
+        job->grid = grid;
+        job->steps = job->grid * QMC_REPLICATES;
+    }
+    return NULL;
+}
+
+const char* job_check(const struct job* job) {
+    if ((job->method == METHOD_CUBATURE || job->method == METHOD_QMC) && !job->func.ops)
+        return "the cube needs f(x1, ..., xn)";
+    if (job->method == METHOD_SWEEP && !job->func.ops)
+        return "the sweep needs f(x, p)";
+    if (job->method == METHOD_SWEEP)
+        return (expr_dims(&job->func) > 2) ? "f(x, p) has more variables than the sweep" : NULL;
+    if (expr_dims(&job->func) > job->dims)
+        return "f(x) has more variables than the job";
+    return NULL;
+}
+
+void job_records(const struct job* job, struct sweep_record* records) {
+    long double dp = (job->steps > 1) ? (job->param_last - job->param_first) / (job->steps - 1) : 0;
+    for (unsigned long long r = 0; r < job->steps; ++r)
+        records[r] = (struct sweep_record) {job->from, job->to, job->param_first + r * dp};
+}
+
+//==============================================================================
+// CACHE KEY SECTION
+//==============================================================================
+
+static uint64_t digest(uint64_t h, const void* data, size_t len) {
+    // FNV-1a
+    const unsigned char* p = data;
+    for (size_t i = 0; i < len; ++i)
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    return h;
+}
+
+static void split(long double v, double* parts) {
+    parts[0] = v;
+    parts[1] = v - parts[0];
+}
+
+void job_key(const struct job* job, struct cache_key* key) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    memset(key, 0, sizeof(struct cache_key));
+
+    // The fields one by one, the padding of the ops is not hashed
+    if (!job->func.ops)
+        h = digest(h, TEXT(FUNCTION(x)), sizeof(TEXT(FUNCTION(x))));
+    for (unsigned i = 0; i < job->func.ops; ++i) {
+        h = digest(h, &job->func.op[i].code, sizeof(int));
+        h = digest(h, &job->func.op[i].value, sizeof(double));
+    }
+    key->func = h;
+
+    key->steps = job->steps;
+    key->grid = job->grid;
+    // Only the QMC points depend on the seed
+    if (job->method == METHOD_QMC)
+        key->seed = job->seed;
+    split(job->from, key->from);
+    split(job->to, key->to);
+    // A Romberg level is the same whatever the tolerance
+    if (job->method != METHOD_ROMBERG) {
+        key->abs_tol = job->abs_tol;
+        key->rel_tol = job->rel_tol;
+    }
+    key->method = job->method;
+    key->dims = job->dims;
+}
+
+unsigned long long job_seed(const struct job* job) {
+    // The scramble follows the integral, so a rerun gets the same points
+    struct cache_key key;
+    job_key(job, &key);
+    key.seed = 0;
+    return digest(0xcbf29ce484222325ull, &key, sizeof(struct cache_key));
+}
@@ -0,0 +1,144 @@
+/* File:     job.h
+ * Purpose:  The integral jobs the server coordinates
+ * Note:
+ |    1.  A job is one line of text:
+ |          <from> <to> steps <N> [f(x)]
+ |          <from> <to> tol <abs_tol> <rel_tol> [f(x)]
+ |          <from> <to> romberg <abs_tol> <rel_tol> [f(x)]
+ |          <from> <to> cube <dims> <cells> f(x1, ..., xn)
+ |          <from> <to> qmc <dims> <points> f(x1, ..., xn)
+ |          <from> <to> sweep <N> <records> <p_first> <p_last> f(x, p)
+ |          sweep <N> <records> f(x, p)
+ |        the first one is the Simpson formula with N steps, the second one
+ |        is the adaptive Gauss-Kronrod, the third one doubles the Simpson-like
+ |        steps until the Romberg estimates agree (see romberg.h),
+ |        no f(x) means the builtin FUNCTION.
+ |        The last two integrate over the cube [from, to]^dims: the tensor
+ |        Gauss cubature of cells^dims cells or the quasi-Monte Carlo of
+ |        the points in every one of QMC_REPLICATES scrambles.
+ |        The sweep is records Simpson integrals of N steps (see sweep.h).
+ |        The header without the bounds is followed by a line
+ |          <from> <to> <p>
+ |        of every record, the first form is the shorthand of the records
+ |        over the same [from, to] with p evenly from p_first to p_last
+ |    2.  The jobs come from the command line, a job file (one per line,
+ |        # starts a comment) or the callers on the local Unix socket
+ |    3.  The steps of the clients lost during the job are given out again
+ |        before the rest of the steps
+ |    4.  A relay server makes a job of every task of its upstream server,
+ |        the Gauss-Kronrod panels of such a job are split into the ranges
+ |        like the Simpson steps, not bisected
+ |    5.  The jobs of the same key (see cache.h) are the same integral,
+ |        the cached ranges of its steps are skipped. Every Romberg level
+ |        has its own key without the tolerances, so a rerun with a tighter
+ |        one computes only the new levels
+ |    6.  The results are joined up the tree of the steps (see reduce.h),
+ |        not in the order they come, so the integral has the same bits
+ |        whatever clients computed it. The Kronrod bisection of the
+ |        adaptive jobs is not a tree, it follows the results
+ |    7.  The steps of a sweep are its records, the result is the integral
+ |        of every record. The sweeps are not cached
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+#ifndef JOB_H
+#define JOB_H
+
+#include "expr.h"
+#include "adaptive.h"
+#include "romberg.h"
+#include "cubature.h"
+#include "cache.h"
+#include "reduce.h"
+#include "sweep.h"
+
+//==============================================================================
+// JOB STRUCTURE SECTION
+//==============================================================================
+
+struct caller;
+
+struct steps_range {
+    unsigned long long first, steps;
+};
+
+struct job {
+    unsigned id,
+             func_id;           // the id of the first job with the same f(x)
+    struct caller* caller;      // who gets the result, NULL for stdout
+    unsigned long long relayed; // 1 + the number of the upstream task
+                                // a relay computes, 0 if not relayed
+    unsigned upstream_id;       // the id of its job on the upstream server
+    struct job* next;           // the queue
+
+    // The integral
+    long double from, to,
+                step;                   // of the line, the steps of a relay
+                                        // are numbered from base
+    int method;
+    unsigned long long steps;           // cells or points for the cube,
+                                        // intervals of the Romberg level
+    unsigned dims;
+    unsigned long long grid,            // cells per dimension, points
+                                        // per replicate or steps per record
+                       seed,            // of the QMC scramble
+                       base;            // the number of the first step
+    long double abs_tol, rel_tol;
+    long double param_first, param_last;    // p of the first and the last record
+    struct sweep_record* records;       // of the sweep, NULL for the others
+                                        // and the shorthand before the queue
+    unsigned records_len;               // the records read after the header
+    struct dsum* values;                // the integrals of the records
+    struct expr func;           // func.ops == 0 for the builtin FUNCTION
+    struct cache_key key;       // of the integral in the result cache
+
+    // The progress
+    unsigned long long next_step;   // first step not handed out yet
+    struct steps_range* lost;       // the steps of the lost clients
+    unsigned lost_len, lost_size;
+    unsigned in_flight;             // tasks being computed
+    struct adaptive adaptive;
+    struct romberg romberg;
+    long double sum,
+                error,              // the error estimates of the relayed panels
+                                    // or of the cubature cells
+                replicate[QMC_REPLICATES];  // the QMC sums of the scrambles
+    unsigned long long done_steps,  // steps of the results taken
+                       part_steps;  // steps of the tasks in flight done so far
+    long double part_sum;           // their partial sums
+    struct reduce reduce;           // the results by their place in the tree
+    struct cache_range cached[CACHE_WAYS];  // the ranges not to compute
+    unsigned cached_len, cached_next;       // the next one ahead of next_step
+    int cache_hit,                  // the adaptive result is cached
+        hit_converged;
+    unsigned hit_intervals;
+    double queued,                  // the time it was queued
+           started,                 // the time of the first task, 0 if none
+           collected;               // the time of the last result
+};
+
+//==============================================================================
+// FUNCTION PROTOTYPES SECTION
+//==============================================================================
+
+    const char* job_parse(const char* line, struct job* job);
+    // PURPOSE:     Fill the integral of the job from the line,
+    //              returns NULL or what is wrong with the line.
+    //              The header of the sweep allocates job->records
+    const char* job_record(const char* line, struct job* job);
+    // PURPOSE:     Take the next record of the sweep from the line,
+    //              returns NULL or what is wrong with the line
+    int job_incomplete(const struct job* job);
+    // PURPOSE:     1 if the sweep waits for the lines of its records
+    const char* job_cube(struct job* job, int method, unsigned dims, double grid);
+    // PURPOSE:     Make the job a cubature or QMC one of the cube,
+    //              returns NULL or what is wrong with it
+    const char* job_check(const struct job* job);
+    // PURPOSE:     NULL if f(x) fits the dimensions of the job
+    void job_records(const struct job* job, struct sweep_record* records);
+    // PURPOSE:     The records of the sweep job by its parameters
+    void job_key(const struct job* job, struct cache_key* key);
+    // PURPOSE:     The key of the integral of the job in the result cache
+    unsigned long long job_seed(const struct job* job);
+    // PURPOSE:     The QMC scramble of the job by its integral
+
+#endif // JOB_H
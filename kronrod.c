@@ -0,0 +1,130 @@
+/* File:     kronrod.c
+ * Purpose:  Gauss-Kronrod 7/15 kernel for the adaptive integration
+ * Note:
+ |    1.  The nodes and weights and the error estimate are the ones
+ |        of QUADPACK qk15
+ |    2.  The points of several panels are evaluated as one block,
+ |        the same way simpson_expr() does it
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+//==============================================================================
+// INCLUDE SECTION
+//==============================================================================
+
+#include <math.h>
+#include <float.h>
+
+#include "expr.h"
+#include "simpson.h"
+#include "kronrod.h"
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+#define PANELS_PER_BLOCK    (EXPR_BLOCK / KRONROD_POINTS)
+
+// Kronrod nodes, xgk[1], xgk[3], xgk[5] and 0 are the Gauss ones
+static const double xgk[8] = {
+    0.991455371120812639206854697526329,
+    0.949107912342758524526189684047851,
+    0.864864423359769072789712788640926,
+    0.741531185599394439863864773280788,
+    0.586087235467691130294144845693013,
+    0.405845151377397166906606412076961,
+    0.207784955007898467600689403773245,
+    0.000000000000000000000000000000000
+};
+
+static const double wgk[8] = {
+    0.022935322010529224963732008058970,
+    0.063092092629978553290700663189204,
+    0.104790010322250183839876322541518,
+    0.140653259715525918745189590510238,
+    0.169004726639267902826583426598550,
+    0.190350578064785409913256402421014,
+    0.204432940075298892414161999234649,
+    0.209482141084727828012999174891714
+};
+
+static const double wg[4] = {
+    0.129484966168869693270611432679082,
+    0.279705391489276667901467771423780,
+    0.381830050505118944950369775488975,
+    0.417959183673469387755102040816327
+};
+
+//==============================================================================
+// KERNEL SECTION
+//==============================================================================
+
+// One panel: y[0] is the center, y[1 + j] and y[8 + j] are at -+xgk[j]
+static double kronrod_panel(const double* y, double half, double* error) {
+    double resg = y[0] * wg[3],
+           resk = y[0] * wgk[7],
+           resabs = fabs(resk);
+
+    for (int j = 0; j < 7; ++j) {
+        double f1 = y[1 + j], f2 = y[8 + j];
+        resk += wgk[j] * (f1 + f2);
+        resabs += wgk[j] * (fabs(f1) + fabs(f2));
+        if (j % 2)
+            resg += wg[j / 2] * (f1 + f2);
+    }
+
+    double reskh = resk / 2,
+           resasc = wgk[7] * fabs(y[0] - reskh);
+    for (int j = 0; j < 7; ++j)
+        resasc += wgk[j] * (fabs(y[1 + j] - reskh) + fabs(y[8 + j] - reskh));
+
+    half = fabs(half);
+    resabs *= half;
+    resasc *= half;
+    double err = fabs((resk - resg) * half);
+    if (resasc != 0 && err != 0)
+        err = resasc * fmin(1, pow(200 * err / resasc, 1.5));
+    if (resabs > DBL_MIN / (50 * DBL_EPSILON))
+        err = fmax(50 * DBL_EPSILON * resabs, err);
+
+    *error = err;
+    return resk * half;
+}
+
+long double kronrod_integrate(const struct expr* f, long double from,
+                              long double distance,
+                              unsigned long long panels,
+                              long double* error) {
+    double x[EXPR_BLOCK], y[EXPR_BLOCK];
+    double half = distance / 2, err;
+    long double res = 0, res_err = 0;
+
+    for (unsigned long long i = 0; i < panels; i += PANELS_PER_BLOCK) {
+        unsigned n = (panels - i < PANELS_PER_BLOCK) ? panels - i : PANELS_PER_BLOCK;
+
+        for (unsigned p = 0; p < n; ++p) {
+            double* px = x + p * KRONROD_POINTS;
+            double center = from + distance * (i + p) + half;
+            px[0] = center;
+            for (int j = 0; j < 7; ++j) {
+                px[1 + j] = center - half * xgk[j];
+                px[8 + j] = center + half * xgk[j];
+            }
+        }
+
+        if (f && f->ops)
+            expr_eval(f, x, y, n * KRONROD_POINTS);
+        else
+            for (unsigned k = 0; k < n * KRONROD_POINTS; ++k) {
+                double xk = x[k];
+                y[k] = FUNCTION(xk);
+            }
+
+        for (unsigned p = 0; p < n; ++p) {
+            res += kronrod_panel(y + p * KRONROD_POINTS, half, &err);
+            res_err += err;
+        }
+    }
+
+    *error = res_err;
+    return res;
+}
@@ -0,0 +1,33 @@
+/* File:     kronrod.h
+ * Purpose:  Gauss-Kronrod 7/15 kernel for the adaptive integration
+ * Note:
+ |    1.  The interval is cut into equal panels, every panel gets the
+ |        15-point Kronrod estimate and the QUADPACK error estimate
+ |        from its difference to the embedded 7-point Gauss rule
+ |    2.  f(x) is the builtin FUNCTION if the expression is NULL or empty
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+#ifndef KRONROD_H
+#define KRONROD_H
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+#define KRONROD_POINTS  15      // evaluations per panel
+
+struct expr;
+
+//==============================================================================
+// FUNCTION PROTOTYPES SECTION
+//==============================================================================
+
+    long double kronrod_integrate(const struct expr* f, long double from,
+                                  long double distance,
+                                  unsigned long long panels,
+                                  long double* error);
+    // PURPOSE:     Sum of the Kronrod estimates over panels of the length
+    //              distance starting at from, the sum of the error
+    //              estimates goes to error
+
+#endif // KRONROD_H
@@ -0,0 +1,238 @@
+/* File:     logger.c
+ * Purpose:  Asynchronous log behind the macros of alerts.h
+ * Note:
+ |    1.  A ring has one writer (its thread) and one reader (the drain
+ |        thread), so the head and the tail are enough to share it.
+ |        The rings are pushed to the list once and live until the exit
+ |    2.  Every message takes a number from the global counter, the drain
+ |        thread writes the oldest message of all the rings first
+ |    3.  The drain thread sleeps longer while there is nothing to write
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+//==============================================================================
+// INCLUDE SECTION
+//==============================================================================
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "logger.h"
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+// Define ring parameters
+#define LOG_SLOTS           256     // messages a ring holds
+#define LOG_MSG_MAX         256     // bytes of a message, the rest is cut
+
+// Define drain parameters
+#define LOG_DRAIN_MIN_US    1000    // sleep after writing something
+#define LOG_DRAIN_MAX_US    50000   // the longest sleep when there is nothing
+
+// Messages
+#define ERR    "ERROR:  "
+#define WARN   "WARNING:  "
+
+//==============================================================================
+// RING STRUCTURE SECTION
+//==============================================================================
+
+struct log_slot {
+    unsigned long long seq;         // the order of the message
+    int len;
+    char text[LOG_MSG_MAX];
+};
+
+struct log_ring {
+    struct log_ring* next;          // the list of all the rings
+    _Atomic unsigned head,          // the next slot to write, by the thread
+                     tail;          // the next slot to read, by the drain
+    _Atomic unsigned long dropped;  // the messages that found the ring full
+    struct log_slot slot[LOG_SLOTS];
+};
+
+//==============================================================================
+// GLOBAL VARIABLES
+//==============================================================================
+
+    int log_level = LOG_INFO;
+
+    static _Thread_local struct log_ring* ring;     // the ring of the thread
+    static struct log_ring* _Atomic rings;          // all the rings
+    static _Atomic unsigned long long log_seq;      // the next message number
+    static atomic_int stopping;                     // the drain writes out and quits
+    static atomic_int stopped;                      // the messages go straight out
+
+    static pthread_once_t started = PTHREAD_ONCE_INIT;
+    static pthread_mutex_t draining = PTHREAD_MUTEX_INITIALIZER;   // one writer of stdout
+    static pthread_t drain;
+    static pid_t drain_pid;                         // a forked child has no drain
+
+//==============================================================================
+// DRAIN SECTION
+//==============================================================================
+
+// Write the messages of all the rings in their order, 0 if there were none
+static int drain_rings() {
+    int written = 0;
+    while (1) {
+        struct log_ring* oldest = NULL;
+        unsigned long long seq = 0;
+        for (struct log_ring* r = atomic_load(&rings); r; r = r->next) {
+            unsigned long lost = atomic_exchange(&r->dropped, 0);
+            if (lost)
+                fprintf(stdout, "%lu log message%s dropped\n", lost, (lost > 1) ? "s" : "");
+
+            unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+            if (tail == atomic_load_explicit(&r->head, memory_order_acquire))
+                continue;
+            struct log_slot* slot = &r->slot[tail % LOG_SLOTS];
+            if (!oldest || slot->seq < seq) {
+                oldest = r;
+                seq = slot->seq;
+            }
+        }
+        if (!oldest)
+            break;
+
+        unsigned tail = atomic_load_explicit(&oldest->tail, memory_order_relaxed);
+        struct log_slot* slot = &oldest->slot[tail % LOG_SLOTS];
+        fwrite(slot->text, 1, slot->len, stdout);
+        atomic_store_explicit(&oldest->tail, tail + 1, memory_order_release);
+        written = 1;
+    }
+    if (written)
+        fflush(stdout);
+    return written;
+}
+
+static void* drain_thread(void* arg) {
+    unsigned sleep_us = LOG_DRAIN_MIN_US;
+    while (1) {
+        int last = atomic_load(&stopping);
+        pthread_mutex_lock(&draining);
+        int written = drain_rings();
+        pthread_mutex_unlock(&draining);
+        if (written)
+            sleep_us = LOG_DRAIN_MIN_US;
+        else if (sleep_us < LOG_DRAIN_MAX_US)
+            sleep_us *= 2;
+        if (last)
+            break;
+        usleep(sleep_us);
+    }
+    return arg;
+}
+
+static void drain_start() {
+    drain_pid = getpid();
+    if (pthread_create(&drain, NULL, &drain_thread, NULL)) {
+        atomic_store(&stopped, 1);
+        return;
+    }
+    atexit(log_stop);
+}
+
+void log_stop() {
+    if (atomic_exchange(&stopped, 1) || getpid() != drain_pid)
+        return;
+    atomic_store(&stopping, 1);
+    pthread_join(drain, NULL);
+}
+
+//==============================================================================
+// WRITE SECTION
+//==============================================================================
+
+// The ring of the calling thread, made the first time
+static struct log_ring* own_ring() {
+    if (ring)
+        return ring;
+    if (!(ring = calloc(1, sizeof(struct log_ring))))
+        return NULL;
+    ring->next = atomic_load(&rings);
+    while (!atomic_compare_exchange_weak(&rings, &ring->next, ring))
+        ;
+    return ring;
+}
+
+void log_print(int level, int line, const char* fmt, ...) {
+    va_list args;
+    char text[LOG_MSG_MAX];
+    struct log_ring* r;
+    const char* tag = (level == LOG_WARN) ? WARN : "";
+
+    pthread_once(&started, drain_start);
+    if (atomic_load_explicit(&stopped, memory_order_relaxed) || !(r = own_ring())) {
+        // Nobody drains, the message goes as it used to
+        va_start(args, fmt);
+        vsnprintf(text, sizeof(text), fmt, args);
+        va_end(args);
+        fprintf(stdout, line ? "%s%s\n" : "%s%s", tag, text);
+        fflush(stdout);
+        return;
+    }
+
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&r->tail, memory_order_acquire) == LOG_SLOTS) {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    struct log_slot* slot = &r->slot[head % LOG_SLOTS];
+    int len = 0;
+#ifdef MSGPID
+    len = snprintf(slot->text, LOG_MSG_MAX, "PID %d:  ", getpid());
+#endif // MSGPID
+    len += snprintf(slot->text + len, LOG_MSG_MAX - len, "%s", tag);
+    va_start(args, fmt);
+    len += vsnprintf(slot->text + len, LOG_MSG_MAX - len, fmt, args);
+    va_end(args);
+    if (len > LOG_MSG_MAX - 2)
+        len = LOG_MSG_MAX - 2;
+    if (line)
+        slot->text[len++] = '\n';
+    slot->len = len;
+    slot->seq = atomic_fetch_add_explicit(&log_seq, 1, memory_order_relaxed);
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+void log_write(const char* text, unsigned long len) {
+    pthread_mutex_lock(&draining);
+    drain_rings();
+    fwrite(text, 1, len, stdout);
+    fflush(stdout);
+    pthread_mutex_unlock(&draining);
+}
+
+void log_fatal(int line, int err, const char* fmt, ...) {
+    va_list args;
+    char text[BUFSIZ];
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+
+#ifdef MSGPID
+    fprintf(stderr, "PID %d:  ", getpid());
+#endif // MSGPID
+    if (err)
+        fprintf(stderr, ERR "@%d  %s\n- %s\n", line, text, strerror(err));
+    else
+        fprintf(stderr, ERR "@%d  %s\n", line, text);
+    exit(EXIT_FAILURE);
+}
+
+int log_parse(const char* name) {
+    static const char* names[] = {"error", "warn", "info", "debug"};
+    for (int i = LOG_ERROR; i <= LOG_DEBUG; ++i)
+        if (!strcmp(name, names[i]))
+            return i;
+    return -1;
+}
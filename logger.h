@@ -0,0 +1,58 @@
+/* File:     logger.h
+ * Purpose:  Asynchronous log behind the macros of alerts.h
+ * Note:
+ |    1.  Every thread formats its messages into its own ring, no locks
+ |        are taken and no I/O is done on the calling thread. The drain
+ |        thread writes the rings to stdout in the order the messages
+ |        were made
+ |    2.  A message that finds its ring full is dropped and counted,
+ |        the drain thread reports how many were lost
+ |    3.  The messages above log_level are not even formatted, the level
+ |        is set at runtime. LOG_DEBUG messages exist only in the builds
+ |        with DEBUG defined ("make DEBUG=1")
+ |    4.  The fatal errors are written to stderr at once, the rings are
+ |        drained by exit()
+ |    5.  A text too long for a ring (the stats dump) is written by
+ |        log_write() after the messages queued before it, never amid them
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+#ifndef LOGGER_H
+#define LOGGER_H
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+// Define severity levels
+#define LOG_ERROR       0
+#define LOG_WARN        1
+#define LOG_INFO        2
+#define LOG_DEBUG       3
+
+//==============================================================================
+// GLOBAL VARIABLES
+//==============================================================================
+
+    extern int log_level;       // the most verbose level written, LOG_INFO
+
+//==============================================================================
+// FUNCTION PROTOTYPES SECTION
+//==============================================================================
+
+    void log_print(int level, int line, const char* fmt, ...)
+                   __attribute__((format(printf, 3, 4)));
+    // PURPOSE:     Queue the message for the drain thread, line adds
+    //              the newline. Starts the drain thread the first time
+    void log_fatal(int line, int err, const char* fmt, ...)
+                   __attribute__((format(printf, 3, 4), noreturn));
+    // PURPOSE:     Write the error of the source line to stderr with
+    //              strerror(err) if err is not 0 and exit
+    void log_write(const char* text, unsigned long len);
+    // PURPOSE:     Write out the queued messages, then the text as it is
+    int log_parse(const char* name);
+    // PURPOSE:     The level by its name (error, warn, info, debug), -1 if none
+    void log_stop();
+    // PURPOSE:     Write out all the rings and stop the drain thread,
+    //              called by exit()
+
+#endif // LOGGER_H
@@ -0,0 +1,64 @@
+/* File:     metrics.c
+ * Purpose:  Counters of the server and the clients and their text dump
+ * Note:
+ |    1.  The dump is built in a wire_buf, so it goes to a socket
+ |        or to stdout the same way
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+//==============================================================================
+// INCLUDE SECTION
+//==============================================================================
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "wire.h"
+#include "metrics.h"
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+#define METRICS_LINE    256         // bytes of one line at most
+
+//==============================================================================
+// DUMP SECTION
+//==============================================================================
+
+// Append the formatted text, cut at METRICS_LINE
+static void append(struct wire_buf* b, const char* fmt, va_list args) {
+    char* p = (char*)wire_space(b, METRICS_LINE);
+    int len = vsnprintf(p, METRICS_LINE, fmt, args);
+    b->len += (len < METRICS_LINE) ? len : METRICS_LINE - 1;
+}
+
+static void put(struct wire_buf* b, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    append(b, fmt, args);
+    va_end(args);
+}
+
+void metrics_family(struct wire_buf* b, const char* name,
+                    const char* type, const char* help) {
+    put(b, "# HELP %s %s\n", name, help);
+    put(b, "# TYPE %s %s\n", name, type);
+}
+
+void metrics_value(struct wire_buf* b, const char* name, double value,
+                   const char* labels, ...) {
+    va_list args;
+    put(b, "%s", name);
+    if (labels) {
+        put(b, "{");
+        va_start(args, labels);
+        append(b, labels, args);
+        va_end(args);
+        put(b, "}");
+    }
+    put(b, " %.9g\n", value);
+}
+
+void metrics_end(struct wire_buf* b) {
+    put(b, "# EOF\n");
+}
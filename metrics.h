@@ -0,0 +1,43 @@
+/* File:     metrics.h
+ * Purpose:  Counters of the server and the clients and their text dump
+ * Note:
+ |    1.  The dump is the text exposition format: "# HELP" and "# TYPE"
+ |        lines of every family, then one "name{labels} value" line
+ |        per sample, and "# EOF" at the end
+ |    2.  The counters of the client threads go to the server in MSG_STATS,
+ |        they are totals since the client started, so a lost one is fine
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+#ifndef METRICS_H
+#define METRICS_H
+
+//==============================================================================
+// COUNTERS STRUCTURE SECTION
+//==============================================================================
+
+struct wire_buf;
+
+struct thread_stats {
+    unsigned thread;            // the thread of the client
+    unsigned long long steps,   // Simpson steps or Kronrod panels done
+                       evals;   // points of f(x) computed
+    double busy,                // s computing
+           idle;                // s waiting for the other threads of the task
+};
+
+//==============================================================================
+// FUNCTION PROTOTYPES SECTION
+//==============================================================================
+
+    void metrics_family(struct wire_buf* b, const char* name,
+                        const char* type, const char* help);
+    // PURPOSE:     Append the HELP and TYPE lines of the family
+    void metrics_value(struct wire_buf* b, const char* name, double value,
+                       const char* labels, ...)
+                       __attribute__((format(printf, 4, 5)));
+    // PURPOSE:     Append the sample, labels is a printf format of
+    //              the label list without the braces or NULL
+    void metrics_end(struct wire_buf* b);
+    // PURPOSE:     Append the end of the dump
+
+#endif // METRICS_H
@@ -0,0 +1,107 @@
+/* File:     net_msg.h
+ * Purpose:  The message the server and the clients exchange
+ * Note:
+ |    1.  The server broadcasts MSG_PORT with its TCP port and sends it
+ |        to every client that broadcasts MSG_PROBE (see discovery.h),
+ |        the client connects and says MSG_HELLO with the number of cores, their
+ |        placement and the measured throughput (see client.c), then the server sends MSG_TASKs and the client
+ |        answers every task with MSG_RESULT, the partial sum is in
+ |        the node_sum field (see reduce.h)
+ |    2.  MSG_DONE ends the job, the client parks its threads and
+ |        waits for the next job on the same connection
+ |    3.  MSG_BYE ends the session, the client disconnects
+ |    4.  MSG_FUNC starts every job: it is followed by ops struct expr_op
+ |        of the integrand bytecode, zero ops means the builtin FUNCTION
+ |    5.  A task is steps Simpson steps or Kronrod panels of the length
+ |        distance by its method from the number first, the step i is
+ |        at local_from + i * distance. The Kronrod ones are answered
+ |        with the error estimate as well
+ |    6.  net_msg is never sent as is: wire.c encodes it into the frames
+ |    7.  While a task is computed the client sends MSG_PROGRESS with the
+ |        steps done and their sum. MSG_CANCEL makes the client stop the
+ |        tasks of the job, they are answered with whatever is computed
+ |    8.  Before the client waits for the next tasks it sends MSG_STATS,
+ |        the counters of every thread (see metrics.h)
+ |    9.  The task of a multi-dimensional job is steps cells or points
+ |        of the cube [local_from, local_to]^dims from the number first,
+ |        grid is the cells per dimension or the points per replicate
+ |        and seed scrambles the points (see cubature.h)
+ |    10. The task of a Romberg level is steps intervals of the length
+ |        distance like the Simpson ones, answered with the sum of f(x) at their
+ |        midpoints times distance (see romberg.h)
+ |    11. A client that is to leave sends MSG_DRAIN, the server gives it
+ |        no more tasks and says MSG_BYE once the results it owes are in.
+ |        MSG_HELLO of a connected client (a relay) gives its new cores
+ |        and throughput
+ |    12. A sweep job sends MSG_SWEEP after MSG_FUNC: one frame of all its
+ |        records (see sweep.h). Its task is steps records from the number
+ |        first, every one of grid Simpson steps. The client sends MSG_VALUE
+ |        with the integral of every record before MSG_RESULT, the number
+ |        of the record is in first
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+#ifndef NET_MSG_H
+#define NET_MSG_H
+
+#include "topology.h"
+#include "metrics.h"
+#include "reduce.h"
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+// Define network parameters
+#define BROADCAST_PORT  31123
+
+// Define message types
+#define MSG_TASK        0   // calculate the interval
+#define MSG_DONE        1   // the job is over, wait for the next one
+#define MSG_BYE         2   // the session is over, disconnect
+#define MSG_FUNC        3   // the integrand for the next tasks
+#define MSG_HELLO       4   // the client cores and placement
+#define MSG_RESULT      5   // the partial sum of the task
+#define MSG_PORT        6   // the server TCP port, broadcast
+#define MSG_CANCEL      7   // drop the tasks of the job
+#define MSG_PROGRESS    8   // the partial sum of the current task
+#define MSG_STATS       9   // the counters of a client thread
+#define MSG_PROBE       10  // where is the server, broadcast
+#define MSG_DRAIN       11  // the client leaves, no more tasks
+#define MSG_SWEEP       12  // the records of the next sweep tasks
+#define MSG_VALUE       13  // the integral of a record of the sweep
+
+// Define integration methods
+#define METHOD_SIMPSON  0   // composite Simpson formula
+#define METHOD_KRONROD  1   // Gauss-Kronrod 7/15 panels with error estimate
+#define METHOD_CUBATURE 2   // tensor Gauss cells of the hypercube
+#define METHOD_QMC      3   // scrambled Sobol points of the hypercube
+#define METHOD_ROMBERG  4   // midpoint sums of a Romberg level
+#define METHOD_SWEEP    5   // Simpson integrals of the records of a sweep
+
+//==============================================================================
+// CLIENT TASK STRUCTURE SECTION
+//==============================================================================
+
+struct net_msg {
+    int tcp_port, type, method;
+    unsigned cores, ops,
+             job;               // the job of the task or the cancel
+    unsigned long long steps;
+    unsigned dims;              // of the integral, 1 for the line
+    unsigned long long first,   // the number of the first cell, point or record
+                       grid,    // cells per dimension, points per replicate
+                                // or steps per record
+                       seed;    // of the scramble
+    long double local_from,
+                local_to,
+                distance,
+                error;
+    struct dsum node_sum,       // the result of the task or the record, bit for bit
+                node_error;
+    struct placement placement;
+    struct thread_stats stats;
+    double rate;                // evaluations of f(x) per second, all the cores
+    unsigned width;             // doubles per SIMD instruction of the kernel
+};
+
+#endif // NET_MSG_H
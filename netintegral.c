@@ -0,0 +1,308 @@
+/* File:     netintegral.c
+ * Purpose:  The library of the integrator: the Simpson integrals computed
+ |           by a pool of threads of the calling process, no server, no sockets
+ * Note:
+ |    1.  The calls wait in one queue, a thread of the pool takes the next
+ |        block of the oldest call that has them. The call that has given
+ |        out its last block leaves the queue, the thread that computes
+ |        its last block adds the blocks up and wakes the waiting one
+ |    2.  One lock guards the queue and the calls, it is taken once per
+ |        block of thousands of evaluations
+ |    3.  The block sums go up the tree as they come (see reduce.h), so
+ |        a call keeps about the tree depth of them whatever its steps
+ |    4.  Nothing here exits the process: a failed allocation or thread
+ |        is the error of the call or NULL of netintegral_open()
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+//==============================================================================
+// INCLUDE SECTION
+//==============================================================================
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "expr.h"
+#include "reduce.h"
+#include "simpson.h"
+#include "topology.h"
+#include "netintegral.h"
+
+//==============================================================================
+// LIBRARY STRUCTURE SECTION
+//==============================================================================
+
+struct netintegral_call {
+    struct netintegral* ni;
+    struct netintegral_call* next;      // the queue
+    struct expr func;                   // func.ops == 0 for the builtin FUNCTION
+    netintegral_func eval;
+    void* arg;
+    long double from, step, value;
+    unsigned long long steps,
+                       block,           // steps of a block
+                       blocks,
+                       next_block,      // the first one not given out
+                       blocks_done;
+    struct reduce sums;                 // the block sums without their sibling yet
+    const char* error;                  // NULL or what went wrong
+    int done;
+    pthread_cond_t finished;
+};
+
+struct netintegral {
+    const struct simpson_kernel* kernel;
+    pthread_t* threads;
+    int* cpus;
+    unsigned threads_len;
+    pthread_mutex_t mutex;
+    pthread_cond_t work;
+    struct netintegral_call *queue, *queue_tail;
+    int stop;
+};
+
+//==============================================================================
+// BLOCK SECTION
+//==============================================================================
+
+static long double call_block(const struct netintegral_call* c, unsigned long long b) {
+    // The steps are numbered from the start, so a block is at the same x
+    // wherever it is computed
+    unsigned long long first = b * c->block,
+                       n = (c->steps - first < c->block) ? c->steps - first : c->block;
+    long double from = c->from + c->step * first;
+    if (c->eval)
+        return simpson_batch(c->eval, c->arg, from, c->step, n);
+    if (c->func.ops)
+        return simpson_expr(&c->func, from, c->step, n);
+    return c->ni->kernel->integrate(from, c->step, n);
+}
+
+// Called with the lock, returns the next block of the call
+static unsigned long long take_block(struct netintegral* ni, struct netintegral_call* c) {
+    unsigned long long b = c->next_block++;
+    if (c->next_block < c->blocks)
+        return b;
+
+    // Nothing more to give out, the call leaves the queue
+    struct netintegral_call** link = &ni->queue;
+    while (*link && *link != c)
+        link = &(*link)->next;
+    if (*link) {
+        *link = c->next;
+        if (ni->queue_tail == c) {
+            ni->queue_tail = ni->queue;
+            while (ni->queue_tail && ni->queue_tail->next)
+                ni->queue_tail = ni->queue_tail->next;
+        }
+    }
+    return b;
+}
+
+// Called with the lock, the call is not touched after it is done
+static void put_block(struct netintegral_call* c, unsigned long long b, long double part) {
+    struct reduce_node node;
+    struct dsum sum, error;
+    unsigned long long first = b * c->block;
+    reduce_node(first, (c->steps - first < c->block) ? c->steps - first : c->block, 0,
+                c->block, &node);
+    node.sum = dsum_of(part);
+    if (!reduce_put(&c->sums, &node))
+        c->error = "cannot allocate the sums of the blocks";
+    if (++c->blocks_done < c->blocks)
+        return;
+    reduce_total(&c->sums, -1, &sum, &error);
+    c->value = dsum_value(sum);
+    c->done = 1;
+    pthread_cond_broadcast(&c->finished);
+}
+
+static void* pool_thread(void* arg) {
+    struct netintegral* ni = arg;
+    pthread_mutex_lock(&ni->mutex);
+    unsigned id = 0;
+    while (ni->threads[id] != pthread_self())
+        ++id;
+    pthread_mutex_unlock(&ni->mutex);
+    topology_pin(ni->cpus[id]);
+
+    pthread_mutex_lock(&ni->mutex);
+    while (1) {
+        while (!ni->queue && !ni->stop)
+            pthread_cond_wait(&ni->work, &ni->mutex);
+        if (ni->stop)
+            break;
+        struct netintegral_call* c = ni->queue;
+        unsigned long long b = take_block(ni, c);
+        pthread_mutex_unlock(&ni->mutex);
+        long double part = call_block(c, b);
+        pthread_mutex_lock(&ni->mutex);
+        put_block(c, b, part);
+    }
+    pthread_mutex_unlock(&ni->mutex);
+    return NULL;
+}
+
+//==============================================================================
+// POOL SECTION
+//==============================================================================
+
+struct netintegral* netintegral_open(unsigned threads, const char* kernel) {
+    struct netintegral* ni = calloc(1, sizeof(struct netintegral));
+    struct placement placement;
+    if (!ni)
+        return NULL;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    ni->threads_len = threads ? threads : (cpus > 0) ? cpus : 1;
+    if (!(ni->kernel = simpson_select(kernel)) ||
+        !(ni->threads = calloc(ni->threads_len, sizeof(pthread_t))) ||
+        !(ni->cpus = calloc(ni->threads_len, sizeof(int)))) {
+        free(ni->threads);
+        free(ni);
+        return NULL;
+    }
+    topology_plan(ni->threads_len, ni->cpus, &placement);
+    pthread_mutex_init(&ni->mutex, NULL);
+    pthread_cond_init(&ni->work, NULL);
+
+    // The threads find their CPU by their id, so they wait for all the ids.
+    // The ones started before a failure are stopped
+    unsigned started = 0;
+    pthread_mutex_lock(&ni->mutex);
+    while (started < ni->threads_len && !pthread_create(&ni->threads[started], NULL, pool_thread, ni))
+        ++started;
+    pthread_mutex_unlock(&ni->mutex);
+    if (started < ni->threads_len) {
+        ni->threads_len = started;
+        netintegral_close(ni);
+        return NULL;
+    }
+    return ni;
+}
+
+void netintegral_close(struct netintegral* ni) {
+    pthread_mutex_lock(&ni->mutex);
+    ni->stop = 1;
+    pthread_cond_broadcast(&ni->work);
+    pthread_mutex_unlock(&ni->mutex);
+    for (unsigned i = 0; i < ni->threads_len; ++i)
+        pthread_join(ni->threads[i], NULL);
+
+    pthread_mutex_destroy(&ni->mutex);
+    pthread_cond_destroy(&ni->work);
+    free(ni->threads);
+    free(ni->cpus);
+    free(ni);
+}
+
+//==============================================================================
+// CALL SECTION
+//==============================================================================
+
+static const char* call_make(struct netintegral* ni, const struct netintegral_job* job,
+                             struct netintegral_call** call) {
+    struct netintegral_call* c;
+    if (!job->steps)
+        return "no steps";
+    if (!isfinite(job->from) || !isfinite(job->to))
+        return "the bounds are not finite";
+    if (!(c = calloc(1, sizeof(struct netintegral_call))))
+        return "cannot allocate the call";
+    if (!job->func && job->expr &&
+        (expr_compile(job->expr, &c->func) >= 0 || expr_dims(&c->func) > 1)) {
+        free(c);
+        return "f(x) does not compile";
+    }
+
+    c->ni = ni;
+    c->eval = job->func;
+    c->arg = job->arg;
+    c->from = job->from;
+    c->steps = job->steps;
+    c->step = (job->to - job->from) / job->steps;
+    c->block = reduce_block(SIMPSON_POINTS);
+    c->blocks = (c->steps + c->block - 1) / c->block;
+    pthread_cond_init(&c->finished, NULL);
+    *call = c;
+    return NULL;
+}
+
+const char* netintegral_submit(struct netintegral* ni, const struct netintegral_job* job,
+                               struct netintegral_call** call) {
+    const char* err = call_make(ni, job, call);
+    if (err)
+        return err;
+
+    pthread_mutex_lock(&ni->mutex);
+    if (ni->queue_tail)
+        ni->queue_tail->next = *call;
+    else
+        ni->queue = *call;
+    ni->queue_tail = *call;
+    if ((*call)->blocks > 1)
+        pthread_cond_broadcast(&ni->work);
+    else
+        pthread_cond_signal(&ni->work);
+    pthread_mutex_unlock(&ni->mutex);
+    return NULL;
+}
+
+int netintegral_ready(struct netintegral_call* call) {
+    pthread_mutex_lock(&call->ni->mutex);
+    int done = call->done;
+    pthread_mutex_unlock(&call->ni->mutex);
+    return done;
+}
+
+const char* netintegral_wait(struct netintegral_call* call, long double* value) {
+    // The waiting thread computes the blocks nobody has taken yet
+    struct netintegral* ni = call->ni;
+    pthread_mutex_lock(&ni->mutex);
+    while (!call->done) {
+        if (call->next_block == call->blocks) {
+            pthread_cond_wait(&call->finished, &ni->mutex);
+            continue;
+        }
+        unsigned long long b = take_block(ni, call);
+        pthread_mutex_unlock(&ni->mutex);
+        long double part = call_block(call, b);
+        pthread_mutex_lock(&ni->mutex);
+        put_block(call, b, part);
+    }
+    pthread_mutex_unlock(&ni->mutex);
+
+    const char* err = call->error;
+    *value = err ? 0 : call->value;
+    pthread_cond_destroy(&call->finished);
+    reduce_free(&call->sums);
+    free(call);
+    return err;
+}
+
+const char* netintegral_integrate(struct netintegral* ni, const struct netintegral_job* job,
+                                  long double* value) {
+    struct netintegral_call* call;
+    const char* err = call_make(ni, job, &call);
+    if (err)
+        return err;
+
+    // One block is not worth waking the pool
+    if (call->blocks == 1) {
+        *value = dsum_value(dsum_of(call_block(call, 0)));
+        pthread_cond_destroy(&call->finished);
+        free(call);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&ni->mutex);
+    if (ni->queue_tail)
+        ni->queue_tail->next = call;
+    else
+        ni->queue = call;
+    ni->queue_tail = call;
+    pthread_cond_broadcast(&ni->work);
+    pthread_mutex_unlock(&ni->mutex);
+    return netintegral_wait(call, value);
+}
@@ -0,0 +1,68 @@
+/* File:     netintegral.h
+ * Purpose:  The library of the integrator: the Simpson integrals computed
+ |           by a pool of threads of the calling process, no server, no sockets
+ * Note:
+ |    1.  netintegral_open() starts the pool once, the threads are pinned
+ |        like the ones of the client and parked between the integrals
+ |    2.  An integral is cut into the same blocks as the jobs of the server
+ |        and its sum goes up the same tree (see reduce.h), so it has the
+ |        bits the server and its clients give for the same kernel
+ |    3.  f(x) is the builtin FUNCTION, an expression of x (see expr.h)
+ |        or the callback of the caller. The callback takes n <= 256 values
+ |        of x at once and is called from any thread of the pool
+ |    4.  netintegral_integrate() waits for the result, the integral of one
+ |        block is computed by the calling thread at once. netintegral_submit()
+ |        returns at once, netintegral_wait() takes the result: the waiting
+ |        thread computes the blocks of its integral the pool has not taken
+ |    5.  The calls are thread-safe, the integrals of many callers
+ |        share the pool in the order they come
+ |    6.  The library never exits the process: what goes wrong, the job
+ |        or the memory, is the message the calls return
+ |    7.  Link with libnetintegral.a -lm -pthread
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+#ifndef NETINTEGRAL_H
+#define NETINTEGRAL_H
+
+//==============================================================================
+// LIBRARY STRUCTURE SECTION
+//==============================================================================
+
+struct netintegral;         // the pool
+struct netintegral_call;    // the integral being computed
+
+typedef void (*netintegral_func)(const double* x, double* y, unsigned n, void* arg);
+    // PURPOSE:     y[i] = f(x[i]) for i < n
+
+struct netintegral_job {
+    long double from, to;
+    unsigned long long steps;   // of the Simpson formula
+    const char* expr;           // f(x) to compile, NULL for the builtin FUNCTION
+    netintegral_func func;      // the callback, takes over expr if not NULL
+    void* arg;                  // its last argument
+};
+
+//==============================================================================
+// FUNCTION PROTOTYPES SECTION
+//==============================================================================
+
+    struct netintegral* netintegral_open(unsigned threads, const char* kernel);
+    // PURPOSE:     Start the pool of threads (0 for all the CPUs) with the
+    //              Simpson kernel by name (NULL for the widest one, see
+    //              simpson.h). NULL if the kernel is not supported
+    //              or the pool cannot be started
+    void netintegral_close(struct netintegral* ni);
+    // PURPOSE:     Stop the pool, every call is to be waited before
+    const char* netintegral_integrate(struct netintegral* ni, const struct netintegral_job* job,
+                                      long double* value);
+    // PURPOSE:     Compute the integral, returns NULL or what went wrong
+    const char* netintegral_submit(struct netintegral* ni, const struct netintegral_job* job,
+                                   struct netintegral_call** call);
+    // PURPOSE:     Start the integral, returns NULL or what is wrong with the job
+    int netintegral_ready(struct netintegral_call* call);
+    // PURPOSE:     1 if the integral is computed, netintegral_wait() returns at once
+    const char* netintegral_wait(struct netintegral_call* call, long double* value);
+    // PURPOSE:     Take the integral, returns NULL or what went wrong,
+    //              the call is freed either way
+
+#endif // NETINTEGRAL_H
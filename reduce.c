@@ -0,0 +1,172 @@
+/* File:     reduce.c
+ * Purpose:  The reduction of the partial sums that does not depend
+ |           on how the work is split
+ * Note:
+ |    1.  dsum_add() is the double-double addition of two TwoSums, no
+ |        multiplication, so no FMA contraction may change its bits
+ |    2.  The nodes wait for their siblings in a short array: there are
+ |        about as many as the tasks in flight times the tree depth
+ |    3.  Nothing here exits on an error, the library (see netintegral.h)
+ |        returns it to the caller
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+//==============================================================================
+// INCLUDE SECTION
+//==============================================================================
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "reduce.h"
+
+//==============================================================================
+// DOUBLE-DOUBLE SECTION
+//==============================================================================
+
+struct dsum dsum_add(struct dsum a, struct dsum b) {
+    // The values and the rests are added exactly, then renormalized
+    double s = a.hi + b.hi, v = s - a.hi,
+           e = (a.hi - (s - v)) + (b.hi - v),
+           t = a.lo + b.lo, w = t - a.lo,
+           f = (a.lo - (t - w)) + (b.lo - w);
+    e += t;
+    double hi = s + e;
+    e -= hi - s;
+    e += f;
+    s = hi + e;
+    return (struct dsum) {s, e - (s - hi)};
+}
+
+struct dsum dsum_of(long double x) {
+    double hi = x;
+    return (struct dsum) {hi, (double)(x - hi)};
+}
+
+long double dsum_value(struct dsum s) {
+    return (long double)s.hi + s.lo;
+}
+
+struct dsum dsum_tree(struct dsum* leaves, unsigned long long n) {
+    if (!n)
+        return (struct dsum) {0, 0};
+
+    // The whole nodes pairwise, the left half first
+    unsigned long long w;
+    for (w = 1; 2 * w <= n; w *= 2)
+        for (unsigned long long i = 0; i + 2 * w <= n; i += 2 * w)
+            leaves[i] = dsum_add(leaves[i], leaves[i + w]);
+
+    // The nodes of the binary digits of n from the left
+    struct dsum total = {0, 0};
+    int first = 1;
+    for (unsigned long long pos = 0; w; w /= 2) {
+        if (!(n & w))
+            continue;
+        total = first ? leaves[pos] : dsum_add(total, leaves[pos]);
+        first = 0;
+        pos += w;
+    }
+    return total;
+}
+
+//==============================================================================
+// TREE SECTION
+//==============================================================================
+
+unsigned long long reduce_block(unsigned long long points) {
+    unsigned long long block = 1;
+    while (2 * block * points <= REDUCE_POINTS)
+        block *= 2;
+    return block;
+}
+
+unsigned long long reduce_span(unsigned long long offset, unsigned long long want,
+                               unsigned long long left, unsigned long long block) {
+    unsigned long long first = offset / block,
+                       blocks_left = (left + block - 1) / block,
+                       blocks = 1;
+    while (first % (2 * blocks) == 0 && 2 * blocks <= blocks_left &&
+           2 * blocks * block <= want)
+        blocks *= 2;
+    return (blocks * block < left) ? blocks * block : left;
+}
+
+void reduce_node(unsigned long long first, unsigned long long steps,
+                 unsigned long long segment, unsigned long long block,
+                 struct reduce_node* node) {
+    memset(node, 0, sizeof(struct reduce_node));
+    if (segment) {
+        node->segment = first / segment;
+        first %= segment;
+    }
+    node->block = first / block;
+    node->blocks = (steps + block - 1) / block;
+}
+
+static int is_node(const struct reduce_node* n) {
+    return n->blocks && !(n->blocks & (n->blocks - 1)) && !(n->block % n->blocks);
+}
+
+int reduce_put(struct reduce* r, struct reduce_node* node) {
+    struct reduce_node n = *node;
+    for (int joined = 1; joined && is_node(&n); ) {
+        joined = 0;
+        for (unsigned j = 0; j < r->len && !joined; ++j) {
+            struct reduce_node* s = &r->nodes[j];
+            if (s->segment != n.segment || s->blocks != n.blocks ||
+                s->block != (n.block ^ n.blocks))
+                continue;
+
+            // The parent takes the place of the two, then looks for its sibling
+            const struct reduce_node *left = (s->block < n.block) ? s : &n,
+                                     *right = (s->block < n.block) ? &n : s;
+            n.sum = dsum_add(left->sum, right->sum);
+            n.error = dsum_add(left->error, right->error);
+            n.block = left->block;
+            n.blocks *= 2;
+            *s = r->nodes[--r->len];
+            joined = 1;
+        }
+    }
+
+    if (r->len == r->size) {
+        unsigned size = r->size ? 2 * r->size : 16;
+        struct reduce_node* nodes = realloc(r->nodes, size * sizeof(struct reduce_node));
+        if (!nodes)
+            return 0;
+        r->nodes = nodes;
+        r->size = size;
+    }
+    r->nodes[r->len++] = *node = n;
+    return 1;
+}
+
+static int node_before(const struct reduce_node* x, const struct reduce_node* y) {
+    return (x->segment != y->segment) ? x->segment < y->segment : x->block < y->block;
+}
+
+void reduce_total(const struct reduce* r, long long segment,
+                  struct dsum* sum, struct dsum* error) {
+    // The nodes are few, the next one from the left is looked for every time
+    const struct reduce_node* last = NULL;
+    *sum = *error = (struct dsum) {0, 0};
+    while (1) {
+        const struct reduce_node* next = NULL;
+        for (unsigned j = 0; j < r->len; ++j) {
+            const struct reduce_node* n = &r->nodes[j];
+            if ((segment < 0 || n->segment == (unsigned long long)segment) &&
+                (!last || node_before(last, n)) && (!next || node_before(n, next)))
+                next = n;
+        }
+        if (!next)
+            break;
+        *sum = last ? dsum_add(*sum, next->sum) : next->sum;
+        *error = last ? dsum_add(*error, next->error) : next->error;
+        last = next;
+    }
+}
+
+void reduce_free(struct reduce* r) {
+    free(r->nodes);
+    memset(r, 0, sizeof(struct reduce));
+}
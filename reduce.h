@@ -0,0 +1,86 @@
+/* File:     reduce.h
+ * Purpose:  The reduction of the partial sums that does not depend
+ |           on how the work is split
+ * Note:
+ |    1.  The steps of a job (of a QMC scramble) are cut into the blocks
+ |        of about REDUCE_POINTS evaluations from its first one, the blocks
+ |        are the leaves of the binary tree: a node is 2^k blocks from
+ |        a multiple of 2^k, the last block may be short
+ |    2.  A task is a node. Its blocks are summed one by one by the kernel
+ |        and then pairwise up the tree, the server joins the two halves of
+ |        a node when both are in, the left one first. So every node has
+ |        the same sum whatever client, thread or order computed it
+ |    3.  The sums are double-double (the value and the rest), their
+ |        addition is error-free up to the rest, so the double kernels
+ |        lose nothing the long double ones keep
+ |    4.  The nodes that are left when the job is done are the ones of
+ |        the binary digits of its blocks, they are added from the left
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+#ifndef REDUCE_H
+#define REDUCE_H
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+#define REDUCE_POINTS   8192    // evaluations of f(x) of a leaf
+
+//==============================================================================
+// REDUCTION STRUCTURE SECTION
+//==============================================================================
+
+struct dsum {
+    double hi, lo;                      // the value is hi + lo, |lo| <= ulp(hi) / 2
+};
+
+struct reduce_node {
+    unsigned long long segment,         // the scramble, 0 if one
+                       block,           // the first one from the segment start
+                       blocks;          // a power of two
+    struct dsum sum, error;
+};
+
+struct reduce {
+    struct reduce_node* nodes;          // the ones without their sibling yet
+    unsigned len, size;
+};
+
+//==============================================================================
+// FUNCTION PROTOTYPES SECTION
+//==============================================================================
+
+    struct dsum dsum_add(struct dsum a, struct dsum b);
+    // PURPOSE:     a + b, the same bits for the same a and b
+    struct dsum dsum_of(long double x);
+    // PURPOSE:     The double-double of x, exact for the 64-bit mantissa
+    long double dsum_value(struct dsum s);
+    // PURPOSE:     hi + lo rounded to long double
+    struct dsum dsum_tree(struct dsum* leaves, unsigned long long n);
+    // PURPOSE:     The sum of the leaves of a node pairwise up the tree,
+    //              n need not be a power of two. The leaves are overwritten
+    unsigned long long reduce_block(unsigned long long points);
+    // PURPOSE:     The steps of a block for points evaluations per step,
+    //              a power of two
+    unsigned long long reduce_span(unsigned long long offset, unsigned long long want,
+                                   unsigned long long left, unsigned long long block);
+    // PURPOSE:     The steps of the greatest node from offset (a multiple of
+    //              block from the segment start) of at most want steps
+    //              and not past left steps, at least one block
+    void reduce_node(unsigned long long first, unsigned long long steps,
+                     unsigned long long segment, unsigned long long block,
+                     struct reduce_node* node);
+    // PURPOSE:     The node of the steps, first from the job start.
+    //              segment is the steps of a scramble, 0 if one
+    int reduce_put(struct reduce* r, struct reduce_node* node);
+    // PURPOSE:     Keep the node, joined with its siblings up the tree.
+    //              node becomes the one it is joined into.
+    //              0 if there is no memory to keep it
+    void reduce_total(const struct reduce* r, long long segment,
+                      struct dsum* sum, struct dsum* error);
+    // PURPOSE:     The sum of the nodes of the segment (-1 for all of them)
+    //              from the left, allocates nothing
+    void reduce_free(struct reduce* r);
+    // PURPOSE:     Drop the nodes
+
+#endif // REDUCE_H
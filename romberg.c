@@ -0,0 +1,69 @@
+/* File:     romberg.c
+ * Purpose:  The server side of the incremental Romberg integration
+ * Note:
+ |    1.  Only the last row of the table is kept: the next one is
+ |        made from it, R(k, j) = R(k, j-1) + (R(k, j-1) - R(k-1, j-1)) / (4^j - 1)
+ |    2.  ROMBERG_FIRST_STEPS is a single interval, so the coarse levels
+ |        may agree by chance (a periodic f(x) sampled at its zeros),
+ |        the first ROMBERG_MIN_LEVELS are never taken as converged
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+//==============================================================================
+// INCLUDE SECTION
+//==============================================================================
+
+#include <math.h>
+#include <string.h>
+
+#include "romberg.h"
+
+//==============================================================================
+// TABLE SECTION
+//==============================================================================
+
+static long double tolerance(const struct romberg* r) {
+    long double rel = r->rel_tol * fabsl(r->value);
+    return (r->abs_tol > rel) ? r->abs_tol : rel;
+}
+
+void romberg_start(struct romberg* r, long double from, long double to,
+                   long double ends, long double abs_tol, long double rel_tol) {
+    memset(r, 0, sizeof(struct romberg));
+    r->abs_tol = abs_tol;
+    r->rel_tol = rel_tol;
+    r->intervals = ROMBERG_FIRST_STEPS;
+
+    // The nodes of a single interval are the ends
+    r->row[0] = r->value = (to - from) * ends / 2;
+    r->error = INFINITY;
+    r->levels = 1;
+}
+
+int romberg_converged(const struct romberg* r) {
+    return r->levels >= ROMBERG_MIN_LEVELS && r->error <= tolerance(r);
+}
+
+int romberg_level(struct romberg* r, long double midpoints) {
+    long double row[ROMBERG_MAX_LEVELS], factor = 1;
+    unsigned k = r->levels;
+
+    row[0] = (r->row[0] + midpoints) / 2;
+    for (unsigned j = 1; j <= k; ++j) {
+        factor *= 4;
+        row[j] = row[j - 1] + (row[j - 1] - r->row[j - 1]) / (factor - 1);
+    }
+    memcpy(r->row, row, (k + 1) * sizeof(long double));
+
+    r->error = fabsl(row[k] - r->value);
+    r->value = row[k];
+    r->intervals *= 2;
+    ++r->levels;
+    return romberg_converged(r) || r->levels == ROMBERG_MAX_LEVELS;
+}
+
+long double romberg_value(const struct romberg* r, long double* error,
+                          unsigned* levels) {
+    *error = r->error;
+    *levels = r->levels;
+    return r->value;
+}
@@ -0,0 +1,56 @@
+/* File:     romberg.h
+ * Purpose:  The server side of the incremental Romberg integration:
+ |           the trapezoid levels and their extrapolation
+ * Note:
+ |    1.  Every level doubles the intervals of the last one, so only the
+ |        new midpoints are computed: the clients return their sum and
+ |        the new trapezoid sum is the mean of the last one and of it
+ |    2.  The trapezoid sums are extrapolated by Richardson, the levels
+ |        go on until two diagonal estimates of the Romberg table meet
+ |        max(abs_tol, rel_tol * |integral|)
+ |    3.  Nothing of a level is computed twice, the job costs the
+ |        evaluations of its last level only
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+#ifndef ROMBERG_H
+#define ROMBERG_H
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+#define ROMBERG_FIRST_STEPS     1       // the first level is the ends only
+#define ROMBERG_MIN_LEVELS      5       // levels before the estimates are trusted
+#define ROMBERG_MAX_LEVELS      32      // refinement limit, 2^31 intervals
+
+//==============================================================================
+// ROMBERG STRUCTURE SECTION
+//==============================================================================
+
+struct romberg {
+    long double row[ROMBERG_MAX_LEVELS],    // the last row of the table
+                value, error,               // its diagonal and the change of it
+                abs_tol, rel_tol;
+    unsigned levels;                        // the rows so far
+    unsigned long long intervals;           // of the last trapezoid sum
+};
+
+//==============================================================================
+// FUNCTION PROTOTYPES SECTION
+//==============================================================================
+
+    void romberg_start(struct romberg* r, long double from, long double to,
+                       long double ends, long double abs_tol, long double rel_tol);
+    // PURPOSE:     Start with the trapezoid of ROMBERG_FIRST_STEPS intervals,
+    //              ends is f(from) + f(to)
+    int romberg_level(struct romberg* r, long double midpoints);
+    // PURPOSE:     Take the midpoint sum (times the step) of the intervals
+    //              of the last level, 1 if no more levels are needed
+    int romberg_converged(const struct romberg* r);
+    // PURPOSE:     1 if the tolerance is met
+    long double romberg_value(const struct romberg* r, long double* error,
+                              unsigned* levels);
+    // PURPOSE:     The integral, its error estimate and the number
+    //              of the levels
+
+#endif // ROMBERG_H
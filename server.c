@@ -1,18 +1,112 @@
 /* File:     server.c
- * Purpose:  Compute a definite integral using the Simpson formula
+ * Purpose:  Compute definite integrals using the Simpson formula
  |           by distributing integration intervals to clients to calculate them
- * Input:    clients_max (number of clients)
+ * Input:    quorum (number of clients to start with)
  | Output:   Estimate of the integral from From to To of FUNCTION
  |           using the Simpson formula
  * Compile:  Better to compile via makefile
- * Usage:    ./server <number of clients>
+ * Usage:    ./server [-s static|guided] [-n jobs] [-f "f(x)"]
+ |                    [-e abs_tol] [-r rel_tol] [-i] [-c dims] [-q dims] [-j job_file] [-u socket]
+ |                    [-t] [-l level] [-P port] [-M group] [-R port] [-S host[:port],...]
+ |                    [-C cache] [-m max_clients] [-L threads] <quorum of clients>
  * Note:
- |    1.  f(x) is hardcoded as FUNCTION (predefined)
+ |    1.  f(x) is the builtin FUNCTION (see simpson.h) unless given by -f,
+ |        the expression is compiled here and shipped to the clients
  |    2.  Integrate bounds are from From to To (hardcoded)
- |    3.  Number of steps is NUM_STEPS (hardcoded)
+ |    3.  Number of steps is NUM_STEPS (hardcoded) unless a tolerance
+ |        is given: then the integral is adaptive, the clients compute
+ |        Gauss-Kronrod estimates and the server bisects the worst
+ |        subintervals until the tolerance is met
  |    4.  TurboBoost avoidance is realized using sort of crutch
  |        by setting taskss for other cores unused in computation.
  |        These taskss are the same as the first one, only to get cores busy.
+ |    5.  All the sockets are non-blocking and served by one event loop
+ |        (edge-triggered epoll on Linux, see event.c): accepting,
+ |        handshakes, tasks and results. Every connection has its own
+ |        read and write buffers, so partial frames are fine
+ |    6.  The messages go in the frames (see wire.c). The tasks for a client
+ |        are buffered while the events are handled and written at once
+ |        after, so the tasks queued together share one frame
+ |    7.  The server is a coordinator of the job queue (see job.h): the jobs
+ |        come from the command line, the job file (-j) or the callers
+ |        on the Unix socket (-u), every caller gets its own results.
+ |        The jobs are pipelined: the clients take the tasks of the next
+ |        job as soon as the current one has no more to hand out, and
+ |        a client gets a batch of the small tasks in one dispatch
+ |    8.  A lost client does not stop the jobs: its tasks are given to the
+ |        other clients. The task running far longer than the median rate
+ |        of the clients promises gets a speculative copy on an idle client,
+ |        the first result is taken and the other one is ignored
+ |    9.  The clients stream the partial sums of their tasks, so every
+ |        second the server prints the running estimate of every job with
+ |        its progress and ETA (the callers get them as the progress lines).
+ |        A caller may cancel its job, the clients stop it at once
+ |    10. The server keeps the times of the phases: discovery (until the
+ |        last client connects), handshake and for every job dispatch (until
+ |        the first task is sent), compute (until the last result) and
+ |        reduction (until the answer), and the counters of every client
+ |        and of its threads (see metrics.h). A caller gets their dump by
+ |        writing "stats", "-t" prints it after every job
+ |    11. The messages go through the asynchronous log (see logger.h),
+ |        "-l" sets the most verbose level printed, "-l error" leaves only
+ |        the results
+ |    12. The clients measure their throughput at connect (see client.c),
+ |        the Simpson chunks are sized by it, not by the cores, so the
+ |        static slices of the fast and the slow machines end together
+ |    13. "-R port" makes the server a relay: it waits for its own clients,
+ |        finds the upstream server by its broadcasts on the port and
+ |        connects to it as one client of all the cores and the throughput
+ |        of its children. Every task of the upstream server is a job here,
+ |        split among the children, its one reduced result goes upward in
+ |        the order of the tasks. "-P" moves the broadcasts of the relay
+ |        (and of any server) to another port, so the relays of one network
+ |        and their children find each other (see client.c). The progress
+ |        and the counters of the children stay on the relay
+ |    14. "-c dims" and "-q dims" integrate f(x1, ..., xdims) over the cube
+ |        [From, To]^dims by the tensor Gauss cubature or by the scrambled
+ |        Sobol points (see cubature.h). Their cells or points are numbered
+ |        and handed out in ranges like the Simpson steps, a QMC range
+ |        stays in one scramble and the spread of the scrambles gives
+ |        the standard error
+ |    15. "-C file" keeps the results in the cache file (see cache.h):
+ |        a job of a cached integral is answered at once, the cached ranges
+ |        of its steps are not handed out, every result taken is cached.
+ |        So a rerun or a job cancelled halfway costs only what is new.
+ |        The servers of one host may share the file, the relays do not
+ |        cache, their root does
+ |    16. "-i" with a tolerance refines incrementally (see romberg.h): the
+ |        steps are doubled level by level and only the new midpoints are
+ |        handed out, their sums are kept here and extrapolated by Romberg
+ |        until two estimates agree. The levels are cached one by one,
+ |        so a rerun with a tighter tolerance starts at the first new level
+ |    17. The clients find the server by their probes (see discovery.h),
+ |        it answers them at once from the event loop. The TCP port is
+ |        the one of the broadcasts unless it is taken, so the clients
+ |        may connect by the address only ("-S" of the client). "-M" adds
+ |        the multicast group to the broadcasts, "-S" of a relay lists
+ |        its upstream servers
+ |    18. The membership is elastic: the jobs start once the quorum of the
+ |        clients is there, and the server goes on answering the probes
+ |        and accepting the clients (up to "-m") while it runs. A new client
+ |        takes its share of the work left at once. A client that sends
+ |        MSG_DRAIN gets no more tasks, it is let go with MSG_BYE once its
+ |        results are in. The bye is written by the loop like any frame,
+ |        the slot is freed after it. A relay tells its upstream server the new cores
+ |        and throughput of its children by another MSG_HELLO
+ |    19. The results are reproducible: the chunks are the nodes of the tree
+ |        of the steps and their sums are joined up the tree, not in the
+ |        order they come (see reduce.h). So the integral has the same bits
+ |        for any clients, threads, "-s" mode, relays or cached ranges,
+ |        as long as the clients run the same kernel
+ |    20. "-L" computes the Simpson jobs in this process by the pool of the
+ |        library (see netintegral.h), no clients, no TCP: the quorum is
+ |        not given. The jobs of "-u" are computed one by one in the event
+ |        loop, the other methods are refused. The blocks and the tree are
+ |        the ones of the clients, so the bits are the same
+ |    21. A sweep job (see job.h) sends its records to every client with
+ |        f(x, p), its tasks are ranges of the records. The integral of
+ |        every record comes in MSG_VALUE, a relay passes them upward at
+ |        once with the numbers of the upstream records
  * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
 */
 /*==============================================================================
@@ -26,6 +120,7 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -35,10 +130,28 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
-#include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <sys/un.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
 
 #include "alerts.h"
+#include "net_msg.h"
+#include "expr.h"
+#include "adaptive.h"
+#include "romberg.h"
+#include "kronrod.h"
+#include "simpson.h"
+#include "cubature.h"
+#include "event.h"
+#include "wire.h"
+#include "discovery.h"
+#include "job.h"
+#include "cache.h"
+#include "metrics.h"
+#include "netintegral.h"
     // used macros: ERROR   - print error with code line and exit
     //              TRY_TO - if (... == -1) then ERROR it
     //              PRINT   - printf macro
@@ -49,29 +162,136 @@
 //==============================================================================
 
 // Define integral parameters
-#define FUNCTION(x)    x*x*x/(x*x + x + 1/x - 2)
 #define NUM_STEPS      2000000000
+#define NUM_EVALS      (2.0 * NUM_STEPS)    // evaluations of f(x) of a cube job
 
 // Define errors
 #define ERROR_INPUT             -1
 
 // Debug definitions
-#define DEBUG
 #define LINE "===========================================\n"
 
-// Define network parameters
-#define BROADCAST_PORT  31123
+// Define membership parameters
+#define CLIENTS_MAX         256 // connections at once unless -m
+#define HELLO_CORES_MAX     (1 << 20) // cores one hello may bring, a relay's included
+
+// Define scheduling parameters
+#define SCHED_STATIC        0   // one slice per client sized by its throughput
+#define SCHED_GUIDED        1   // guided self-scheduling, clients pull chunks
+#define GUIDED_FACTOR       2   // chunk = remaining * share / GUIDED_FACTOR
+#define MIN_CHUNK_STEPS     1000000 // lower chunk bound per client core
+
+// Define event loop parameters
+#define MAX_EVENTS          256 // events taken by one wakeup
+#define READ_CHUNK          4096 // bytes read by one call
+
+// Define connection states
+#define CONN_FREE           0   // the slot is not used
+#define CONN_HANDSHAKE      1   // connected, waiting for the number of cores
+#define CONN_IDLE           2   // ready for a task
+#define CONN_BUSY           3   // computing a task
+#define CONN_BYE            4   // the bye is queued, closed once it is written
+
+// Define event sources
+#define SOURCE_BOSS         0   // the TCP listener
+#define SOURCE_CLIENT       1   // struct conn
+#define SOURCE_CONTROL      2   // the Unix socket listener
+#define SOURCE_CALLER       3   // struct caller
+#define SOURCE_UPSTREAM     4   // struct upstream
+#define SOURCE_PROBE        5   // the UDP socket of the probes
+
+// Define coordinator parameters
+#define BATCH_TASKS         64  // tasks a client may own at once
+#define JOB_LINE_MAX        4096 // job line length limit
+#define VALUE_LINE_MAX      96  // a value line of a sweep to the caller
+
+// Define recovery parameters
+#define SPECULATE_TICK      100 // ms between the straggler checks
+#define BYE_TIMEOUT         1.0 // s the exit waits for the byes to be written
+#define SPECULATE_FACTOR    3   // a task this times slower than expected is copied
+#define SPECULATE_MIN       0.5 // s, the tasks shorter than this are never copied
+#define RATE_WEIGHT         0.3 // weight of the last task in the client rate
+
+// Define progress parameters
+#define PROGRESS_PERIOD     1.0 // s between the progress reports
+
+// Define adaptive integration parameters
+#define ADAPTIVE_PIECES     4   // initial subintervals per client core
+#define ADAPTIVE_PANELS     4   // Kronrod panels per client core in a task
 
 //==============================================================================
-// CLIENT TASK STRUCTURE SECTION
+// CONNECTION STRUCTURE SECTION
 //==============================================================================
 
-struct net_msg {
-    int tcp_port;
-    unsigned cores, steps;
-    long double local_from,
-                local_to,
-                distance;
+struct task {
+    struct job* job;                    // not valid any more once done
+    struct interval owned;              // the adaptive subinterval
+    struct steps_range range;           // the Simpson steps
+    double work;                        // points of f(x) to compute
+    unsigned copies;                    // clients computing the task
+    int done;                           // the result is taken or cancelled
+    unsigned long long part_steps;      // the progress the client reported
+    long double part;
+};
+
+struct task_ref {
+    struct task* task;
+    double sent;                        // the time it was sent
+};
+
+struct conn {
+    int source;                         // SOURCE_CLIENT
+    int fd, state;
+    unsigned cores;                     // threads of the client
+    double capacity;                    // evaluations per second it measured
+    unsigned width;                     // doubles per SIMD instruction
+    struct placement placement;         // of its threads
+    unsigned func_id;                   // the f(x) the client has, 0 if none
+    struct task_ref owned[BATCH_TASKS]; // the tasks in the order sent
+    unsigned owned_head, owned_len;
+    int draining;                       // sent MSG_DRAIN, gets no more tasks
+    double rate,                        // points per second per core, 0 unknown
+           last_result;                 // the time of the last result
+    struct wire_buf in,                 // incomplete incoming frame
+                    out;                // frames the socket did not take yet
+    int dirty;                          // out is to be written
+
+    // Counters of the stats dump
+    unsigned long long tasks, steps,    // results taken
+                       bytes_in, bytes_out;
+    double evals,                       // points of f(x) of the results
+           busy, idle,                  // s with tasks, s idle while the jobs wait
+           since;                       // the time counted up to, 0 if not counted
+    struct thread_stats* threads;       // as the client reported them
+};
+
+struct caller {
+    int source;                         // SOURCE_CALLER
+    int fd, closed;                     // fd is -1 once the caller is gone,
+                                        // closed once it writes nothing more
+    unsigned jobs;                      // jobs not reported yet
+    struct wire_buf in;                 // incomplete line
+    struct wire_buf out;                // replies not written yet
+    struct job* sweep;                  // the sweep waiting for its records
+    int dead;                           // dropped, freed after the events
+    struct caller* next;                // the dead ones
+};
+
+struct relayed {
+    int done;                           // the result is ready to go upward
+    struct dsum value, error;
+};
+
+struct upstream {
+    int source;                         // SOURCE_UPSTREAM
+    int fd;                             // -1 if not connected
+    struct wire_buf in, out;
+    struct expr func;                   // f(x) of the next tasks
+    struct sweep_record* records;       // the sweep of the next tasks
+    unsigned records_len;
+    struct relayed tasks[BATCH_TASKS];  // the results in the order of the tasks
+    unsigned long long first,           // the oldest task not answered
+                       next;            // the number of the next task
 };
 
 //==============================================================================
@@ -84,18 +304,211 @@ struct net_msg {
     // PURPOSE:     obvious
     void enable_keepalive(int sock);
     // PURPOSE:     check if the connection is alive
+    void set_nonblock(int sock, int on);
+    // PURPOSE:     switch O_NONBLOCK of the socket
+    void poll_events();
+    // PURPOSE:     wait for the events once and handle all of them
+    void accept_clients();
+    // PURPOSE:     accept all the pending connections
+    void conn_read(struct conn* c);
+    // PURPOSE:     read until EAGAIN and handle the complete frames
+    void conn_queued(struct conn* c);
+    // PURPOSE:     remember the connection has frames to write
+    void conn_flush(struct conn* c);
+    // PURPOSE:     write the buffered frames until EAGAIN
+    void flush_clients();
+    // PURPOSE:     write the frames queued for all the connections
+    void handle_msg(struct conn* c, struct net_msg* msg);
+    // PURPOSE:     handle the message by the connection state
+    int next_task(struct conn* c, struct job* job, struct task* t);
+    // PURPOSE:     fill the next task of the job for the client,
+    //              0 if the job has no work for now
+    int next_chunk(struct conn* c, struct job* job, struct task* t);
+    // PURPOSE:     the next Simpson chunk for the client
+    unsigned long long job_block(const struct job* job);
+    // PURPOSE:     the steps of a leaf of the tree of the job
+    void job_node(const struct job* job, unsigned long long first, unsigned long long steps,
+                  struct reduce_node* node);
+    // PURPOSE:     the node of the steps of the job, first counts from job->base
+    double client_share(const struct conn* c);
+    // PURPOSE:     the part of the work the client does in the time
+    //              all the clients do all of it
+    int next_interval(struct conn* c, struct job* job, struct task* t);
+    // PURPOSE:     the next adaptive subinterval for the client
+    void task_msg(struct conn* c, const struct task* t, struct net_msg* msg);
+    // PURPOSE:     the MSG_TASK of the task for the client
+    void give_task(struct conn* c, struct task* t);
+    // PURPOSE:     send the task to the client and make it the owner
+    struct job* take_result(struct conn* c, struct net_msg* result);
+    // PURPOSE:     account the result of the oldest task the client owns,
+    //              returns its job
+    void take_value(struct conn* c, struct net_msg* value);
+    // PURPOSE:     keep the integral of the record of a sweep the client computes
+    void feed_clients();
+    // PURPOSE:     give tasks to the idle clients while there is work
+    const char* local_check(const struct job* job);
+    // PURPOSE:     NULL if the job may be computed in this process,
+    //              or what is wrong
+    void run_local();
+    // PURPOSE:     compute the queued jobs by the pool of this process
+    void conn_lost(struct conn* c, const char* why);
+    // PURPOSE:     disconnect the client and give its tasks back to the jobs
+    void conn_close(struct conn* c);
+    // PURPOSE:     close the socket of the client and free its slot,
+    //              take its cores out of the totals
+    void conn_hello(struct conn* c, struct net_msg* msg);
+    // PURPOSE:     take the cores and the throughput of the client,
+    //              a new one joins the idle ones
+    //              (no cores or above HELLO_CORES_MAX drops it)
+    void conn_drain(struct conn* c);
+    // PURPOSE:     give the client no more tasks, let it go once it is idle
+    void conn_leave(struct conn* c);
+    // PURPOSE:     say bye to the drained client and free its slot
+    void speculate();
+    // PURPOSE:     copy the tasks of the stragglers to the idle clients
+    double now();
+    // PURPOSE:     monotonic time in seconds
+    int dispatch(struct conn* c);
+    // PURPOSE:     give the client a batch of tasks, 0 if no work for now
+    void send_task(struct conn* c, struct net_msg* task);
+    // PURPOSE:     write the task to the client
+    void send_func(struct conn* c, const struct expr* f);
+    // PURPOSE:     write the integrand to the client
+    void send_sweep(struct conn* c, const struct job* job);
+    // PURPOSE:     write the records of the sweep to the client
+    void release_client(struct conn* c, int type);
+    // PURPOSE:     send MSG_DONE or MSG_BYE to the client,
+    //              MSG_BYE also takes it out, the loop closes it
+    //              once the bye is written
+    void enqueue(const struct job* job);
+    // PURPOSE:     put the copy of the job at the end of the queue
+    int job_finished(struct job* job);
+    // PURPOSE:     1 if the job has nothing to compute and nothing in flight
+    void finish_job(struct job* job);
+    // PURPOSE:     report the result of the job and drop it,
+    //              a Romberg job goes on to its next level instead
+    int refine_job(struct job* job);
+    // PURPOSE:     start the next Romberg level of the finished one,
+    //              0 if the job is done
+    long double romberg_ends(const struct job* job);
+    // PURPOSE:     f(from) + f(to) of the job
+    void drop_job(struct job* job);
+    // PURPOSE:     unlink the job from the queue and free it
+    void cancel_job(struct caller* cl, unsigned id);
+    // PURPOSE:     stop the job of the caller and tell the caller
+    void stop_job(struct job* job);
+    // PURPOSE:     stop the job on the clients and drop it
+    int is_adaptive(const struct job* job);
+    // PURPOSE:     1 if the job is bisected here, not split into ranges
+    long double qmc_error(const struct job* job);
+    // PURPOSE:     the standard error of the QMC job by its scrambles
+    void print_sweep(const struct job* job);
+    // PURPOSE:     report the integrals of the records of the sweep
+    void reduce_job(struct job* job, struct dsum* sum, struct dsum* error);
+    // PURPOSE:     the sums of the tree of the finished job, the scrambles
+    //              go to job->replicate, the whole ranges to the cache
+    void cache_node(const struct job* job, const struct reduce_node* node);
+    // PURPOSE:     keep the steps of the node in the cache
+    void cache_load(struct job* job);
+    // PURPOSE:     take the cached result or ranges of the job
+    void skip_cached(struct job* job);
+    // PURPOSE:     move the next step of the job past the cached ranges
+    void finish_cached();
+    // PURPOSE:     finish the jobs the cache answered in full
+    void take_progress(struct conn* c, struct net_msg* msg);
+    // PURPOSE:     account the partial sum of the oldest task of the client
+    void report_progress();
+    // PURPOSE:     print the running estimates of the jobs once a period
+    void read_job_file(const char* path);
+    // PURPOSE:     queue the jobs of the file
+    void open_control(const char* path);
+    // PURPOSE:     listen to the callers on the Unix socket
+    void accept_callers();
+    // PURPOSE:     accept all the pending callers
+    void caller_read(struct caller* cl);
+    // PURPOSE:     read until EAGAIN and queue the complete job lines
+    void caller_job(struct caller* cl, struct job* job);
+    // PURPOSE:     queue the parsed job of the caller and free its records
+    void caller_reply(struct caller* cl, const char* fmt, ...);
+    // PURPOSE:     send the line to the caller
+    void caller_flush(struct caller* cl);
+    // PURPOSE:     write the replies queued for the caller until EAGAIN
+    void caller_drop(struct caller* cl);
+    // PURPOSE:     drop the caller once it is closed, has no jobs
+    //              and all its replies are written
+    void free_callers();
+    // PURPOSE:     free the dropped callers, no event refers to them
+    void conn_clock(struct conn* c);
+    // PURPOSE:     count the time since the last call as busy or idle
+    //              by the client state, call before the state changes
+    void take_stats(struct conn* c, struct net_msg* msg);
+    // PURPOSE:     keep the counters of the client thread
+    void dump_stats(struct wire_buf* b);
+    // PURPOSE:     append the text dump of the phases and the counters
+    void print_stats();
+    // PURPOSE:     print the dump to stdout after the queued log lines
+    void connect_upstream();
+    // PURPOSE:     find the upstream server and say hello as one client
+    void upstream_hello();
+    // PURPOSE:     tell the upstream server the cores and the throughput
+    //              of the children
+    void upstream_read();
+    // PURPOSE:     read until EAGAIN and handle the upstream messages
+    void upstream_flush();
+    // PURPOSE:     write the results queued for the upstream server
+    void upstream_close(const char* why);
+    // PURPOSE:     disconnect from the upstream server and drop its jobs,
+    //              why is NULL if the server said bye
+    void relay_task(const struct net_msg* task);
+    // PURPOSE:     queue the job of the upstream task
+    void relay_cancel(unsigned id);
+    // PURPOSE:     stop the jobs of the cancelled upstream job, answer them
+    void relay_result(const struct job* job, struct dsum value, struct dsum error);
+    // PURPOSE:     keep the result of the relayed job (NULL for none),
+    //              queue the results ready to go upward
 
 //==============================================================================
 // GLOBAL VARIABLES
 //==============================================================================
 
     int bsock;          // broadcast socket
-    int clients_max;    // maximum number of clients
+    int probe_sock;     // the probes of the clients
+    int clients_max = CLIENTS_MAX;  // -m, the connections at once
+    int quorum;         // clients to start the jobs with
     int boss;         // boss
-    int *client;        // clients array
-    int *cores;         // cores array
-    int bytes;          // temp bytes variable
+    int control = -1;   // Unix socket for the callers
+    struct conn *conns; // clients array
+    int clients_ready;  // clients done with the handshake
+    int clients_leaving;    // clients with the bye not written yet
+    int *idle;          // stack of the idle clients
+    int idle_len;
+    int *dirty;         // stack of the clients with frames to write
+    int dirty_len;
     int cores_all;    // total number of cores
+    double capacity_all;    // total evaluations per second, 0 if unknown
+
+    // Event sources of the listeners
+    int source_boss = SOURCE_BOSS,
+        source_control = SOURCE_CONTROL,
+        source_probe = SOURCE_PROBE;
+
+    // Scheduling variables
+    int sched_mode = SCHED_GUIDED;
+    int jobs = 1;                       // times to compute the integral
+    int in_flight;                      // tasks being computed
+
+    // Job queue variables
+    struct job *queue, *queue_tail;     // the jobs not finished yet
+    struct caller* dead_callers;        // dropped during the events
+    unsigned job_ids;                   // the id of the last job queued
+    struct expr last_func;              // f(x) of the last job queued
+    unsigned last_func_id;
+
+    // Integration method variables
+    int method = METHOD_SIMPSON;
+    int incremental = 0;                // -i, Romberg instead of Gauss-Kronrod
+    unsigned dims = 1;                  // -c or -q, of the cube
+    long double abs_tol = 0, rel_tol = 0;
 
     // Network variables
     struct sockaddr_in addr;
@@ -106,6 +519,31 @@ struct net_msg {
     long double From = 0;
     long double To = 1;
 
+    // integrand, func.ops == 0 for the builtin FUNCTION
+    struct expr func;
+
+    // Discovery variables
+    struct discovery discovery;         // -P and -M, the port of the broadcasts
+                                        // and the probes and the group
+
+    // Relay variables
+    int upstream_port = 0;              // -R, the broadcasts of the upstream
+                                        // server, 0 if this one is the root
+    struct discovery upstream_discovery;    // -S, its static servers
+    struct upstream upstream = {.source = SOURCE_UPSTREAM, .fd = -1};
+
+    // Local mode variables
+    unsigned local_threads = 0;         // -L, 0 if the clients compute
+    struct netintegral* local_pool;
+
+    // Stats variables
+    int print_phases = 0;               // -t, dump after every job
+    int stats_due = 0;                  // a job is over, dump after the events
+    double t_start, t_connected, t_ready;
+    unsigned jobs_done, last_job;       // jobs finished, the last one
+    double last_phases[3],              // dispatch, compute, reduction
+           total_phases[3];             // the same over all the jobs
+
 //==============================================================================
 // MAIN CODE SECTION
 //==============================================================================
@@ -113,126 +551,1856 @@ struct net_msg {
 int main(int argc, char** argv)
 {
     // ARGS CHECK
-    if (argc != 2)
-        PRINT_ERR("USAGE: %s [NUMBER OF CLIENTS]", argv[0]);
+    int opt;
+    int err;
+    t_start = now();
+    const char *job_file = NULL,
+               *control_path = NULL;
+    discovery_init(&discovery, BROADCAST_PORT);
+    discovery_init(&upstream_discovery, 0);
+    while ((opt = getopt(argc, argv, "s:n:f:e:r:ic:q:j:u:tl:P:M:R:S:C:m:L:")) != -1) {
+        if (opt == 's' && !strcmp(optarg, "static"))
+            sched_mode = SCHED_STATIC;
+        else if (opt == 's' && !strcmp(optarg, "guided"))
+            sched_mode = SCHED_GUIDED;
+        else if (opt == 'n' && sscanf(optarg, "%d", &jobs) == 1 && jobs > 0)
+            continue;
+        else if (opt == 'f') {
+            if ((err = expr_compile(optarg, &func)) >= 0)
+                PRINT_ERR("Cannot compile f(x) at \"%s\"", optarg + err);
+        }
+        else if (opt == 'e' && sscanf(optarg, "%Lf", &abs_tol) == 1 && abs_tol > 0)
+            method = METHOD_KRONROD;
+        else if (opt == 'r' && sscanf(optarg, "%Lf", &rel_tol) == 1 && rel_tol > 0)
+            method = METHOD_KRONROD;
+        else if (opt == 'i')
+            incremental = 1;
+        else if (opt == 'c' && sscanf(optarg, "%u", &dims) == 1)
+            method = METHOD_CUBATURE;
+        else if (opt == 'q' && sscanf(optarg, "%u", &dims) == 1)
+            method = METHOD_QMC;
+        else if (opt == 'j')
+            job_file = optarg;
+        else if (opt == 'u')
+            control_path = optarg;
+        else if (opt == 't')
+            print_phases = 1;
+        else if (opt == 'l' && (log_level = log_parse(optarg)) >= 0)
+            continue;
+        else if (opt == 'P' && sscanf(optarg, "%d", &discovery.port) == 1 &&
+                 discovery.port > 0 && discovery.port < 65536)
+            continue;
+        else if (opt == 'M' && discovery_group(&discovery, optarg))
+            upstream_discovery.group = discovery.group;
+        else if (opt == 'S' && discovery_servers(&upstream_discovery, optarg))
+            continue;
+        else if (opt == 'R' && sscanf(optarg, "%d", &upstream_port) == 1 &&
+                 upstream_port > 0 && upstream_port < 65536)
+            continue;
+        else if (opt == 'C') {
+            if (!cache_open(optarg))
+                PRINT_ERR("Cannot open the cache %s", optarg);
+        }
+        else if (opt == 'm' && sscanf(optarg, "%d", &clients_max) == 1 && clients_max > 0)
+            continue;
+        else if (opt == 'L' && sscanf(optarg, "%u", &local_threads) == 1 && local_threads > 0)
+            continue;
+        else
+            PRINT_ERR("USAGE: %s [-s static|guided] [-n jobs] [-f \"f(x)\"] [-e abs_tol] [-r rel_tol] [-i] [-c dims] [-q dims] [-j job_file] [-u socket] [-t] [-l error|warn|info|debug] [-P port] [-M group] [-R port] [-S host[:port],...] [-C cache] [-m max_clients] [-L threads] [QUORUM OF CLIENTS]", argv[0]);
+    }
+
+    if (optind != argc - 1 && !(local_threads && optind == argc))
+        PRINT_ERR("USAGE: %s [-s static|guided] [-n jobs] [-f \"f(x)\"] [-e abs_tol] [-r rel_tol] [-i] [-c dims] [-q dims] [-j job_file] [-u socket] [-t] [-l error|warn|info|debug] [-P port] [-M group] [-R port] [-S host[:port],...] [-C cache] [-m max_clients] [-L threads] [QUORUM OF CLIENTS]", argv[0]);
 
-    if (!sscanf(argv[1], "%d", &clients_max))
+    if (!local_threads && (sscanf(argv[optind], "%d", &quorum) != 1 || quorum <= 0))
         PRINT_ERR("ERROR: The number of clients should be positive integer");
+    if (clients_max < quorum)
+        clients_max = quorum;
 
-    if (!(client = calloc(clients_max, sizeof(int))) ||
-        !(cores  = calloc(clients_max, sizeof(int))))
+    if (incremental && method != METHOD_KRONROD)
+        PRINT_ERR("-i refines until the tolerance is met, give -e or -r");
+    if (incremental)
+        method = METHOD_ROMBERG;
+
+    if (upstream_port == discovery.port)
+        PRINT_ERR("The relay would find itself, give it another broadcast port by -P");
+    if (upstream_discovery.servers_len && !upstream_port)
+        PRINT_ERR("-S lists the upstream servers of a relay, give -R");
+    upstream_discovery.port = upstream_port;
+    if (local_threads && upstream_port)
+        PRINT_ERR("-L computes the jobs here, a relay gives them to its clients");
+
+    if (!(conns = calloc(clients_max, sizeof(struct conn))) ||
+        !(idle  = calloc(clients_max, sizeof(int))) ||
+        !(dirty = calloc(clients_max, sizeof(int))))
         PRINT_ERR("Memory allocation");
 
+    // The lost clients are found by the errors of write, not by the signal
+    signal(SIGPIPE, SIG_IGN);
+
     // SETUP TCP PORT
+    event_init();
+    pthread_t bthread;
+    if (local_threads) {
+        if (!(local_pool = netintegral_open(local_threads, NULL)))
+            PRINT_ERR("Cannot start the pool: no Simpson kernel for this CPU or no threads");
+        PRINT_LINE("Computing the jobs by %u thread%s of this process",
+                   local_threads, (local_threads > 1) ? "s" : "");
+        goto jobs;
+    }
     TRY_TO(boss = socket(PF_INET, SOCK_STREAM, 0));
     memset(&addr, 0, addr_len);
     addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(0);
+    addr.sin_port = htons(discovery.port);
     addr.sin_family = AF_INET;
 
-    // Bind to port and listen to clients
-    TRY_TO(bind(boss, (struct sockaddr*)&addr, addr_len));
-    TRY_TO(listen(boss, clients_max));
+    // Bind to the port of the broadcasts, so the clients may know it,
+    // or to any if another server has it
+    int yes = 1;
+    TRY_TO(setsockopt(boss, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)));
+    if (bind(boss, (struct sockaddr*)&addr, addr_len) == -1) {
+        PRINT_WARN("TCP port %d is taken, the clients find this server by the probes only", discovery.port);
+        addr.sin_port = htons(0);
+        TRY_TO(bind(boss, (struct sockaddr*)&addr, addr_len));
+    }
+    TRY_TO(listen(boss, (clients_max < SOMAXCONN) ? SOMAXCONN : clients_max));
     TRY_TO(getsockname(boss, (struct sockaddr*)&addr, &addr_len));
+    set_nonblock(boss, 1);
+    event_add(boss, &source_boss);
 
     // Setup broadcast message
     memset(&broadcast_msg, 0, sizeof(struct net_msg));
-    broadcast_msg.tcp_port = addr.sin_port;
+    broadcast_msg.type = MSG_PORT;
+    broadcast_msg.tcp_port = ntohs(addr.sin_port);
 
-    // Start the broadcast via another thread
-    pthread_t bthread;
+    // Answer the probes of the clients at once
+    probe_sock = discovery_listen(&discovery);
+    event_add(probe_sock, &source_probe);
+
+    // Start the broadcast via another thread, it goes on while the jobs run
     if (pthread_create(&bthread, NULL, &broadcast, &broadcast_msg))
         PRINT_ERR("Cannot create the broadcasting thread");
 
-    // Wait for the clients
+    // Wait for the quorum of the clients
     wait_for_clients();
 
-    // Finish the broadcast
+    // The relay goes upward once its children are there
+    if (upstream_port)
+        connect_upstream();
+
+    // The jobs of the command line are there unless other jobs are given
+jobs:
+    if (control_path)
+        open_control(control_path);
+    if (job_file)
+        read_job_file(job_file);
+    if (!control_path && !job_file && !upstream_port) {
+        struct job job;
+        const char* err;
+        memset(&job, 0, sizeof(struct job));
+        job.from = From;
+        job.to = To;
+        job.method = method;
+        job.steps = (method == METHOD_ROMBERG) ? ROMBERG_FIRST_STEPS : NUM_STEPS;
+        job.dims = 1;
+        job.abs_tol = abs_tol;
+        job.rel_tol = rel_tol;
+        job.func = func;
+
+        // The cube jobs cost about the evaluations of the line one
+        if (method == METHOD_CUBATURE &&
+            (err = job_cube(&job, method, dims, floor(pow(NUM_EVALS, 1.0 / dims) / CUBATURE_NODES))))
+            PRINT_ERR("%s", err);
+        if (method == METHOD_QMC &&
+            (err = job_cube(&job, method, dims, fmin(NUM_EVALS / QMC_REPLICATES, QMC_MAX_POINTS))))
+            PRINT_ERR("%s", err);
+        if ((err = job_check(&job)) || (local_threads && (err = local_check(&job))))
+            PRINT_ERR("%s", err);
+        for (int i = 0; i < jobs; ++i)
+            enqueue(&job);
+    }
+
+    // The clients stay connected with their threads parked between the jobs,
+    // the callers may bring the jobs forever
+    finish_cached();
+    feed_clients();
+    flush_clients();
+    while (queue || control != -1 || upstream.fd != -1)
+        poll_events();
+
+    if (local_threads) {
+        netintegral_close(local_pool);
+        goto exit;
+    }
+    for (int i = 0; i < clients_max; ++i)
+        release_client(&conns[i], MSG_BYE);
+
+    // The byes go by the loop, the client that does not read is cut
+    for (double until = now() + BYE_TIMEOUT; clients_leaving && now() < until; )
+        poll_events();
+    for (int i = 0; i < clients_max; ++i)
+        if (conns[i].state == CONN_BYE)
+            conn_close(&conns[i]);
+
+    // Finish the broadcast and the listening
     pthread_cancel(bthread);
     pthread_join(bthread, NULL);
     shutdown(bsock, SHUT_RDWR);
     close(bsock);
+    close(probe_sock);
+    close(boss);
 
-    // Distribute intervals
-    struct net_msg request;
-    long double distance = (To - From) / NUM_STEPS;
-    unsigned cores_count = 0;
-    for (int i = 0; i < clients_max; ++i) {
-        request = (struct net_msg) {
-            0,
-            cores[i],
-            NUM_STEPS / cores_all * cores[i],
-            From + (To - From) / cores_all * cores_count,
-            From + (To - From) / cores_all * (cores_count + cores[i]),
-            distance
-        };
-        // Send the Task created to the client
-        TRY_TO(bytes = write(client[i], &request, sizeof(struct net_msg)));
-        if (bytes != sizeof(struct net_msg))
-            PRINT_ERR("Cannot send a task to the client %d", i);
-        cores_count += cores[i];
+    // exiting
+exit:
+    free(conns);
+    free(idle);
+    free(dirty);
+    return 0;
+}
+
+void feed_clients() {
+    if (local_threads) {
+        run_local();
+        return;
+    }
+
+    // Pull model: the clients that sent all the results wait on the stack,
+    // so only they are looked at
+    while (idle_len) {
+        struct conn* c = &conns[idle[idle_len - 1]];
+        if (!dispatch(c))
+            break;
+        --idle_len;
+    }
+}
+
+int dispatch(struct conn* c) {
+    // The tasks are taken from the oldest job that has them, so the next
+    // job starts while the results of the previous one are coming.
+    // The small tasks are batched up to a usual chunk of the client
+    unsigned long long budget = (unsigned long long)MIN_CHUNK_STEPS * c->cores,
+                       used = 0;
+    unsigned given = 0;
+
+    for (struct job* job = queue; job && c->owned_len < BATCH_TASKS && used < budget; ) {
+        struct task* t = calloc(1, sizeof(struct task));
+        if (!t)
+            PRINT_ERR("Memory allocation");
+        if (!next_task(c, job, t)) {
+            free(t);
+            job = job->next;
+            continue;
+        }
+        ++job->in_flight;
+        if (!job->started)
+            job->started = now();
+        give_task(c, t);
+        ++given;
+        used += is_adaptive(job) ? budget : t->range.steps;
+    }
+    return given;
+}
+
+void give_task(struct conn* c, struct task* t) {
+    struct net_msg msg;
+    if (c->func_id != t->job->func_id) {
+        send_func(c, &t->job->func);
+        if (t->job->method == METHOD_SWEEP)
+            send_sweep(c, t->job);
+        c->func_id = t->job->func_id;
+    }
+    task_msg(c, t, &msg);
+    send_task(c, &msg);
+    if (c->state != CONN_BUSY)
+        conn_clock(c);
+
+    struct task_ref* ref = &c->owned[(c->owned_head + c->owned_len) % BATCH_TASKS];
+    ref->task = t;
+    ref->sent = now();
+    ++c->owned_len;
+    ++t->copies;
+    ++in_flight;
+    c->state = CONN_BUSY;
+}
+
+struct job* take_result(struct conn* c, struct net_msg* result) {
+    int i = c - conns;
+    struct task_ref ref = c->owned[c->owned_head];
+    struct task* t = ref.task;
+    struct job* job = t->job;
+    c->owned_head = (c->owned_head + 1) % BATCH_TASKS;
+    --in_flight;
+    if (!--c->owned_len) {
+        conn_clock(c);
+        c->state = CONN_IDLE;
+        if (!c->draining)
+            idle[idle_len++] = i;
+    }
+
+    // The rate counts from the moment the client could start the task
+    double end = now(),
+           start = (ref.sent > c->last_result) ? ref.sent : c->last_result,
+           rate = t->work / c->cores / ((end > start) ? end - start : 1e-6);
+    c->rate = c->rate ? (1 - RATE_WEIGHT) * c->rate + RATE_WEIGHT * rate : rate;
+    c->last_result = end;
+
+    // The late copy of the task is dropped
+    int late = t->done;
+    t->done = 1;
+    if (!late) {
+        ++c->tasks;
+        c->steps += is_adaptive(job) ? ADAPTIVE_PANELS * c->cores : t->range.steps;
+        c->evals += t->work;
+        job->collected = end;
+    }
+    if (!late && is_adaptive(job)) {
+        DBG_PRINT("Client_%d := %Lf +- %Le", i, result->distance, result->error);
+        adaptive_result(&job->adaptive, &t->owned, result->distance, result->error);
+    }
+    else if (!late) {
+        PRINT_LINE("Client_%d := %Lf", i, result->distance);
+        job->sum += result->distance;
+        job->error += result->error;
+        job->done_steps += t->range.steps;
+        job->part_steps -= t->part_steps;
+        job->part_sum -= t->part;
+
+        // The sum of the job is the one of the tree, job->sum is the progress
+        struct reduce_node node;
+        job_node(job, job->base + t->range.first, t->range.steps, &node);
+        node.sum = result->node_sum;
+        node.error = result->node_error;
+        if (!reduce_put(&job->reduce, &node))
+            PRINT_ERR("Memory allocation");
+        if (!job->relayed && job->method != METHOD_SWEEP)
+            cache_node(job, &node);
+    }
+    if (!--t->copies)
+        free(t);
+    if (late) {
+        PRINT_LINE("Client_%d: the result is dropped, the task is done or cancelled", i);
+        return NULL;
+    }
+    --job->in_flight;
+    return job;
+}
+
+void take_value(struct conn* c, struct net_msg* value) {
+    // The tasks in flight are looked at, the value of a done one is dropped
+    struct job* job = NULL;
+    for (unsigned k = 0; k < c->owned_len && !job; ++k) {
+        struct task* t = c->owned[(c->owned_head + k) % BATCH_TASKS].task;
+        if (!t->done && t->job->id == value->job && t->job->method == METHOD_SWEEP)
+            job = t->job;
+    }
+    if (!job || value->first >= job->steps) {
+        PRINT_WARN("Client %d: the value of the record %llu is dropped", (int)(c - conns), value->first);
+        return;
+    }
+    job->values[value->first] = value->node_sum;
+
+    // The relay passes it upward at once, the result of the task goes later
+    if (job->relayed && upstream.fd != -1) {
+        value->job = job->upstream_id;
+        value->first += job->base;
+        wire_put(&upstream.out, value);
+    }
+}
+
+//==============================================================================
+// RECOVERY SECTION
+//==============================================================================
+
+void conn_lost(struct conn* c, const char* why) {
+    int i = c - conns;
+    PRINT_WARN("Client %d is lost (%s), %u task%s go%s to the others", i, why, c->owned_len,
+               (c->owned_len == 1) ? "" : "s", (c->owned_len == 1) ? "es" : "");
+
+    conn_close(c);
+
+    // The tasks nobody else computes go back to their jobs
+    for (; c->owned_len; --c->owned_len) {
+        struct task* t = c->owned[c->owned_head].task;
+        c->owned_head = (c->owned_head + 1) % BATCH_TASKS;
+        --in_flight;
+        if (--t->copies || t->done) {
+            if (!t->copies)
+                free(t);
+            continue;
+        }
+
+        struct job* job = t->job;
+        --job->in_flight;
+        if (is_adaptive(job))
+            adaptive_requeue(&job->adaptive, &t->owned);
+        else {
+            if (job->lost_len == job->lost_size) {
+                job->lost_size = job->lost_size ? 2 * job->lost_size : 16;
+                if (!(job->lost = realloc(job->lost, job->lost_size * sizeof(struct steps_range))))
+                    PRINT_ERR("Memory allocation");
+            }
+            job->lost[job->lost_len++] = t->range;
+            job->part_steps -= t->part_steps;
+            job->part_sum -= t->part;
+        }
+        free(t);
+    }
+
+    if (!clients_ready)
+        PRINT_WARN("All the clients are lost, the jobs wait for the new ones");
+    upstream_hello();
+    feed_clients();
+}
+
+void conn_close(struct conn* c) {
+    int i = c - conns;
+
+    // The client counts from its hello to here, whichever way it goes
+    if (c->state == CONN_IDLE || c->state == CONN_BUSY) {
+        cores_all -= c->cores;
+        capacity_all -= c->capacity;
+        --clients_ready;
+    }
+    else if (c->state == CONN_BYE)
+        --clients_leaving;
+    event_del(c->fd);
+    close(c->fd);
+    wire_free(&c->in);
+    wire_free(&c->out);
+    free(c->threads);
+    c->threads = NULL;
+    c->state = CONN_FREE;
+    for (int j = 0; j < idle_len; ++j)
+        if (idle[j] == i)
+            idle[j--] = idle[--idle_len];
+}
+
+void conn_hello(struct conn* c, struct net_msg* msg) {
+    int i = c - conns;
+
+    // The bad hello is not let into the membership
+    if (!msg->cores || msg->cores > HELLO_CORES_MAX) {
+        if (c->state != CONN_HANDSHAKE) {
+            conn_lost(c, "bad number of cores");
+            return;
+        }
+        PRINT_WARN("Client %d: %u cores, the hello is refused", i, msg->cores);
+        conn_close(c);
+        return;
+    }
+
+    // A relay says hello again when its children change
+    if (c->state != CONN_HANDSHAKE) {
+        cores_all -= c->cores;
+        capacity_all -= c->capacity;
+        free(c->threads);
+        PRINT_LINE("Client %d: now %d core%s, %.3g evaluations per second", i, msg->cores,
+                   ((msg->cores > 1) ? "s" : ""), (msg->rate > 0) ? msg->rate : 0);
+    }
+    c->cores = msg->cores;
+    if (!(c->threads = calloc(c->cores, sizeof(struct thread_stats))))
+        PRINT_ERR("Memory allocation");
+    cores_all += msg->cores;
+    c->capacity = (msg->rate > 0) ? msg->rate : 0;
+    c->width = msg->width;
+    c->placement = msg->placement;
+    capacity_all += c->capacity;
+    if (c->state != CONN_HANDSHAKE) {
+        upstream_hello();
+        return;
+    }
+
+    c->since = queue ? now() : 0;
+    c->state = CONN_IDLE;
+    if (++clients_ready == quorum && !t_ready)
+        t_ready = now();
+    PRINT_LINE("Client %d: %d core%s, %.3g evaluations per second, %u-wide SIMD", i, c->cores,
+               ((c->cores > 1) ? "s" : ""), c->capacity, c->width);
+    if (msg->placement.phys)
+        PRINT_LINE("Client %d: pinned to %u physical cores + %u hyperthreads, %u socket%s, %u NUMA node%s",
+                   i, msg->placement.phys, msg->placement.smt,
+                   msg->placement.sockets, (msg->placement.sockets > 1) ? "s" : "",
+                   msg->placement.nodes, (msg->placement.nodes > 1) ? "s" : "");
+
+    // The client joining a running job takes its share of what is left
+    idle[idle_len++] = i;
+    upstream_hello();
+    feed_clients();
+}
+
+void conn_drain(struct conn* c) {
+    int i = c - conns;
+    if (c->draining)
+        return;
+    PRINT_LINE("Client %d drains, %u task%s left", i, c->owned_len, (c->owned_len == 1) ? "" : "s");
+    c->draining = 1;
+    for (int j = 0; j < idle_len; ++j)
+        if (idle[j] == i)
+            idle[j--] = idle[--idle_len];
+    if (!c->owned_len)
+        conn_leave(c);
+}
+
+void conn_leave(struct conn* c) {
+    PRINT_LINE("Client %d is drained and leaves", (int)(c - conns));
+    release_client(c, MSG_BYE);
+    upstream_hello();
+}
+
+static int rate_order(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+void speculate() {
+    // Only the clients with nothing to do copy the tasks
+    if (!idle_len || !in_flight)
+        return;
+
+    double rates[clients_max], median;
+    int n = 0;
+    for (int i = 0; i < clients_max; ++i)
+        if ((conns[i].state == CONN_IDLE || conns[i].state == CONN_BUSY) && conns[i].rate > 0)
+            rates[n++] = conns[i].rate;
+    if (!n)
+        return;
+    qsort(rates, n, sizeof(double), rate_order);
+    median = rates[n / 2];
+
+    double t_now = now();
+    for (int i = 0; i < clients_max && idle_len; ++i) {
+        struct conn* c = &conns[i];
+        if (c->state != CONN_BUSY)
+            continue;
+
+        // The oldest task of the client is the one it computes
+        struct task_ref* ref = &c->owned[c->owned_head];
+        struct task* t = ref->task;
+        double start = (ref->sent > c->last_result) ? ref->sent : c->last_result,
+               expected = t->work / c->cores / median;
+        if (t->done || t->copies > 1 || t_now - start < SPECULATE_MIN ||
+            t_now - start < SPECULATE_FACTOR * expected)
+            continue;
+
+        struct conn* spare = &conns[idle[--idle_len]];
+        PRINT_WARN("Client_%d is straggling, the task is copied to Client_%d", i, (int)(spare - conns));
+        give_task(spare, t);
+    }
+}
+
+//==============================================================================
+// PROGRESS SECTION
+//==============================================================================
+
+void take_progress(struct conn* c, struct net_msg* msg) {
+    // The copies report the same steps again, only the news are taken
+    struct task* t = c->owned[c->owned_head].task;
+    if (t->done || msg->steps <= t->part_steps)
+        return;
+    t->job->part_steps += msg->steps - t->part_steps;
+    t->job->part_sum += msg->distance - t->part;
+    t->part_steps = msg->steps;
+    t->part = msg->distance;
+}
+
+void report_progress() {
+    static double last = 0;
+    double t_now = now();
+    if (t_now - last < PROGRESS_PERIOD)
+        return;
+    last = t_now;
+
+    for (struct job* job = queue; job; job = job->next) {
+        if (!job->started || job->relayed)
+            continue;
+        double elapsed = t_now - job->started;
+
+        // The adaptive jobs have no steps to count, only the error
+        if (is_adaptive(job)) {
+            struct adaptive* a = &job->adaptive;
+            if (job->caller)
+                caller_reply(job->caller, "%u progress - %.18Lg -\n", job->id, a->total_value);
+            else
+                printf("Job %u: estimate %.6Lf +- %.3Le over %u subintervals, %.1f s\n",
+                       job->id, a->total_value, a->total_error, a->intervals, elapsed);
+            continue;
+        }
+
+        double done = (double)(job->done_steps + job->part_steps) / job->steps,
+               eta = (done > 0) ? elapsed * (1 - done) / done : -1;
+        long double estimate = job->sum + job->part_sum;
+
+        // The records of a sweep have no common estimate
+        if (job->method == METHOD_SWEEP) {
+            if (job->caller)
+                caller_reply(job->caller, "%u progress %.1f - %.1f\n", job->id, 100 * done, eta);
+            else
+                printf("Job %u: %.1f%% of %llu records done, ETA %.1f s\n",
+                       job->id, 100 * done, job->steps, eta);
+            continue;
+        }
+
+        // A Romberg level refines the estimate only when it is over
+        if (job->method == METHOD_ROMBERG) {
+            estimate = job->romberg.value;
+            if (job->caller)
+                caller_reply(job->caller, "%u progress - %.18Lg -\n", job->id, estimate);
+            else
+                printf("Job %u: estimate %.6Lf, level %u %.1f%% done, %.1f s\n",
+                       job->id, estimate, job->romberg.levels, 100 * done, elapsed);
+            continue;
+        }
+        if (job->caller)
+            caller_reply(job->caller, "%u progress %.1f %.18Lg %.1f\n", job->id, 100 * done, estimate, eta);
+        else
+            printf("Job %u: %.1f%% done, estimate %.6Lf, ETA %.1f s\n", job->id, 100 * done, estimate, eta);
+    }
+    fflush(stdout);
+}
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//==============================================================================
+// JOB QUEUE SECTION
+//==============================================================================
+
+void enqueue(const struct job* src) {
+    struct job* job = malloc(sizeof(struct job));
+    if (!job)
+        PRINT_ERR("Memory allocation");
+    *job = *src;
+    job->id = ++job_ids;
+    job->next = NULL;
+    job->next_step = 0;
+    job->in_flight = 0;
+    job->sum = job->error = 0;
+    memset(job->replicate, 0, sizeof(job->replicate));
+    memset(&job->reduce, 0, sizeof(struct reduce));
+    if (!job->relayed) {
+        job->seed = (job->method == METHOD_QMC) ? job_seed(job) : 0;
+        if (job->steps)
+            job->step = (job->to - job->from) / job->steps;
+    }
+    job->lost = NULL;
+    job->lost_len = job->lost_size = 0;
+    job->done_steps = job->part_steps = 0;
+    job->part_sum = 0;
+    job->queued = now();
+    job->started = job->collected = 0;
+    job->cached_len = job->cached_next = 0;
+    job->cache_hit = 0;
+
+    // The records of the relayed sweep are the ones of its upstream task,
+    // the ones of the lines are read into the parsed job
+    if (job->method == METHOD_SWEEP) {
+        if (!(job->records = malloc(job->steps * sizeof(struct sweep_record))) ||
+            !(job->values = calloc(job->steps, sizeof(struct dsum))))
+            PRINT_ERR("Memory allocation");
+        if (src->records)
+            memcpy(job->records, src->records, job->steps * sizeof(struct sweep_record));
+        else
+            job_records(job, job->records);
+    }
+
+    // The idle clients wait for work from now on
+    for (int i = 0; !queue && i < clients_max; ++i)
+        if (conns[i].state == CONN_IDLE)
+            conns[i].since = job->queued;
+
+    // The clients keep f(x) between the jobs while it is the same,
+    // the records of every sweep are its own
+    if (job->method == METHOD_SWEEP) {
+        job->func_id = job->id;
+        last_func_id = 0;
+    }
+    else if (last_func_id && job->func.ops == last_func.ops &&
+        !memcmp(job->func.op, last_func.op, job->func.ops * sizeof(struct expr_op)))
+        job->func_id = last_func_id;
+    else
+        job->func_id = last_func_id = job->id;
+    last_func = job->func;
+
+    memset(&job->adaptive, 0, sizeof(struct adaptive));
+    if (is_adaptive(job))
+        adaptive_start(&job->adaptive, job->from, job->to, ADAPTIVE_PIECES * cores_all,
+                       job->abs_tol, job->rel_tol);
+    if (job->method == METHOD_ROMBERG && !job->relayed)
+        romberg_start(&job->romberg, job->from, job->to, romberg_ends(job),
+                      job->abs_tol, job->rel_tol);
+
+    if (queue_tail)
+        queue_tail->next = job;
+    else
+        queue = job;
+    queue_tail = job;
+    if (job->caller)
+        ++job->caller->jobs;
+    PRINT_LINE("Job %u queued", job->id);
+    if (!job->relayed)
+        cache_load(job);
+}
+
+int job_finished(struct job* job) {
+    if (job->cache_hit)
+        return 1;
+    if (job->in_flight)
+        return 0;
+    if (is_adaptive(job))
+        return adaptive_finished(&job->adaptive);
+    return job->next_step == job->steps && !job->lost_len;
+}
+
+void finish_job(struct job* job) {
+    // The levels cached whole are finished at once
+    while (refine_job(job))
+        if (!job_finished(job))
+            return;
+
+    long double S = job->sum, error = job->error;
+    struct dsum sum = {0, 0}, error_sum = {0, 0};
+    unsigned intervals = 0;
+    int converged = 1;
+    if (job->cache_hit) {
+        intervals = job->hit_intervals;
+        converged = job->hit_converged;
+    }
+    else if (is_adaptive(job)) {
+        S = adaptive_value(&job->adaptive, &error, &intervals);
+        converged = adaptive_converged(&job->adaptive);
+        cache_put_result(&job->key, &(struct cache_range) {0, 0, dsum_of(S), dsum_of(error)},
+                         intervals, converged);
+    }
+    else if (job->method == METHOD_ROMBERG && !job->relayed) {
+        S = romberg_value(&job->romberg, &error, &intervals);
+        converged = romberg_converged(&job->romberg);
+    }
+    else {
+        reduce_job(job, &sum, &error_sum);
+        S = job->sum;
+        error = (job->method == METHOD_QMC && !job->relayed) ? qmc_error(job) : job->error;
+    }
+    if (!job->started)
+        job->started = job->collected = now();
+
+    // printing result
+    if (job->relayed)
+        relay_result(job, sum, error_sum);
+    else if (job->method == METHOD_SWEEP)
+        print_sweep(job);
+    else if (!job->caller) {
+        printf (LINE);
+        if (job->dims > 1)
+            printf ("Job %u: [%Lg:%Lg]^%u\n", job->id, job->from, job->to, job->dims);
+        else
+            printf ("Job %u: [%Lg:%Lg]\n", job->id, job->from, job->to);
+        printf ("The integral of f(x) == %.6Lf\n", S);
+        if (job->method == METHOD_KRONROD)
+            printf ("Error estimate %.3Le over %u subintervals%s\n", error, intervals,
+                    converged ? "" : ", the tolerance is NOT met");
+        else if (job->method == METHOD_CUBATURE)
+            printf ("Error estimate %.3Le over %llu cells\n", error, job->steps);
+        else if (job->method == METHOD_QMC)
+            printf ("Standard error %.3Le over %d scrambles of %llu points\n", error,
+                    QMC_REPLICATES, job->grid);
+        else if (job->method == METHOD_ROMBERG)
+            printf ("Error estimate %.3Le over %u levels, %llu intervals%s\n", error, intervals,
+                    job->romberg.intervals, converged ? "" : ", the tolerance is NOT met");
+        printf (LINE);
+        fflush(stdout);
+    }
+    else {
+        caller_reply(job->caller, "%u %.18Lg %.3Le %u%s\n", job->id, S, error, intervals,
+                     (!converged) ? " unconverged" : "");
+        --job->caller->jobs;
+        caller_drop(job->caller);
+    }
+
+    // The phases of the job
+    double phases[3] = {job->started - job->queued, job->collected - job->started,
+                        now() - job->collected};
+    for (int k = 0; k < 3; ++k) {
+        last_phases[k] = phases[k];
+        total_phases[k] += phases[k];
+    }
+    last_job = job->id;
+    ++jobs_done;
+    stats_due = print_phases;
+    drop_job(job);
+}
+
+void print_sweep(const struct job* job) {
+    if (!job->caller) {
+        printf (LINE);
+        printf ("Job %u: %llu integrals of %llu steps\n", job->id, job->steps, job->grid);
+        for (unsigned long long r = 0; r < job->steps; ++r)
+            printf ("[%Lg:%Lg] p == %-12g The integral of f(x, p) == %.6Lf\n",
+                    job->records[r].from, job->records[r].to, job->records[r].param,
+                    dsum_value(job->values[r]));
+        printf (LINE);
+        fflush(stdout);
+        return;
+    }
+
+    // The values are queued for the caller and go with the last line,
+    // the rest of them when the caller reads
+    struct wire_buf* out = &job->caller->out;
+    for (unsigned long long r = 0; job->caller->fd != -1 && r < job->steps; ++r) {
+        char* line = (char*)wire_space(out, VALUE_LINE_MAX);
+        int len = snprintf(line, VALUE_LINE_MAX, "%u value %llu %.18Lg\n", job->id, r,
+                           dsum_value(job->values[r]));
+        out->len += (len < VALUE_LINE_MAX) ? len : VALUE_LINE_MAX - 1;
+    }
+    caller_reply(job->caller, "%u sweep %llu\n", job->id, job->steps);
+    --job->caller->jobs;
+    caller_drop(job->caller);
+}
+
+int refine_job(struct job* job) {
+    struct dsum sum, error;
+    if (job->method != METHOD_ROMBERG || job->relayed || job->cache_hit)
+        return 0;
+    reduce_job(job, &sum, &error);
+    reduce_free(&job->reduce);
+    if (romberg_level(&job->romberg, job->sum))
+        return 0;
+
+    // The next level is the midpoints of twice as many intervals
+    job->steps *= 2;
+    job->step = (job->to - job->from) / job->steps;
+    job->next_step = 0;
+    job->sum = job->error = 0;
+    job->done_steps = 0;
+    job->cached_len = job->cached_next = 0;
+    PRINT_LINE("Job %u: level %u of %llu intervals", job->id, job->romberg.levels,
+               job->romberg.intervals);
+    cache_load(job);
+    return 1;
+}
+
+long double romberg_ends(const struct job* job) {
+    // Two evaluations are not worth a task
+    long double a = job->from, b = job->to;
+    double x[2] = {a, b}, y[2];
+    if (!job->func.ops)
+        return FUNCTION(a) + FUNCTION(b);
+    expr_eval(&job->func, x, y, 2);
+    return (long double)y[0] + y[1];
+}
+
+int is_adaptive(const struct job* job) {
+    // The relayed panels are a range of the upstream task, not bisected here
+    return job->method == METHOD_KRONROD && !job->relayed;
+}
+
+long double qmc_error(const struct job* job) {
+    // The scrambles are independent estimates, job->sum is their mean
+    long double spread = 0;
+    for (int r = 0; r < QMC_REPLICATES; ++r) {
+        long double d = QMC_REPLICATES * job->replicate[r] - job->sum;
+        spread += d * d;
+    }
+    return sqrtl(spread / (QMC_REPLICATES - 1) / QMC_REPLICATES);
+}
+
+void reduce_job(struct job* job, struct dsum* sum, struct dsum* error) {
+    // The cached job is one range, or one per scramble: the nodes are
+    // too many for the set of its key
+    if (job->method == METHOD_QMC && !job->relayed) {
+        for (int r = 0; r < QMC_REPLICATES; ++r) {
+            reduce_total(&job->reduce, r, sum, error);
+            job->replicate[r] = dsum_value(*sum);
+            cache_put_range(&job->key, &(struct cache_range) {r * job->grid, job->grid, *sum, *error});
+        }
+    }
+    reduce_total(&job->reduce, -1, sum, error);
+    if (!job->relayed && job->method != METHOD_QMC && job->method != METHOD_SWEEP)
+        cache_put_range(&job->key, &(struct cache_range) {0, job->steps, *sum, *error});
+    job->sum = dsum_value(*sum);
+    job->error = dsum_value(*error);
+}
+
+void cache_node(const struct job* job, const struct reduce_node* node) {
+    // The last block of the job or of the scramble is short
+    unsigned long long block = job_block(job),
+                       start = job->grid * node->segment,
+                       first = start + block * node->block,
+                       end = (job->method == METHOD_QMC) ? start + job->grid : job->steps;
+    if (first + block * node->blocks < end)
+        end = first + block * node->blocks;
+    cache_put_range(&job->key, &(struct cache_range) {first, end - first, node->sum, node->error});
+}
+
+void cache_load(struct job* job) {
+    struct cache_range hit;
+    job_key(job, &job->key);
+    if (job->method == METHOD_SWEEP)
+        return;
+
+    // The adaptive job is cached whole
+    if (is_adaptive(job)) {
+        if (cache_get_result(&job->key, &hit, &job->hit_intervals, &job->hit_converged)) {
+            job->cache_hit = 1;
+            job->sum = dsum_value(hit.value);
+            job->error = dsum_value(hit.error);
+            PRINT_LINE("Job %u: the result is cached", job->id);
+        }
+        return;
+    }
+
+    // The cached ranges are taken like the results
+    job->cached_len = cache_ranges(&job->key, job->cached, CACHE_WAYS);
+    for (unsigned k = 0; k < job->cached_len; ++k) {
+        struct cache_range* r = &job->cached[k];
+        struct reduce_node node;
+        job_node(job, r->first, r->steps, &node);
+        node.sum = r->value;
+        node.error = r->error;
+        if (!reduce_put(&job->reduce, &node))
+            PRINT_ERR("Memory allocation");
+        job->sum += dsum_value(r->value);
+        job->error += dsum_value(r->error);
+        job->done_steps += r->steps;
+    }
+    if (job->cached_len)
+        PRINT_LINE("Job %u: %llu of %llu steps are cached", job->id, job->done_steps, job->steps);
+    skip_cached(job);
+}
+
+void skip_cached(struct job* job) {
+    while (job->cached_next < job->cached_len &&
+           job->cached[job->cached_next].first <= job->next_step) {
+        struct cache_range* r = &job->cached[job->cached_next++];
+        if (job->next_step < r->first + r->steps)
+            job->next_step = r->first + r->steps;
+    }
+}
+
+void finish_cached() {
+    // Nothing was handed out, so the results of the clients are not awaited
+    struct job* next;
+    for (struct job* job = queue; job; job = next) {
+        next = job->next;
+        if (!job->started && job_finished(job))
+            finish_job(job);
+    }
+    feed_clients();
+}
+
+void drop_job(struct job* job) {
+    // Unlink the job
+    struct job** link = &queue;
+    while (*link != job)
+        link = &(*link)->next;
+    *link = job->next;
+    if (queue_tail == job) {
+        queue_tail = queue;
+        while (queue_tail && queue_tail->next)
+            queue_tail = queue_tail->next;
+    }
+    adaptive_free(&job->adaptive);
+    reduce_free(&job->reduce);
+    free(job->lost);
+    free(job->records);
+    free(job->values);
+    free(job);
+
+    // No work left, the clients wait for the next job and it is not idle time
+    if (!queue) {
+        for (int i = 0; i < clients_max; ++i) {
+            if (conns[i].state == CONN_IDLE) {
+                conn_clock(&conns[i]);
+                conns[i].since = 0;
+            }
+            release_client(&conns[i], MSG_DONE);
+        }
+    }
+}
+
+void read_job_file(const char* path) {
+    char line[JOB_LINE_MAX];
+    const char* err;
+    struct job job;
+    FILE* file = fopen(path, "r");
+    if (!file)
+        PRINT_ERRV("Cannot open %s", path);
+
+    memset(&job, 0, sizeof(struct job));
+    for (int n = 1; fgets(line, sizeof(line), file); ++n) {
+        line[strcspn(line, "#\n")] = '\0';
+        if (!line[strspn(line, " \t")])
+            continue;
+
+        // The lines after the header of a sweep are its records
+        if (job_incomplete(&job))
+            err = job_record(line, &job);
+        else if (!(err = job_parse(line, &job)) && local_threads)
+            err = local_check(&job);
+        if (err)
+            PRINT_ERR("%s:%d: %s", path, n, err);
+        if (!job_incomplete(&job)) {
+            enqueue(&job);
+            free(job.records);
+            job.records = NULL;
+        }
+    }
+    if (job_incomplete(&job))
+        PRINT_ERR("%s: the sweep has %u of its %llu records", path, job.records_len, job.steps);
+    fclose(file);
+}
+
+//==============================================================================
+// LOCAL MODE SECTION
+//==============================================================================
+
+const char* local_check(const struct job* job) {
+    if (job->method != METHOD_SIMPSON || job->dims > 1)
+        return "-L computes the Simpson jobs of one dimension only";
+    return NULL;
+}
+
+static void local_eval(const double* x, double* y, unsigned n, void* f) {
+    expr_eval(f, x, y, n);
+}
+
+void run_local() {
+    // The job is one node of the whole steps, the cached ranges are
+    // computed again with the rest
+    struct job* next;
+    for (struct job* job = queue; job; job = next) {
+        next = job->next;
+        if (!job_finished(job)) {
+            struct netintegral_job nj = {job->from, job->to, job->steps, NULL,
+                                         job->func.ops ? local_eval : NULL, &job->func};
+            struct reduce_node node;
+            long double value;
+            const char* err;
+            job->started = now();
+            if ((err = netintegral_integrate(local_pool, &nj, &value)))
+                PRINT_ERR("Job %u: %s", job->id, err);
+            job->collected = now();
+
+            reduce_free(&job->reduce);
+            job_node(job, 0, job->steps, &node);
+            node.sum = dsum_of(value);
+            node.error = (struct dsum) {0, 0};
+            if (!reduce_put(&job->reduce, &node))
+                PRINT_ERR("Memory allocation");
+            job->sum = value;
+            job->error = 0;
+            job->done_steps = job->next_step = job->steps;
+            job->cached_len = job->cached_next = 0;
+        }
+        finish_job(job);
     }
 
-    PRINT_LINE("Tasks sent");
+    // No event loop runs when the jobs are of the command line
+    if (stats_due) {
+        print_stats();
+        stats_due = 0;
+    }
+}
 
-    // Collecting partial sums and keeping alive the connection
-    // until the end of all calculations
+//==============================================================================
+// CALLERS SECTION
+//==============================================================================
+
+void open_control(const char* path) {
+    struct sockaddr_un uaddr;
+    memset(&uaddr, 0, sizeof(uaddr));
+    uaddr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(uaddr.sun_path))
+        PRINT_ERR("The socket path is too long: %s", path);
+    strcpy(uaddr.sun_path, path);
+
+    // The socket of the previous run is replaced
+    unlink(path);
+    TRY_TO(control = socket(AF_UNIX, SOCK_STREAM, 0));
+    TRY_TO(bind(control, (struct sockaddr*)&uaddr, sizeof(uaddr)));
+    TRY_TO(listen(control, SOMAXCONN));
+    set_nonblock(control, 1);
+    event_add(control, &source_control);
+    PRINT_LINE("Waiting for jobs on %s", path);
+}
+
+void accept_callers() {
+    while (1) {
+        int new = accept(control, NULL, NULL);
+        if (new == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (new == -1 && (errno == EINTR || errno == ECONNABORTED))
+            continue;
+        TRY_TO(new);
+
+        struct caller* cl = calloc(1, sizeof(struct caller));
+        if (!cl)
+            PRINT_ERR("Memory allocation");
+        cl->source = SOURCE_CALLER;
+        cl->fd = new;
+        set_nonblock(new, 1);
+        event_add(new, cl);
+    }
+}
+
+void caller_read(struct caller* cl) {
+    struct job job;
+    const char* err;
+    while (!cl->closed) {
+        int bytes = read(cl->fd, wire_space(&cl->in, READ_CHUNK), READ_CHUNK);
+        if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        if (bytes <= 0) {
+            // The caller may still read the results of its jobs, it goes
+            // once they are written or it is gone
+            event_want_in(cl->fd, 0);
+            cl->closed = 1;
+            if (cl->sweep) {
+                caller_reply(cl, "error the sweep has %u of its %llu records\n",
+                             cl->sweep->records_len, cl->sweep->steps);
+                free(cl->sweep->records);
+                free(cl->sweep);
+                cl->sweep = NULL;
+            }
+            break;
+        }
+        cl->in.len += bytes;
+
+        // Every complete line is a job
+        char *line = (char*)cl->in.data, *end;
+        unsigned long left = cl->in.len;
+        while ((end = memchr(line, '\n', left))) {
+            *end = '\0';
+            left -= end + 1 - line;
+            line[strcspn(line, "#\r")] = '\0';
+            unsigned id;
+            char word[8];
+            if (cl->sweep && line[strspn(line, " \t")]) {
+                // The lines after the header of a sweep are its records
+                if ((err = job_record(line, cl->sweep))) {
+                    caller_reply(cl, "error %s, the sweep is dropped\n", err);
+                    free(cl->sweep->records);
+                    free(cl->sweep);
+                    cl->sweep = NULL;
+                }
+                else if (!job_incomplete(cl->sweep)) {
+                    caller_job(cl, cl->sweep);
+                    free(cl->sweep);
+                    cl->sweep = NULL;
+                }
+            }
+            else if (sscanf(line, " cancel %u", &id) == 1)
+                cancel_job(cl, id);
+            else if (sscanf(line, " %7s", word) == 1 && !strcmp(word, "stats")) {
+                // The dump goes like the replies, the rest when the caller reads
+                dump_stats(&cl->out);
+                caller_flush(cl);
+            }
+            else if (line[strspn(line, " \t")]) {
+                if ((err = job_parse(line, &job)) || (local_threads && (err = local_check(&job)))) {
+                    caller_reply(cl, "error %s\n", err);
+                    free(job.records);
+                }
+                else if (!job_incomplete(&job))
+                    caller_job(cl, &job);
+                else {
+                    if (!(cl->sweep = malloc(sizeof(struct job))))
+                        PRINT_ERR("Memory allocation");
+                    *cl->sweep = job;
+                }
+            }
+            line = end + 1;
+        }
+        wire_consume(&cl->in, cl->in.len - left);
+        if (cl->in.len > JOB_LINE_MAX) {
+            caller_reply(cl, "error the line is too long\n");
+            cl->in.len = 0;
+        }
+    }
+
+    // The new jobs go to the idle clients
+    caller_drop(cl);
+    feed_clients();
+}
+
+void caller_job(struct caller* cl, struct job* job) {
+    job->caller = cl;
+    enqueue(job);
+    free(job->records);
+    job->records = NULL;
+    caller_reply(cl, "%u queued\n", job_ids);
+}
+
+void caller_reply(struct caller* cl, const char* fmt, ...) {
+    char line[BUFSIZ];
+    va_list args;
+    if (cl->fd == -1)
+        return;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (len >= (int)sizeof(line))
+        len = sizeof(line) - 1;
+
+    // The caller not reading the replies makes them wait, not the server
+    memcpy(wire_space(&cl->out, len), line, len);
+    cl->out.len += len;
+    caller_flush(cl);
+}
+
+void caller_flush(struct caller* cl) {
+    unsigned long done = 0;
+    while (cl->fd != -1 && done < cl->out.len) {
+        int bytes = send(cl->fd, cl->out.data + done, cl->out.len - done, MSG_NOSIGNAL);
+        if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        if (bytes == -1) {
+            // The jobs of the gone caller are computed anyway, their results are dropped
+            PRINT_WARN("Cannot reply to the caller @%d (%s)", cl->fd, strerror(errno));
+            event_del(cl->fd);
+            close(cl->fd);
+            cl->fd = -1;
+            cl->closed = 1;
+            done = cl->out.len;
+            break;
+        }
+        done += bytes;
+    }
+    wire_consume(&cl->out, done);
+
+    // The rest goes when the socket is writable again
+    if (cl->fd != -1)
+        event_want_out(cl->fd, cl->out.len > 0);
+}
+
+void cancel_job(struct caller* cl, unsigned id) {
+    struct job* job = queue;
+    while (job && (job->id != id || job->caller != cl))
+        job = job->next;
+    if (!job) {
+        caller_reply(cl, "error no job %u\n", id);
+        return;
+    }
+
+    stop_job(job);
+    PRINT_LINE("Job %u is cancelled", id);
+    caller_reply(cl, "%u cancelled\n", id);
+    --cl->jobs;
+}
+
+void stop_job(struct job* job) {
+    // The results of the tasks given out are ignored when they come
+    struct net_msg cancel;
+    memset(&cancel, 0, sizeof(struct net_msg));
+    cancel.type = MSG_CANCEL;
+    cancel.job = job->id;
     for (int i = 0; i < clients_max; ++i) {
-        enable_keepalive(client[i]);
+        struct conn* c = &conns[i];
+        int owns = 0;
+        for (unsigned k = 0; c->state == CONN_BUSY && k < c->owned_len; ++k) {
+            struct task* t = c->owned[(c->owned_head + k) % BATCH_TASKS].task;
+            if (!t->done && t->job == job) {
+                t->done = 1;
+                owns = 1;
+            }
+            else if (t->job == job)
+                owns = 1;
+        }
+        if (owns)
+            send_task(c, &cancel);
+    }
+    drop_job(job);
+}
+
+void caller_drop(struct caller* cl) {
+    if (!cl->closed || cl->jobs || cl->out.len || cl->dead)
+        return;
+    if (cl->fd != -1) {
+        event_del(cl->fd);
+        close(cl->fd);
+        cl->fd = -1;
+    }
+
+    // The events of the same wakeup may still point to it
+    cl->dead = 1;
+    cl->next = dead_callers;
+    dead_callers = cl;
+}
+
+void free_callers() {
+    while (dead_callers) {
+        struct caller* cl = dead_callers;
+        dead_callers = cl->next;
+        if (cl->sweep) {
+            free(cl->sweep->records);
+            free(cl->sweep);
+        }
+        wire_free(&cl->in);
+        wire_free(&cl->out);
+        free(cl);
     }
+}
+
+//==============================================================================
+// RELAY SECTION
+//==============================================================================
+
+void connect_upstream() {
+    struct sockaddr_in paddr;
 
-    // Filling fd_set
-    fd_set fds;
-    int maxsd = 0;
-    long double S = 0;
+    // The upstream server is found like the clients find it
+    upstream.fd = discovery_connect(&upstream_discovery, &paddr);
+    enable_keepalive(upstream.fd);
+    PRINT_LINE("Connected to the upstream server [%s:%d]", inet_ntoa(paddr.sin_addr), ntohs(paddr.sin_port));
 
-    FD_ZERO(&fds);
+    wire_seal(&upstream.out);
+    upstream_hello();
+    set_nonblock(upstream.fd, 1);
+    event_add(upstream.fd, &upstream);
+    upstream_flush();
+}
+
+void upstream_hello() {
+    // The relay is one client of all the cores and the throughput of its
+    // children, its SIMD is as wide as the narrowest of them
+    struct net_msg msg;
+    if (upstream.fd == -1 || !cores_all)
+        return;
+    memset(&msg, 0, sizeof(struct net_msg));
+    msg.type = MSG_HELLO;
+    msg.cores = cores_all;
+    msg.rate = capacity_all;
     for (int i = 0; i < clients_max; ++i) {
-            if (client[i]) {
-                FD_SET(client[i], &fds);
-                if (client[i] > maxsd)
-                    maxsd = client[i];
+        struct conn* c = &conns[i];
+        if (c->state != CONN_IDLE && c->state != CONN_BUSY)
+            continue;
+        msg.placement.phys += c->placement.phys;
+        msg.placement.smt += c->placement.smt;
+        msg.placement.sockets += c->placement.sockets;
+        msg.placement.nodes += c->placement.nodes;
+        if (!msg.width || c->width < msg.width)
+            msg.width = c->width;
+    }
+    wire_put(&upstream.out, &msg);
+}
+
+void upstream_read() {
+    struct wire_frame frame;
+    struct net_msg msg;
+    while (upstream.fd != -1) {
+        int bytes = read(upstream.fd, wire_space(&upstream.in, READ_CHUNK), READ_CHUNK);
+        if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        if (bytes <= 0) {
+            upstream_close(bytes ? strerror(errno) : "the connection is closed");
+            return;
+        }
+
+        // Handle the complete frames, MSG_BYE closes the connection
+        upstream.in.len += bytes;
+        long size, used = 0;
+        while (upstream.fd != -1 &&
+               (size = wire_frame(upstream.in.data + used, upstream.in.len - used, &frame)) > 0) {
+            if (frame.type == MSG_FUNC && !wire_func(&frame, &upstream.func)) {
+                upstream_close("broken f(x)");
+                return;
             }
-            else {
-                PRINT_ERR("A weird shit just have happened nearby: some file descriptors are NULL");
+            if (frame.type == MSG_FUNC)
+                upstream.records_len = 0;
+            if (frame.type == MSG_SWEEP) {
+                if (!upstream.records &&
+                    !(upstream.records = malloc(SWEEP_MAX_RECORDS * sizeof(struct sweep_record))))
+                    PRINT_ERR("Memory allocation");
+                if (!wire_sweep(&frame, upstream.records)) {
+                    upstream_close("broken sweep");
+                    return;
+                }
+                upstream.records_len = frame.count;
+            }
+            for (unsigned i = 0; frame.type != MSG_FUNC && frame.type != MSG_SWEEP &&
+                                 i < frame.count && upstream.fd != -1; ++i) {
+                wire_record(&frame, i, &msg);
+                if (msg.type == MSG_TASK && msg.method == METHOD_SWEEP &&
+                    (msg.first > upstream.records_len || msg.steps > upstream.records_len - msg.first)) {
+                    upstream_close("the sweep task has no records");
+                    return;
+                }
+                if (msg.type == MSG_TASK)
+                    relay_task(&msg);
+                else if (msg.type == MSG_CANCEL)
+                    relay_cancel(msg.job);
+                else if (msg.type == MSG_BYE)
+                    upstream_close(NULL);
+                else if (msg.type != MSG_DONE)
+                    PRINT_WARN("Upstream: unexpected message %d is ignored", msg.type);
             }
+            used += size;
+        }
+        if (upstream.fd == -1)
+            return;
+        wire_consume(&upstream.in, used);
+        if (size < 0) {
+            upstream_close("broken frame");
+            return;
+        }
     }
 
-    // getting calculations results
-    int ready = 0;
-    while (ready < clients_max) {
-        if ((select(maxsd+1, &fds, NULL, NULL, NULL) == -1) && (errno != EINTR)) {
-            PRINT_ERRV("SELECT");
+    // The new jobs go to the idle clients
+    feed_clients();
+}
+
+void upstream_flush() {
+    unsigned long done = 0;
+    wire_seal(&upstream.out);
+    while (done < upstream.out.len) {
+        int bytes = write(upstream.fd, upstream.out.data + done, upstream.out.len - done);
+        if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        if (bytes == -1) {
+            upstream_close(strerror(errno));
+            return;
         }
-        else {
-            PRINT_LINE("SELECT happened");
+        done += bytes;
+    }
+    wire_consume(&upstream.out, done);
+
+    // The rest goes when the socket is writable again
+    event_want_out(upstream.fd, upstream.out.len > 0);
+}
+
+void upstream_close(const char* why) {
+    if (why) {
+        PRINT_WARN("The upstream server is lost (%s), its jobs are dropped", why);
+    }
+    else
+        PRINT_LINE("The upstream server said bye");
+
+    event_del(upstream.fd);
+    close(upstream.fd);
+    upstream.fd = -1;
+    wire_free(&upstream.in);
+    wire_free(&upstream.out);
+
+    // Nobody waits for the results of the relayed jobs any more
+    for (struct job *job = queue, *next; job; job = next) {
+        next = job->next;
+        if (job->relayed)
+            stop_job(job);
+    }
+}
+
+void relay_task(const struct net_msg* task) {
+    // The upstream server owns at most BATCH_TASKS tasks of the relay,
+    // so the ring of the results never overflows
+    struct job job;
+    memset(&job, 0, sizeof(struct job));
+    job.from = task->local_from;
+    job.to = task->local_to;
+    job.method = task->method;
+    job.steps = task->steps;
+    job.func = upstream.func;
+    job.dims = task->dims;
+    job.grid = task->grid;
+    job.seed = task->seed;
+    job.step = task->distance;
+    job.base = task->first;
+    if (job.method == METHOD_SWEEP)
+        job.records = upstream.records + task->first;
+    job.upstream_id = task->job;
+    job.relayed = 1 + upstream.next;
+    upstream.tasks[upstream.next++ % BATCH_TASKS] = (struct relayed) {.done = 0};
+    enqueue(&job);
+}
+
+void relay_cancel(unsigned id) {
+    // The cancelled tasks are answered with zero like the clients do
+    for (struct job *job = queue, *next; job; job = next) {
+        next = job->next;
+        if (!job->relayed || job->upstream_id != id)
+            continue;
+        upstream.tasks[(job->relayed - 1) % BATCH_TASKS] = (struct relayed) {.done = 1};
+        stop_job(job);
+    }
+    PRINT_LINE("Upstream job %u is cancelled", id);
+    relay_result(NULL, (struct dsum) {0, 0}, (struct dsum) {0, 0});
+}
+
+void relay_result(const struct job* job, struct dsum value, struct dsum error) {
+    struct net_msg result;
+    if (job)
+        upstream.tasks[(job->relayed - 1) % BATCH_TASKS] = (struct relayed) {1, value, error};
+
+    // The upstream server takes the results in the order of its tasks,
+    // they are written after the events like the tasks of the clients
+    while (upstream.first < upstream.next && upstream.tasks[upstream.first % BATCH_TASKS].done) {
+        struct relayed* r = &upstream.tasks[upstream.first++ % BATCH_TASKS];
+        memset(&result, 0, sizeof(struct net_msg));
+        result.type = MSG_RESULT;
+        result.node_sum = r->value;
+        result.node_error = r->error;
+        wire_put(&upstream.out, &result);
+    }
+}
+
+//==============================================================================
+// STATS SECTION
+//==============================================================================
+
+void conn_clock(struct conn* c) {
+    double t_now = now();
+    if (c->state == CONN_BUSY)
+        c->busy += t_now - c->since;
+    else if (c->state == CONN_IDLE && c->since)
+        c->idle += t_now - c->since;
+    c->since = t_now;
+}
+
+void take_stats(struct conn* c, struct net_msg* msg) {
+    if (msg->stats.thread < c->cores)
+        c->threads[msg->stats.thread] = msg->stats;
+}
+
+// The families of the client and the thread counters, in the dump order
+enum {CLIENT_CAPACITY, CLIENT_WIDTH, CLIENT_TASKS, CLIENT_STEPS, CLIENT_RATE, CLIENT_BYTES,
+      CLIENT_BUSY, CLIENT_IDLE, CLIENT_FAMILIES};
+enum {THREAD_STEPS, THREAD_RATE, THREAD_BUSY, THREAD_IDLE, THREAD_FAMILIES};
+
+static const struct {
+    const char *name, *type, *help;
+} client_families[CLIENT_FAMILIES] = {
+    {"netintegral_client_calibrated_evals_per_second", "gauge", "Points of f(x) per second measured at connect"},
+    {"netintegral_client_simd_width",         "gauge",   "Doubles per SIMD instruction of the kernel"},
+    {"netintegral_client_tasks_total",        "counter", "Results taken from the client"},
+    {"netintegral_client_steps_total",        "counter", "Simpson steps or Kronrod panels of the results"},
+    {"netintegral_client_evals_per_second",   "gauge",   "Points of f(x) per second with tasks"},
+    {"netintegral_client_bytes_total",        "counter", "Bytes on the wire"},
+    {"netintegral_client_busy_seconds_total", "counter", "Time with tasks"},
+    {"netintegral_client_idle_seconds_total", "counter", "Time idle while the jobs wait for the last results"},
+}, thread_families[THREAD_FAMILIES] = {
+    {"netintegral_thread_steps_total",        "counter", "Simpson steps or Kronrod panels of the thread"},
+    {"netintegral_thread_evals_per_second",   "gauge",   "Points of f(x) per second computing"},
+    {"netintegral_thread_busy_seconds_total", "counter", "Time computing"},
+    {"netintegral_thread_idle_seconds_total", "counter", "Time waiting for the other threads of the task"},
+};
+
+static double client_value(const struct conn* c, int family) {
+    switch (family) {
+        case CLIENT_CAPACITY:   return c->capacity;
+        case CLIENT_WIDTH:      return c->width;
+        case CLIENT_TASKS:      return c->tasks;
+        case CLIENT_STEPS:      return c->steps;
+        case CLIENT_RATE:       return c->busy ? c->evals / c->busy : 0;
+        case CLIENT_BUSY:       return c->busy;
+        default:                return c->idle;
+    }
+}
+
+static double thread_value(const struct thread_stats* ts, int family) {
+    switch (family) {
+        case THREAD_STEPS:  return ts->steps;
+        case THREAD_RATE:   return ts->busy ? ts->evals / ts->busy : 0;
+        case THREAD_BUSY:   return ts->busy;
+        default:            return ts->idle;
+    }
+}
+
+void dump_stats(struct wire_buf* b) {
+    static const char* phase_names[3] = {"dispatch", "compute", "reduction"};
+
+    metrics_family(b, "netintegral_phase_seconds", "gauge",
+                   "Time of the server phases before the jobs");
+    metrics_value(b, "netintegral_phase_seconds", t_connected - t_start, "phase=\"discovery\"");
+    metrics_value(b, "netintegral_phase_seconds", t_ready - t_connected, "phase=\"handshake\"");
+
+    metrics_family(b, "netintegral_jobs_total", "counter", "Jobs finished");
+    metrics_value(b, "netintegral_jobs_total", jobs_done, NULL);
+    metrics_family(b, "netintegral_job_phase_seconds", "gauge",
+                   "Time of the phases of the last job finished");
+    for (int k = 0; jobs_done && k < 3; ++k)
+        metrics_value(b, "netintegral_job_phase_seconds", last_phases[k],
+                      "job=\"%u\",phase=\"%s\"", last_job, phase_names[k]);
+    metrics_family(b, "netintegral_job_phase_seconds_total", "counter",
+                   "Time of the phases summed over the jobs");
+    for (int k = 0; k < 3; ++k)
+        metrics_value(b, "netintegral_job_phase_seconds_total", total_phases[k],
+                      "phase=\"%s\"", phase_names[k]);
+
+    // The clients, the time is counted up to now
+    for (int i = 0; i < clients_max; ++i)
+        if (conns[i].state == CONN_IDLE || conns[i].state == CONN_BUSY)
+            conn_clock(&conns[i]);
+    for (int f = 0; f < CLIENT_FAMILIES; ++f) {
+        metrics_family(b, client_families[f].name, client_families[f].type, client_families[f].help);
+        for (int i = 0; i < clients_max; ++i) {
+            struct conn* c = &conns[i];
+            if (c->state != CONN_IDLE && c->state != CONN_BUSY)
+                continue;
+            if (f == CLIENT_BYTES) {
+                metrics_value(b, client_families[f].name, c->bytes_in, "client=\"%d\",direction=\"in\"", i);
+                metrics_value(b, client_families[f].name, c->bytes_out, "client=\"%d\",direction=\"out\"", i);
+            }
+            else
+                metrics_value(b, client_families[f].name, client_value(c, f), "client=\"%d\"", i);
         }
+    }
 
+    // The threads, as the clients reported them last time
+    for (int f = 0; f < THREAD_FAMILIES; ++f) {
+        metrics_family(b, thread_families[f].name, thread_families[f].type, thread_families[f].help);
         for (int i = 0; i < clients_max; ++i) {
-            if (FD_ISSET(client[i], &fds)) {
-                PRINT_LINE("Event @%d", client[i]);
-                TRY_TO(bytes = read(client[i], &request, sizeof(struct net_msg)));
-                if (!bytes)
-                    PRINT_ERR("The connection is closed")
-                else if (bytes != sizeof(struct net_msg))
-                    PRINT_ERR("Cannot receive net_msg");
-                S += request.distance;
-                ++ready;
-
-                PRINT_LINE("Client_%d := %Lf", i, request.distance);
+            struct conn* c = &conns[i];
+            if (c->state != CONN_IDLE && c->state != CONN_BUSY)
+                continue;
+            for (unsigned k = 0; k < c->cores; ++k)
+                metrics_value(b, thread_families[f].name, thread_value(&c->threads[k], f),
+                              "client=\"%d\",thread=\"%u\"", i, k);
+        }
+    }
+    metrics_end(b);
+}
+
+void print_stats() {
+    struct wire_buf dump = {NULL, 0, 0, WIRE_SEALED};
+    dump_stats(&dump);
+    log_write((const char*)dump.data, dump.len);
+    wire_free(&dump);
+}
+
+//==============================================================================
+// EVENT LOOP SECTION
+//==============================================================================
+
+void poll_events() {
+    struct event events[MAX_EVENTS];
+    int n = event_wait(events, MAX_EVENTS, (in_flight || clients_leaving) ? SPECULATE_TICK : -1);
+
+    for (int i = 0; i < n; ++i) {
+        struct conn* c = events[i].ptr;
+        switch (c->source) {
+            case SOURCE_BOSS:
+                accept_clients();
+                break;
+            case SOURCE_CONTROL:
+                accept_callers();
+                break;
+            case SOURCE_PROBE:
+                discovery_answer(probe_sock, &broadcast_msg);
+                break;
+            case SOURCE_CALLER:
+                // The caller dropped by an earlier event is not touched
+                if (((struct caller*)events[i].ptr)->dead)
+                    break;
+                if (events[i].out)
+                    caller_flush(events[i].ptr);
+                if (events[i].in)
+                    caller_read(events[i].ptr);
+                else
+                    caller_drop(events[i].ptr);
+                break;
+            case SOURCE_UPSTREAM:
+                if (events[i].in && upstream.fd != -1)
+                    upstream_read();
+                if (events[i].out && upstream.fd != -1)
+                    upstream_flush();
+                break;
+            default:
+                if (events[i].in && c->state != CONN_FREE)
+                    conn_read(c);
+                if (events[i].out && c->state != CONN_FREE)
+                    conn_flush(c);
+        }
+    }
+
+    // The jobs the cache answered are over before the clients get them
+    finish_cached();
+
+    // The tasks handed out by this wakeup go now
+    speculate();
+    report_progress();
+    flush_clients();
+    if (upstream.fd != -1 && upstream.out.len)
+        upstream_flush();
+
+    // The counters of the last results are in by now
+    if (stats_due) {
+        print_stats();
+        stats_due = 0;
+    }
+    free_callers();
+}
+
+void accept_clients() {
+    while (1) {
+        int new = accept(boss, (struct sockaddr*)&addr, &addr_len);
+        if (new == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (new == -1 && (errno == EINTR || errno == ECONNABORTED))
+            continue;
+        TRY_TO(new);
+
+        struct conn* c = NULL;
+        for (int i = 0; i < clients_max && !c; ++i)
+            if (conns[i].state == CONN_FREE)
+                c = &conns[i];
+        if (!c) {
+            PRINT_WARN("Extra connection [%s:%d] is refused", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+            close(new);
+            continue;
+        }
+
+        PRINT_LINE("New connection %d [%s:%d]", (int)(c - conns), inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+        if (!t_ready)
+            t_connected = now();
+        c->source = SOURCE_CLIENT;
+        c->fd = new;
+        c->state = CONN_HANDSHAKE;
+        c->func_id = 0;
+        c->owned_len = 0;
+        c->draining = 0;
+        c->rate = 0;
+        c->last_result = now();
+        c->in.len = c->out.len = 0;
+        wire_seal(&c->out);
+        c->tasks = c->steps = c->bytes_in = c->bytes_out = 0;
+        c->evals = c->busy = c->idle = c->since = 0;
+        set_nonblock(new, 1);
+        enable_keepalive(new);
+        event_add(new, c);
+    }
+}
+
+void conn_read(struct conn* c) {
+    struct wire_frame frame;
+    struct net_msg msg;
+    while (1) {
+        int bytes = read(c->fd, wire_space(&c->in, READ_CHUNK), READ_CHUNK);
+        if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        if (bytes <= 0 && c->state == CONN_HANDSHAKE) {
+            // Nothing is lost yet, the slot is free again
+            PRINT_LINE("Client %d left before the handshake", (int)(c - conns));
+            conn_close(c);
+            return;
+        }
+        if (c->state == CONN_BYE) {
+            // The client told bye has nothing to say, it only closes
+            if (bytes <= 0)
+                conn_close(c);
+            continue;
+        }
+        if (bytes <= 0) {
+            conn_lost(c, bytes ? strerror(errno) : "the connection is closed");
+            return;
+        }
+
+        // Handle the complete frames, keep the tail
+        c->in.len += bytes;
+        c->bytes_in += bytes;
+        long size, used = 0;
+        while ((size = wire_frame(c->in.data + used, c->in.len - used, &frame)) > 0) {
+            for (unsigned i = 0; i < frame.count; ++i) {
+                wire_record(&frame, i, &msg);
+                handle_msg(c, &msg);
+
+                // The drained client is told bye, the rest is not read
+                if (c->state == CONN_FREE || c->state == CONN_BYE)
+                    return;
             }
+            used += size;
+        }
+        wire_consume(&c->in, used);
+        if (size < 0) {
+            conn_lost(c, "broken frame");
+            return;
         }
     }
+}
 
-    // printing result
-    printf (LINE);
-    printf ("The integral of f(x) == %.6Lf\n", S);
-    printf (LINE);
+void conn_queued(struct conn* c) {
+    if (c->dirty)
+        return;
+    c->dirty = 1;
+    dirty[dirty_len++] = c - conns;
+}
 
-    // exiting
-    free(client);
-    free(cores);
-    return 0;
+void conn_flush(struct conn* c) {
+    unsigned long done = 0;
+    wire_seal(&c->out);
+    while (done < c->out.len) {
+        int bytes = write(c->fd, c->out.data + done, c->out.len - done);
+        if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (bytes == -1 && errno == EINTR)
+            continue;
+        if (bytes == -1 && c->state == CONN_BYE) {
+            conn_close(c);
+            return;
+        }
+        if (bytes == -1) {
+            conn_lost(c, strerror(errno));
+            return;
+        }
+        done += bytes;
+        c->bytes_out += bytes;
+    }
+    wire_consume(&c->out, done);
+
+    // The bye is the last frame, the slot is free once it is written
+    if (c->state == CONN_BYE && !c->out.len) {
+        shutdown(c->fd, SHUT_RDWR);
+        conn_close(c);
+        return;
+    }
+
+    // The rest goes when the socket is writable again
+    event_want_out(c->fd, c->out.len > 0);
+}
+
+void flush_clients() {
+    while (dirty_len) {
+        struct conn* c = &conns[dirty[--dirty_len]];
+        c->dirty = 0;
+        if (c->state != CONN_FREE)
+            conn_flush(c);
+    }
+}
+
+void handle_msg(struct conn* c, struct net_msg* msg) {
+    int i = c - conns;
+    DBG_PRINT("Event @%d", c->fd);
+
+    if (msg->type == MSG_HELLO)
+        conn_hello(c, msg);
+    else if (c->state == CONN_BUSY && msg->type == MSG_PROGRESS)
+        take_progress(c, msg);
+    else if (c->state == CONN_BUSY && msg->type == MSG_VALUE)
+        take_value(c, msg);
+    else if (c->state != CONN_HANDSHAKE && msg->type == MSG_STATS)
+        take_stats(c, msg);
+    else if (c->state != CONN_HANDSHAKE && msg->type == MSG_DRAIN)
+        conn_drain(c);
+    else if (c->state == CONN_BUSY && msg->type == MSG_RESULT) {
+        struct job* job = take_result(c, msg);
+        if (job && job_finished(job))
+            finish_job(job);
+        if (c->draining && !c->owned_len)
+            conn_leave(c);
+        feed_clients();
+    }
+    else
+        PRINT_WARN("Client %d: unexpected message %d is ignored", i, msg->type);
 }
 
 //==============================================================================
@@ -242,7 +2410,6 @@ int main(int argc, char** argv)
 void* broadcast(void* args) {
     // Prepare to create a UDP socket
     struct sockaddr_in addr;
-    int sent_bytes;
     socklen_t addr_len = sizeof(struct sockaddr_in);
 
     // Creating a UDP socket
@@ -256,86 +2423,249 @@ void* broadcast(void* args) {
     TRY_TO(bind(bsock, (struct sockaddr*)&addr, addr_len));
     int ld1 = 1;
     TRY_TO(setsockopt(bsock, SOL_SOCKET, SO_BROADCAST, &ld1, sizeof(ld1)));
-    addr.sin_addr.s_addr = htonl(-1);
-    addr.sin_port = htons(BROADCAST_PORT);
 
-    // Broadcast in cycle every second
+    // Announce in cycle every second for the clients that do not probe,
+    // the probing ones are answered by the event loop
     while (1) {
-        TRY_TO(sent_bytes = sendto(bsock, args, sizeof(struct net_msg), 0, (struct sockaddr*)&addr, addr_len));
-        if (sent_bytes != sizeof(struct net_msg))
-            PRINT_ERR("Cannot send net_msg")
-        PRINT_LINE("Sent %d bytes", sent_bytes);
+        discovery_announce(bsock, &discovery, args);
+        DBG_PRINT("Announced the port %d", ((struct net_msg*)args)->tcp_port);
         sleep(1);
     }
-    args = NULL;
 }
 
 
 void wait_for_clients() {
-    // prepare variables
-    fd_set fds;
-    int clients_count = 0, cores_info = 0, maxsd;
-    struct net_msg recv_msg;
     cores_all = 0;
+    capacity_all = 0;
+    clients_ready = 0;
 
-    PRINT_LINE("Wait for clients on port %d", broadcast_msg.tcp_port);
+    PRINT_LINE("Wait for %d client%s on port %d", quorum, (quorum > 1) ? "s" : "", broadcast_msg.tcp_port);
 
-    // Wait for clients in cycle until all of them are done
-    while (cores_info < clients_max) {
-        FD_ZERO(&fds);
-        FD_SET(boss, &fds);
-        maxsd = boss;
-        for (int i = 0; i < clients_max; ++i) {
-            if (client[i]) {
-                FD_SET(client[i], &fds);
-                if (client[i] > maxsd)
-                    maxsd = client[i];
-            }
-        }
+    // Wait for clients in cycle until the quorum is there,
+    // the others join later
+    while (clients_ready < quorum)
+        poll_events();
 
-        // If all clients are done, close the connection gently
-        if (clients_count == clients_max) {
-            FD_CLR(boss, &fds);
-            shutdown(boss, SHUT_RDWR);
-            close(boss);
-        }
+    PRINT_LINE("Prepared to integrate");
+}
 
-        // Select the wait event is happened
-        if ((select(maxsd+1, &fds, NULL, NULL, NULL) == -1) && (errno != EINTR))
-            PRINT_ERRV("Select failed");
+int next_task(struct conn* c, struct job* job, struct task* t) {
+    t->job = job;
+    if (is_adaptive(job))
+        return next_interval(c, job, t);
+    return next_chunk(c, job, t);
+}
 
-        if (FD_ISSET(boss, &fds)) {
-            PRINT_LINE("Event @%d", boss);
-            int new;
-            TRY_TO(new = accept(boss, (struct sockaddr*)&addr, &addr_len));
-            PRINT_LINE("New connection %d [%s:%d]", clients_count, inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
-            for (int i = 0; i < clients_max; ++i)
-                if (!client[i]) {
-                    client[i] = new;
-                    break;
-                }
-            clients_count += 1;
-        }
-
-        // read net_msg from clients in cycle
-        for (int i = 0; i < clients_max; ++i)
-            if (FD_ISSET(client[i], &fds)) {
-                PRINT_LINE("Event @%d", client[i]);
-                TRY_TO(bytes = read(client[i], &recv_msg, sizeof(struct net_msg)));
-                if (!bytes)
-                    PRINT_ERR("The connection is closed")
-                else if (bytes != sizeof(struct net_msg))
-                    PRINT_ERR("Cannot read net_msg")
-                else {
-                    cores[i] = recv_msg.cores;
-                    cores_info += 1;
-                    cores_all += recv_msg.cores;
-                    PRINT_LINE("Client %d: %d core%s", i, cores[i], ((cores[i] > 1) ? "s" : ""));
-                }
-            }
+int next_interval(struct conn* c, struct job* job, struct task* t) {
+    if (!adaptive_next(&job->adaptive, &t->owned))
+        return 0;
+    t->work = (double)ADAPTIVE_PANELS * c->cores * KRONROD_POINTS;
+    return 1;
+}
+
+static double step_points(const struct job* job) {
+    switch (job->method) {
+        case METHOD_KRONROD:    return KRONROD_POINTS;
+        case METHOD_CUBATURE:   return cubature_points(job->dims);
+        case METHOD_QMC:        return 1;
+        case METHOD_ROMBERG:    return 1;
+        case METHOD_SWEEP:      return (double)SIMPSON_POINTS * job->grid;
+        default:                return SIMPSON_POINTS;
     }
+}
 
-    PRINT_LINE("Prepared to integrate");
+int next_chunk(struct conn* c, struct job* job, struct task* t) {
+    // The steps of the lost clients go first
+    if (job->lost_len) {
+        t->range = job->lost[--job->lost_len];
+        t->work = step_points(job) * t->range.steps;
+        return 1;
+    }
+
+    // The least chunk costs about MIN_CHUNK_STEPS Simpson steps,
+    // the relayed Kronrod panels are few, any client may take a handful
+    unsigned long long left = job->steps - job->next_step,
+                       least = SIMPSON_POINTS * MIN_CHUNK_STEPS / step_points(job),
+                       chunk;
+    if (job->method == METHOD_KRONROD)
+        least = ADAPTIVE_PANELS;
+    if (!left)
+        return 0;
+
+    if (sched_mode == SCHED_STATIC) {
+        // One slice per client sized by its throughput, rounded up so
+        // the slices of all the clients cover the job
+        chunk = job->steps * client_share(c) + 1;
+    }
+    else {
+        // Guided self-scheduling: chunks shrink as the work runs out,
+        // so the last chunks finish at roughly the same moment
+        chunk = left * client_share(c) / GUIDED_FACTOR + 1;
+        if (chunk < least * c->cores)
+            chunk = least * c->cores;
+    }
+
+    // A QMC chunk stays in one scramble, their sums are kept apart
+    unsigned long long offset = job->base + job->next_step;
+    if (job->method == METHOD_QMC) {
+        offset %= job->grid;
+        if (left > job->grid - offset)
+            left = job->grid - offset;
+    }
+
+    // The chunk ends where the cached steps begin
+    unsigned long long uncached = (job->cached_next < job->cached_len)
+                                ? job->cached[job->cached_next].first - job->next_step : left;
+    if (left > uncached)
+        left = uncached;
+
+    // The chunk is a node of the tree of the steps (see reduce.h)
+    chunk = reduce_span(offset, chunk, left, job_block(job));
+
+    t->range = (struct steps_range) {job->next_step, chunk};
+    t->work = step_points(job) * chunk;
+    job->next_step += chunk;
+    skip_cached(job);
+    return 1;
+}
+
+unsigned long long job_block(const struct job* job) {
+    // The records of a sweep are integrated together by blocks
+    if (job->method == METHOD_SWEEP)
+        return SWEEP_BLOCK;
+    return reduce_block(step_points(job));
+}
+
+void job_node(const struct job* job, unsigned long long first, unsigned long long steps,
+              struct reduce_node* node) {
+    reduce_node(first, steps, (job->method == METHOD_QMC) ? job->grid : 0, job_block(job), node);
+}
+
+double client_share(const struct conn* c) {
+    // The cores are counted only if no client measured its throughput
+    if (capacity_all > 0)
+        return c->capacity / capacity_all;
+    return (double)c->cores / cores_all;
+}
+
+void task_msg(struct conn* c, const struct task* t, struct net_msg* msg) {
+    struct job* job = t->job;
+    if (is_adaptive(job)) {
+        unsigned panels = ADAPTIVE_PANELS * c->cores;
+        *msg = (struct net_msg) {
+            .type       = MSG_TASK,
+            .method     = METHOD_KRONROD,
+            .cores      = c->cores,
+            .job        = job->id,
+            .steps      = panels,
+            .dims       = 1,
+            .local_from = t->owned.from,
+            .local_to   = t->owned.to,
+            .distance   = (t->owned.to - t->owned.from) / panels
+        };
+        return;
+    }
+
+    if (job->method == METHOD_CUBATURE || job->method == METHOD_QMC) {
+        *msg = (struct net_msg) {
+            .type       = MSG_TASK,
+            .method     = job->method,
+            .cores      = c->cores,
+            .job        = job->id,
+            .steps      = t->range.steps,
+            .dims       = job->dims,
+            .first      = job->base + t->range.first,
+            .grid       = job->grid,
+            .seed       = job->seed,
+            .local_from = job->from,
+            .local_to   = job->to
+        };
+        return;
+    }
+
+    // The records are numbered in the sweep the client has, the ones of
+    // a relayed sweep from the first one of its upstream task
+    if (job->method == METHOD_SWEEP) {
+        *msg = (struct net_msg) {
+            .type       = MSG_TASK,
+            .method     = METHOD_SWEEP,
+            .cores      = c->cores,
+            .job        = job->id,
+            .steps      = t->range.steps,
+            .dims       = 1,
+            .first      = t->range.first,
+            .grid       = job->grid,
+            .local_from = job->from,
+            .local_to   = job->to
+        };
+        return;
+    }
+
+    // The steps are numbered from job->from, so a step is at the same x
+    // whatever chunk or relay it goes with
+    unsigned long long first = job->base + t->range.first;
+    *msg = (struct net_msg) {
+        .type       = MSG_TASK,
+        .method     = job->method,
+        .cores      = c->cores,
+        .job        = job->id,
+        .steps      = t->range.steps,
+        .dims       = 1,
+        .first      = first,
+        .local_from = job->from,
+        .local_to   = job->from + job->step * (first + t->range.steps),
+        .distance   = job->step
+    };
+}
+
+void send_task(struct conn* c, struct net_msg* task) {
+    wire_put(&c->out, task);
+    conn_queued(c);
+    DBG_PRINT("Client_%d <- [%.6Lf:%.6Lf] %llu steps", (int)(c - conns), task->local_from, task->local_to, task->steps);
+}
+
+void send_func(struct conn* c, const struct expr* f) {
+    wire_put_func(&c->out, f);
+    conn_queued(c);
+}
+
+void send_sweep(struct conn* c, const struct job* job) {
+    wire_put_sweep(&c->out, job->records, job->steps);
+    conn_queued(c);
+}
+
+void release_client(struct conn* c, int type) {
+    struct net_msg stop;
+    int i = c - conns;
+    if (c->state == CONN_FREE || c->state == CONN_BYE)
+        return;
+    memset(&stop, 0, sizeof(struct net_msg));
+    stop.type = type;
+    wire_put(&c->out, &stop);
+    conn_queued(c);
+    DBG_PRINT("Client_%d <- %d @%d", i, type, c->fd);
+    if (type != MSG_BYE)
+        return;
+
+    // The client is out of the membership now, the loop writes the bye
+    // and frees the slot. The one that dies before it is not lost:
+    // it has nothing to give back
+    if (c->state != CONN_HANDSHAKE) {
+        cores_all -= c->cores;
+        capacity_all -= c->capacity;
+        --clients_ready;
+    }
+    for (int j = 0; j < idle_len; ++j)
+        if (idle[j] == i)
+            idle[j--] = idle[--idle_len];
+    c->state = CONN_BYE;
+    ++clients_leaving;
+}
+
+void set_nonblock(int sock, int on) {
+    int flags;
+    TRY_TO(flags = fcntl(sock, F_GETFL));
+    TRY_TO(fcntl(sock, F_SETFL, on ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK)));
 }
 
 void enable_keepalive(int sock) {
@@ -0,0 +1,285 @@
+/* File:     simpson.c
+ * Purpose:  Simpson formula kernels for the integrating threads
+ * Note:
+ |    1.  The vector kernels evaluate the nodes by their index,
+ |        x = from + i * distance, so no error piles up along the interval
+ |    2.  Kernels for the wider ISAs are compiled with the target attribute,
+ |        so the whole file is built without any -m flags
+ |    3.  Every kernel has its midpoint sum for the Romberg levels,
+ |        the new nodes of a level are the midpoints of the last one
+ |    4.  The sums are compensated: every lane keeps the rest its additions
+ |        rounded off, so the double kernels are as good as the long
+ |        double one over a block of steps (see reduce.h)
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+//==============================================================================
+// INCLUDE SECTION
+//==============================================================================
+
+#include <stdio.h>
+#include <string.h>
+
+#include "expr.h"
+#include "reduce.h"
+#include "simpson.h"
+
+//==============================================================================
+// KERNELS SECTION
+//==============================================================================
+
+// The reference kernel: the same loop the threads always had
+static long double simpson_ldouble(long double from, long double distance,
+                                   unsigned long long steps) {
+    long double distance2 = distance / 2;
+    long double srt       = from;
+    long double mid       = srt + distance2;
+    long double end       = srt + distance;
+    long double f_srt     = FUNCTION(srt);
+    long double f_end;
+    long double local_res = 0;
+
+    for (unsigned long long i = 0; i < steps; ++i) {
+        f_end = FUNCTION(end);
+        local_res += f_srt + 4 * FUNCTION(mid) + f_end;
+        f_srt = f_end;          // next dx
+        srt = end;              //
+        mid += distance;        //
+        end += distance;        //
+    }
+
+    return local_res * distance / 6;
+}
+
+static long double midpoint_ldouble(long double from, long double distance,
+                                    unsigned long long steps) {
+    long double mid = from + distance / 2,
+                local_res = 0;
+    for (unsigned long long i = 0; i < steps; ++i) {
+        local_res += FUNCTION(mid);
+        mid += distance;
+    }
+    return local_res * distance;
+}
+
+// The sum s and its rest c gain y, nothing is rounded off (TwoSum),
+// no branches, so the vectors take it lane by lane
+#define TWO_SUM(s, c, y, t, z)                                                 \
+    t = s + y;                                                                 \
+    z = t - s;                                                                 \
+    c += (s - (t - z)) + (y - z);                                              \
+    s = t;
+
+// Vector kernel template. Over n steps the Simpson sum is
+//      h/6 * (f(a) + f(b) + 4 * sum f(mid_i) + 2 * sum f(node_i), 0 < i < n)
+// so the nodes are summed from i = 0 and f(a) is taken back at the end.
+// Every lane keeps its sum and rest, the lanes are added in their order.
+#define SIMPSON_VECTOR_KERNEL(NAME, ISA, WIDTH)                                \
+typedef double NAME##_vec __attribute__((vector_size(WIDTH * sizeof(double))));\
+__attribute__((target(ISA)))                                                   \
+static long double NAME(long double from, long double distance,                \
+                        unsigned long long steps) {                            \
+    double a = from, h = distance, h2 = h / 2;                                 \
+    NAME##_vec lane, x, m, y, t, z, node_v, node_c, mid_v, mid_c;              \
+    for (int k = 0; k < WIDTH; ++k) {                                          \
+        lane[k] = k;                                                           \
+        node_v[k] = node_c[k] = mid_v[k] = mid_c[k] = 0;                       \
+    }                                                                          \
+                                                                               \
+    unsigned long long i = 0, full = steps - steps % WIDTH;                    \
+    for (; i < full; i += WIDTH) {                                             \
+        x = a + ((double)i + lane) * h;                                        \
+        m = x + h2;                                                            \
+        y = FUNCTION(x);                                                       \
+        TWO_SUM(node_v, node_c, y, t, z)                                       \
+        y = FUNCTION(m);                                                       \
+        TWO_SUM(mid_v, mid_c, y, t, z)                                         \
+    }                                                                          \
+                                                                               \
+    double node_s = 0, node_r = 0, mid_s = 0, mid_r = 0, xs, ys, ts, zs;       \
+    for (; i < steps; ++i) {                                                   \
+        xs = a + i * h;                                                        \
+        ys = FUNCTION(xs);                                                     \
+        TWO_SUM(node_s, node_r, ys, ts, zs)                                    \
+        xs += h2;                                                              \
+        ys = FUNCTION(xs);                                                     \
+        TWO_SUM(mid_s, mid_r, ys, ts, zs)                                      \
+    }                                                                          \
+    struct dsum node = {node_s, node_r}, mid = {mid_s, mid_r};                 \
+    for (int k = 0; k < WIDTH; ++k) {                                          \
+        node = dsum_add(node, (struct dsum) {node_v[k], node_c[k]});           \
+        mid  = dsum_add(mid,  (struct dsum) {mid_v[k],  mid_c[k]});            \
+    }                                                                          \
+                                                                               \
+    double fa = FUNCTION(a), b = a + steps * h, fb = FUNCTION(b);              \
+    return (4 * dsum_value(mid) + 2 * dsum_value(node) - fa + fb) * distance / 6;\
+}                                                                              \
+                                                                               \
+__attribute__((target(ISA)))                                                   \
+static long double NAME##_midpoint(long double from, long double distance,     \
+                                   unsigned long long steps) {                 \
+    double a = from, h = distance, h2 = h / 2;                                 \
+    NAME##_vec lane, m, y, t, z, mid_v, mid_c;                                 \
+    for (int k = 0; k < WIDTH; ++k) {                                          \
+        lane[k] = k;                                                           \
+        mid_v[k] = mid_c[k] = 0;                                               \
+    }                                                                          \
+                                                                               \
+    unsigned long long i = 0, full = steps - steps % WIDTH;                    \
+    for (; i < full; i += WIDTH) {                                             \
+        m = a + ((double)i + lane) * h + h2;                                   \
+        y = FUNCTION(m);                                                       \
+        TWO_SUM(mid_v, mid_c, y, t, z)                                         \
+    }                                                                          \
+                                                                               \
+    double mid_s = 0, mid_r = 0, ms, ys, ts, zs;                               \
+    for (; i < steps; ++i) {                                                   \
+        ms = a + i * h + h2;                                                   \
+        ys = FUNCTION(ms);                                                     \
+        TWO_SUM(mid_s, mid_r, ys, ts, zs)                                      \
+    }                                                                          \
+    struct dsum mid = {mid_s, mid_r};                                          \
+    for (int k = 0; k < WIDTH; ++k)                                            \
+        mid = dsum_add(mid, (struct dsum) {mid_v[k], mid_c[k]});               \
+    return dsum_value(mid) * distance;                                         \
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+    SIMPSON_VECTOR_KERNEL(simpson_sse2,   "sse2",    2)
+    SIMPSON_VECTOR_KERNEL(simpson_avx2,   "avx2",    4)
+    SIMPSON_VECTOR_KERNEL(simpson_avx512, "avx512f", 8)
+#else  // x86
+    SIMPSON_VECTOR_KERNEL(simpson_double, "default", 2)
+#endif // x86
+
+//==============================================================================
+// DISPATCH SECTION
+//==============================================================================
+
+// Ordered from the widest to the reference one
+static const struct simpson_kernel kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    {"avx512",  8, simpson_avx512, simpson_avx512_midpoint},
+    {"avx2",    4, simpson_avx2,   simpson_avx2_midpoint},
+    {"sse2",    2, simpson_sse2,   simpson_sse2_midpoint},
+#else  // x86
+    {"double",  2, simpson_double, simpson_double_midpoint},
+#endif // x86
+    {"ldouble", 1, simpson_ldouble, midpoint_ldouble},
+};
+
+#define KERNELS_NUM (sizeof(kernels) / sizeof(kernels[0]))
+
+static int simpson_supported(const struct simpson_kernel* kernel) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (kernel->integrate == simpson_avx512)
+        return __builtin_cpu_supports("avx512f");
+    if (kernel->integrate == simpson_avx2)
+        return __builtin_cpu_supports("avx2");
+    if (kernel->integrate == simpson_sse2)
+        return __builtin_cpu_supports("sse2");
+#endif // x86
+    (void)kernel;
+    return 1;
+}
+
+const struct simpson_kernel* simpson_select(const char* name) {
+    for (unsigned i = 0; i < KERNELS_NUM; ++i) {
+        if (name && strcmp(name, kernels[i].name))
+            continue;
+        if (simpson_supported(&kernels[i]))
+            return &kernels[i];
+        if (name)
+            return NULL;
+    }
+    return NULL;
+}
+
+void simpson_list(char* buf, unsigned size) {
+    unsigned len = 0;
+    buf[0] = '\0';
+    for (unsigned i = 0; i < KERNELS_NUM && len < size; ++i)
+        if (simpson_supported(&kernels[i]))
+            len += snprintf(buf + len, size - len, "%s%s",
+                            len ? "|" : "", kernels[i].name);
+}
+
+//==============================================================================
+// EXPRESSION KERNEL SECTION
+//==============================================================================
+
+// The lanes of the sums are independent, so the compiler vectorizes them.
+// A block of y is summed plainly, the sums of the blocks are compensated
+#define SUM_LANES   8
+
+static void sum_lanes(double* s, double* c, const double* y, unsigned n) {
+    double run[SUM_LANES] = {0}, t, z;
+    unsigned k = 0;
+    for (; k + SUM_LANES <= n; k += SUM_LANES)
+        for (unsigned l = 0; l < SUM_LANES; ++l)
+            run[l] += y[k + l];
+    for (; k < n; ++k)
+        run[0] += y[k];
+    for (unsigned l = 0; l < SUM_LANES; ++l) {
+        TWO_SUM(s[l], c[l], run[l], t, z)
+    }
+}
+
+static long double lanes_value(const double* s, const double* c) {
+    struct dsum sum = {0, 0};
+    for (unsigned l = 0; l < SUM_LANES; ++l)
+        sum = dsum_add(sum, (struct dsum) {s[l], c[l]});
+    return dsum_value(sum);
+}
+
+static void eval_expr(const double* x, double* y, unsigned n, void* f) {
+    expr_eval(f, x, y, n);
+}
+
+long double simpson_expr(const struct expr* f, long double from,
+                         long double distance, unsigned long long steps) {
+    return simpson_batch(eval_expr, (void*)f, from, distance, steps);
+}
+
+long double simpson_batch(void (*eval)(const double* x, double* y, unsigned n, void* arg),
+                          void* arg, long double from, long double distance,
+                          unsigned long long steps) {
+    double a = from, h = distance, h2 = h / 2;
+    double x[EXPR_BLOCK], y[EXPR_BLOCK];
+    double node[SUM_LANES] = {0}, node_r[SUM_LANES] = {0},
+           mid[SUM_LANES] = {0}, mid_r[SUM_LANES] = {0};
+
+    // The first half of the block takes the nodes, the second the midpoints
+    for (unsigned long long i = 0; i < steps; i += EXPR_BLOCK / 2) {
+        unsigned n = (steps - i < EXPR_BLOCK / 2) ? steps - i : EXPR_BLOCK / 2;
+        for (unsigned k = 0; k < n; ++k) {
+            x[k] = a + (i + k) * h;
+            x[n + k] = x[k] + h2;
+        }
+        eval(x, y, 2 * n, arg);
+        sum_lanes(node, node_r, y, n);
+        sum_lanes(mid, mid_r, y + n, n);
+    }
+
+    x[0] = a;
+    x[1] = a + steps * h;
+    eval(x, y, 2, arg);
+    return (4 * lanes_value(mid, mid_r) + 2 * lanes_value(node, node_r) - y[0] + y[1]) *
+           distance / 6;
+}
+
+long double midpoint_expr(const struct expr* f, long double from,
+                          long double distance, unsigned long long steps) {
+    double a = from, h = distance, h2 = h / 2;
+    double x[EXPR_BLOCK], y[EXPR_BLOCK];
+    double mid[SUM_LANES] = {0}, mid_r[SUM_LANES] = {0};
+
+    for (unsigned long long i = 0; i < steps; i += EXPR_BLOCK) {
+        unsigned n = (steps - i < EXPR_BLOCK) ? steps - i : EXPR_BLOCK;
+        for (unsigned k = 0; k < n; ++k)
+            x[k] = a + (i + k) * h + h2;
+        expr_eval(f, x, y, n);
+        sum_lanes(mid, mid_r, y, n);
+    }
+    return lanes_value(mid, mid_r) * distance;
+}
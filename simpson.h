@@ -0,0 +1,67 @@
+/* File:     simpson.h
+ * Purpose:  Simpson formula kernels for the integrating threads
+ * Note:
+ |    1.  The builtin f(x) is hardcoded as FUNCTION (predefined)
+ |    2.  "ldouble" is the reference scalar long double kernel,
+ |        the others evaluate FUNCTION on SIMD vectors of doubles
+ |    3.  The widest kernel supported by the CPU is detected via cpuid
+ |    4.  Integrands shipped by the server as expressions are integrated
+ |        by simpson_expr() through the batched expr_eval()
+ |    5.  The midpoint sums are the new nodes of the Romberg levels
+ |    6.  simpson_batch() is simpson_expr() for any batched f(x), the
+ |        callbacks of the library (see netintegral.h)
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+#ifndef SIMPSON_H
+#define SIMPSON_H
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+// Define the builtin integrand
+#define FUNCTION(x)    x*x*x/(x*x + x + 1/x - 2)
+
+#define SIMPSON_POINTS  2       // evaluations per step: the node and the midpoint
+
+//==============================================================================
+// KERNEL STRUCTURE SECTION
+//==============================================================================
+
+struct expr;
+
+struct simpson_kernel {
+    const char* name;       // kernel name to select it by
+    unsigned width;         // doubles per vector instruction, 1 for scalar
+    long double (*integrate)(long double from, long double distance,
+                             unsigned long long steps);
+    // PURPOSE:     Simpson sum of FUNCTION over steps intervals of the
+    //              length distance starting at from
+    long double (*midpoint)(long double from, long double distance,
+                            unsigned long long steps);
+    // PURPOSE:     The same intervals by the midpoint rule
+};
+
+//==============================================================================
+// FUNCTION PROTOTYPES SECTION
+//==============================================================================
+
+    const struct simpson_kernel* simpson_select(const char* name);
+    // PURPOSE:     Find the kernel by name or the widest supported one
+    //              if name is NULL. Returns NULL if it is not supported
+    void simpson_list(char* buf, unsigned size);
+    // PURPOSE:     Print the names of the supported kernels into buf
+    long double simpson_expr(const struct expr* f, long double from,
+                             long double distance, unsigned long long steps);
+    // PURPOSE:     Simpson sum of the compiled expression f, evaluated
+    //              by blocks of nodes and midpoints
+    long double simpson_batch(void (*eval)(const double* x, double* y, unsigned n, void* arg),
+                              void* arg, long double from, long double distance,
+                              unsigned long long steps);
+    // PURPOSE:     Simpson sum of f(x) given by eval, called for at most
+    //              EXPR_BLOCK values of x at once
+    long double midpoint_expr(const struct expr* f, long double from,
+                              long double distance, unsigned long long steps);
+    // PURPOSE:     Midpoint sum of the compiled expression f
+
+#endif // SIMPSON_H
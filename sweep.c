@@ -0,0 +1,76 @@
+/* File:     sweep.c
+ * Purpose:  Kernel of the parameter sweeps
+ * Note:
+ |    1.  The block of x is the nodes of steps i, i + 1, ... of every
+ |        record, then their midpoints: x[s * n + k] is the step i + s
+ |        of the record k. The block of p repeats the parameters, so it
+ |        is filled once
+ |    2.  A record is summed like simpson_expr() does it: every block
+ |        plainly, the sums of the blocks compensated
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+//==============================================================================
+// INCLUDE SECTION
+//==============================================================================
+
+#include "expr.h"
+#include "reduce.h"
+#include "sweep.h"
+
+//==============================================================================
+// KERNEL SECTION
+//==============================================================================
+
+struct dsum sweep_integrate(const struct expr* f, const struct sweep_record* records,
+                            unsigned n, unsigned long long steps, struct dsum* values) {
+    double x[2 * EXPR_BLOCK], y[EXPR_BLOCK];
+    double from[SWEEP_BLOCK], h[SWEEP_BLOCK], h2[SWEEP_BLOCK];
+    struct dsum node[SWEEP_BLOCK], mid[SWEEP_BLOCK], sum = {0, 0};
+    unsigned per_block = EXPR_BLOCK / 2 / n;   // steps of every record in a block
+
+    for (unsigned k = 0; k < n; ++k) {
+        from[k] = records[k].from;
+        h[k] = (records[k].to - records[k].from) / steps;
+        h2[k] = h[k] / 2;
+        node[k] = mid[k] = (struct dsum) {0, 0};
+    }
+    for (unsigned j = 0; j < EXPR_BLOCK; ++j)
+        x[EXPR_BLOCK + j] = records[j % n].param;
+
+    for (unsigned long long i = 0; i < steps; i += per_block) {
+        unsigned m = (steps - i < per_block) ? steps - i : per_block,
+                 half = m * n;
+        for (unsigned s = 0; s < m; ++s)
+            for (unsigned k = 0; k < n; ++k) {
+                x[s * n + k] = from[k] + (i + s) * h[k];
+                x[half + s * n + k] = x[s * n + k] + h2[k];
+            }
+        expr_eval(f, x, y, 2 * half);
+
+        // The lanes of a record are apart by n, summed plainly
+        double run_node[SWEEP_BLOCK] = {0}, run_mid[SWEEP_BLOCK] = {0};
+        for (unsigned s = 0; s < m; ++s)
+            for (unsigned k = 0; k < n; ++k) {
+                run_node[k] += y[s * n + k];
+                run_mid[k] += y[half + s * n + k];
+            }
+        for (unsigned k = 0; k < n; ++k) {
+            node[k] = dsum_add(node[k], (struct dsum) {run_node[k], 0});
+            mid[k] = dsum_add(mid[k], (struct dsum) {run_mid[k], 0});
+        }
+    }
+
+    // The ends of all the records are one block
+    for (unsigned k = 0; k < n; ++k) {
+        x[k] = from[k];
+        x[n + k] = from[k] + steps * h[k];
+    }
+    expr_eval(f, x, y, 2 * n);
+    for (unsigned k = 0; k < n; ++k) {
+        long double distance = (records[k].to - records[k].from) / steps;
+        values[k] = dsum_of((4 * dsum_value(mid[k]) + 2 * dsum_value(node[k]) - y[k] + y[n + k]) *
+                            distance / 6);
+        sum = dsum_add(sum, values[k]);
+    }
+    return sum;
+}
@@ -0,0 +1,51 @@
+/* File:     sweep.h
+ * Purpose:  Kernel of the parameter sweeps: many Simpson integrals of
+ |           the same f(x, p) computed together
+ * Note:
+ |    1.  A sweep is an array of records, every record is the bounds and
+ |        the parameter p of one integral. All of them take the same steps
+ |    2.  The records are integrated by blocks of SWEEP_BLOCK: one block of
+ |        x holds the same steps of all the records of the block, a lane
+ |        per record (structure of arrays). So the evaluator runs full
+ |        blocks whatever the number of the steps, and the sums of the
+ |        records stay in a few cache lines
+ |    3.  p is the second variable of the expression (see expr.h),
+ |        its block is the parameters of the lanes
+ |    4.  The block of the records is the leaf of the tree of the sweep
+ |        (see reduce.h), its sum goes up the tree like the Simpson ones,
+ |        the integrals of the records are the values of the sweep
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "reduce.h"
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+#define SWEEP_BLOCK         32      // records integrated together
+#define SWEEP_MAX_RECORDS   4096    // records of one sweep
+
+struct expr;
+
+//==============================================================================
+// SWEEP STRUCTURE SECTION
+//==============================================================================
+
+struct sweep_record {
+    long double from, to;
+    double param;           // p of f(x, p)
+};
+
+//==============================================================================
+// FUNCTION PROTOTYPES SECTION
+//==============================================================================
+
+    struct dsum sweep_integrate(const struct expr* f, const struct sweep_record* records,
+                                unsigned n, unsigned long long steps, struct dsum* values);
+    // PURPOSE:     Simpson integrals over steps intervals of the n records
+    //              (n <= SWEEP_BLOCK) into values, returns their sum
+
+#endif // SWEEP_H
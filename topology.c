@@ -0,0 +1,170 @@
+/* File:     topology.c
+ * Purpose:  Placement of the client threads on the CPU topology
+ * Note:
+ |    1.  Only the CPUs the process is allowed to run on are used
+ |    2.  The CPUs are ordered by the hyperthread rank inside the core,
+ |        then by the core number inside the socket, then by the socket:
+ |        so the first threads get one hyperthread of every core
+ |        and the neighbour threads go to the different sockets
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+//==============================================================================
+// INCLUDE SECTION
+//==============================================================================
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include "topology.h"
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+#define SYS_CPU "/sys/devices/system/cpu"
+
+struct cpu_info {
+    int cpu, core, socket, node,
+        rank,       // hyperthread number inside the core
+        slot;       // core number inside the socket
+};
+
+//==============================================================================
+// SYSFS SECTION
+//==============================================================================
+
+#ifdef LINUX
+static int read_int(int cpu, const char* name) {
+    char path[BUFSIZ];
+    int value = -1;
+    snprintf(path, sizeof(path), SYS_CPU "/cpu%d/topology/%s", cpu, name);
+
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return -1;
+    if (fscanf(file, "%d", &value) != 1)
+        value = -1;
+    fclose(file);
+    return value;
+}
+
+// The cpuN directory has a nodeM link on the NUMA systems
+static int read_node(int cpu) {
+    char path[BUFSIZ];
+    int node = 0;
+    snprintf(path, sizeof(path), SYS_CPU "/cpu%d", cpu);
+
+    DIR* dir = opendir(path);
+    if (!dir)
+        return 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)))
+        if (sscanf(entry->d_name, "node%d", &node) == 1)
+            break;
+    closedir(dir);
+    return node;
+}
+
+static int cpu_order(const void* a, const void* b) {
+    const struct cpu_info *x = a, *y = b;
+    if (x->rank != y->rank)
+        return x->rank - y->rank;
+    if (x->slot != y->slot)
+        return x->slot - y->slot;
+    return x->socket - y->socket;
+}
+
+static unsigned count_distinct(const int* ids, unsigned n) {
+    unsigned count = 0;
+    for (unsigned i = 0; i < n; ++i) {
+        unsigned j = 0;
+        while (j < i && ids[j] != ids[i])
+            ++j;
+        count += (j == i);
+    }
+    return count;
+}
+#endif // LINUX
+
+//==============================================================================
+// PLACEMENT SECTION
+//==============================================================================
+
+int topology_plan(unsigned threads, int* cpus, struct placement* pl) {
+    memset(pl, 0, sizeof(struct placement));
+    for (unsigned t = 0; t < threads; ++t)
+        cpus[t] = -1;
+
+#ifdef LINUX
+    static struct cpu_info info[CPU_SETSIZE];
+    cpu_set_t allowed;
+    unsigned n = 0;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed))
+        return 0;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+        struct cpu_info it = {cpu, read_int(cpu, "core_id"),
+                              read_int(cpu, "physical_package_id"),
+                              read_node(cpu), 0, 0};
+        if (it.core < 0 || it.socket < 0)
+            return 0;
+
+        // The CPUs go in ascending order, so the siblings seen before
+        // give the rank and the cores of the socket seen before the slot
+        for (unsigned j = 0; j < n; ++j) {
+            if (info[j].socket != it.socket)
+                continue;
+            if (info[j].core == it.core) {
+                ++it.rank;
+                it.slot = info[j].slot;
+            }
+            else if (!info[j].rank && !it.rank)
+                ++it.slot;
+        }
+        info[n++] = it;
+    }
+    if (!n)
+        return 0;
+
+    qsort(info, n, sizeof(struct cpu_info), cpu_order);
+
+    // More threads than CPUs go round the list again
+    int sockets[threads], nodes[threads], cores[threads];
+    for (unsigned t = 0; t < threads; ++t) {
+        struct cpu_info* it = &info[t % n];
+        cpus[t] = it->cpu;
+        sockets[t] = it->socket;
+        nodes[t] = it->node;
+        cores[t] = it->socket * CPU_SETSIZE + it->core;
+    }
+
+    pl->phys = count_distinct(cores, threads);
+    pl->smt = threads - pl->phys;
+    pl->sockets = count_distinct(sockets, threads);
+    pl->nodes = count_distinct(nodes, threads);
+    return 1;
+#else  // LINUX
+    return 0;
+#endif // LINUX
+}
+
+int topology_pin(int cpu) {
+#ifdef LINUX
+    cpu_set_t set;
+    if (cpu < 0)
+        return 0;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return !pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else  // LINUX
+    (void)cpu;
+    return 0;
+#endif // LINUX
+}
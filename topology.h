@@ -0,0 +1,34 @@
+/* File:     topology.h
+ * Purpose:  Placement of the client threads on the CPU topology
+ * Note:
+ |    1.  The topology is read from /sys/devices/system/cpu (Linux only),
+ |        elsewhere the threads are left to the scheduler
+ |    2.  The threads fill the physical cores first spreading over the
+ |        sockets, and only then the additional hyperthreads
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+//==============================================================================
+// PLACEMENT STRUCTURE SECTION
+//==============================================================================
+
+struct placement {
+    unsigned phys,      // threads on their own physical cores
+             smt,       // threads sharing a physical core with another one
+             sockets,   // sockets used
+             nodes;     // NUMA nodes used
+};
+
+//==============================================================================
+// FUNCTION PROTOTYPES SECTION
+//==============================================================================
+
+    int topology_plan(unsigned threads, int* cpus, struct placement* pl);
+    // PURPOSE:     Choose the CPU for every thread into cpus[threads].
+    //              Returns 0 if the topology is unknown, cpus are -1 then
+    int topology_pin(int cpu);
+    // PURPOSE:     Pin the calling thread to the cpu, 0 if failed
+
+#endif // TOPOLOGY_H
@@ -0,0 +1,376 @@
+/* File:     wire.c
+ * Purpose:  Encoding of the messages into the frames sent over the network
+ * Note:
+ |    1.  The record of every type has its own fixed size (see record_size),
+ |        the frame is checked against it before any record is decoded
+ |    2.  The bytes are put one by one, so the host byte order and the
+ |        struct padding never get to the network
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+//==============================================================================
+// INCLUDE SECTION
+//==============================================================================
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alerts.h"
+#include "wire.h"
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+// Define record sizes
+#define SIZE_PORT       2           // u16 port
+#define SIZE_HELLO      32          // u32 cores, u32 x4 placement,
+                                    // f64 rate, u32 width
+#define SIZE_TASK       90          // u8 method, u32 cores, u64 steps,
+                                    // u32 job, from, to, distance, u8 dims,
+                                    // u64 first, u64 grid, u64 seed
+#define SIZE_RESULT     32          // f64 x2 sum, f64 x2 error
+#define SIZE_OP         9           // u8 code, f64 value
+#define SIZE_CANCEL     4           // u32 job
+#define SIZE_PROGRESS   24          // u64 steps, sum
+#define SIZE_STATS      36          // u32 thread, u64 steps, u64 evals,
+                                    // f64 busy, f64 idle
+#define SIZE_RECORD     40          // from, to, f64 param
+#define SIZE_VALUE      28          // u32 job, u64 record, f64 x2 value
+#define SIZE_LDOUBLE    16          // f64 value, f64 rest
+
+//==============================================================================
+// FIELD SECTION
+//==============================================================================
+
+static long record_size(int type) {
+    switch (type) {
+        case MSG_TASK:      return SIZE_TASK;
+        case MSG_DONE:
+        case MSG_BYE:
+        case MSG_PROBE:
+        case MSG_DRAIN:     return 0;
+        case MSG_FUNC:      return SIZE_OP;
+        case MSG_HELLO:     return SIZE_HELLO;
+        case MSG_RESULT:    return SIZE_RESULT;
+        case MSG_PORT:      return SIZE_PORT;
+        case MSG_CANCEL:    return SIZE_CANCEL;
+        case MSG_PROGRESS:  return SIZE_PROGRESS;
+        case MSG_STATS:     return SIZE_STATS;
+        case MSG_SWEEP:     return SIZE_RECORD;
+        case MSG_VALUE:     return SIZE_VALUE;
+        default:            return -1;
+    }
+}
+
+static unsigned char* put_u(unsigned char* p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i, v >>= 8)
+        *p++ = v & 0xFF;
+    return p;
+}
+
+static uint64_t get_u(const unsigned char** p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; ++i)
+        v |= (uint64_t)*(*p)++ << (8 * i);
+    return v;
+}
+
+static unsigned char* put_double(unsigned char* p, double x) {
+    uint64_t v;
+    memcpy(&v, &x, sizeof(v));
+    return put_u(p, v, 8);
+}
+
+static double get_double(const unsigned char** p) {
+    uint64_t v = get_u(p, 8);
+    double x;
+    memcpy(&x, &v, sizeof(x));
+    return x;
+}
+
+static unsigned char* put_ldouble(unsigned char* p, long double x) {
+    double hi = x;
+    p = put_double(p, hi);
+    return put_double(p, x - hi);
+}
+
+static long double get_ldouble(const unsigned char** p) {
+    long double hi = get_double(p);
+    return hi + get_double(p);
+}
+
+//==============================================================================
+// BUFFER SECTION
+//==============================================================================
+
+unsigned char* wire_space(struct wire_buf* b, size_t bytes) {
+    if (b->len + bytes > b->size) {
+        b->size = 2 * (b->len + bytes);
+        if (!(b->data = realloc(b->data, b->size)))
+            PRINT_ERR("Memory allocation");
+    }
+    return b->data + b->len;
+}
+
+void wire_free(struct wire_buf* b) {
+    free(b->data);
+    memset(b, 0, sizeof(struct wire_buf));
+    b->open = WIRE_SEALED;
+}
+
+void wire_seal(struct wire_buf* b) {
+    b->open = WIRE_SEALED;
+}
+
+void wire_consume(struct wire_buf* b, size_t bytes) {
+    b->open = WIRE_SEALED;
+    if (!bytes)
+        return;
+    memmove(b->data, b->data + bytes, b->len - bytes);
+    b->len -= bytes;
+}
+
+// Start a new frame or reuse the open one, returns the place for the record
+static unsigned char* frame_record(struct wire_buf* b, int type, size_t size) {
+    unsigned char* p = wire_space(b, WIRE_HEADER + size);
+    unsigned char* head = NULL;
+    if (b->open < b->len && size)
+        head = b->data + b->open;
+    // The empty records are not counted, every one is a frame
+    if (!head || head[3] != type || b->len - b->open - WIRE_HEADER + size > WIRE_MAX_FRAME) {
+        b->open = b->len;
+        head = p;
+        put_u(head, WIRE_MAGIC, 2);
+        head[2] = WIRE_VERSION;
+        head[3] = type;
+        put_u(head + 4, 0, 4);
+        put_u(head + 8, 0, 4);
+        p += WIRE_HEADER;
+        b->len += WIRE_HEADER;
+    }
+
+    const unsigned char* field = head + 4;
+    uint64_t count = get_u(&field, 4),
+             length = get_u(&field, 4);
+    put_u(head + 4, count + 1, 4);
+    put_u(head + 8, length + size, 4);
+    b->len += size;
+    return p;
+}
+
+//==============================================================================
+// ENCODE SECTION
+//==============================================================================
+
+void wire_put(struct wire_buf* b, const struct net_msg* msg) {
+    long size = record_size(msg->type);
+    if (size < 0 || msg->type == MSG_FUNC || msg->type == MSG_SWEEP)
+        PRINT_ERR("Cannot encode message of type %d", msg->type);
+    unsigned char* p = frame_record(b, msg->type, size);
+
+    switch (msg->type) {
+        case MSG_TASK:
+            *p++ = msg->method;
+            p = put_u(p, msg->cores, 4);
+            p = put_u(p, msg->steps, 8);
+            p = put_u(p, msg->job, 4);
+            p = put_ldouble(p, msg->local_from);
+            p = put_ldouble(p, msg->local_to);
+            p = put_ldouble(p, msg->distance);
+            *p++ = msg->dims;
+            p = put_u(p, msg->first, 8);
+            p = put_u(p, msg->grid, 8);
+            p = put_u(p, msg->seed, 8);
+            break;
+        case MSG_HELLO:
+            p = put_u(p, msg->cores, 4);
+            p = put_u(p, msg->placement.phys, 4);
+            p = put_u(p, msg->placement.smt, 4);
+            p = put_u(p, msg->placement.sockets, 4);
+            p = put_u(p, msg->placement.nodes, 4);
+            p = put_double(p, msg->rate);
+            p = put_u(p, msg->width, 4);
+            break;
+        case MSG_RESULT:
+            p = put_double(p, msg->node_sum.hi);
+            p = put_double(p, msg->node_sum.lo);
+            p = put_double(p, msg->node_error.hi);
+            p = put_double(p, msg->node_error.lo);
+            break;
+        case MSG_PORT:
+            p = put_u(p, msg->tcp_port, 2);
+            break;
+        case MSG_CANCEL:
+            p = put_u(p, msg->job, 4);
+            break;
+        case MSG_PROGRESS:
+            p = put_u(p, msg->steps, 8);
+            p = put_ldouble(p, msg->distance);
+            break;
+        case MSG_STATS:
+            p = put_u(p, msg->stats.thread, 4);
+            p = put_u(p, msg->stats.steps, 8);
+            p = put_u(p, msg->stats.evals, 8);
+            p = put_double(p, msg->stats.busy);
+            p = put_double(p, msg->stats.idle);
+            break;
+        case MSG_VALUE:
+            p = put_u(p, msg->job, 4);
+            p = put_u(p, msg->first, 8);
+            p = put_double(p, msg->node_sum.hi);
+            p = put_double(p, msg->node_sum.lo);
+            break;
+    }
+}
+
+void wire_put_func(struct wire_buf* b, const struct expr* e) {
+    unsigned char* p = wire_space(b, WIRE_HEADER + e->ops * SIZE_OP);
+    put_u(p, WIRE_MAGIC, 2);
+    p[2] = WIRE_VERSION;
+    p[3] = MSG_FUNC;
+    put_u(p + 4, e->ops, 4);
+    p = put_u(p + 8, e->ops * SIZE_OP, 4);
+
+    for (unsigned i = 0; i < e->ops; ++i) {
+        *p++ = e->op[i].code;
+        p = put_double(p, e->op[i].value);
+    }
+    b->len += WIRE_HEADER + e->ops * SIZE_OP;
+    b->open = WIRE_SEALED;
+}
+
+void wire_put_sweep(struct wire_buf* b, const struct sweep_record* records, unsigned count) {
+    unsigned char* p = wire_space(b, WIRE_HEADER + count * SIZE_RECORD);
+    put_u(p, WIRE_MAGIC, 2);
+    p[2] = WIRE_VERSION;
+    p[3] = MSG_SWEEP;
+    put_u(p + 4, count, 4);
+    p = put_u(p + 8, count * SIZE_RECORD, 4);
+
+    for (unsigned i = 0; i < count; ++i) {
+        p = put_ldouble(p, records[i].from);
+        p = put_ldouble(p, records[i].to);
+        p = put_double(p, records[i].param);
+    }
+    b->len += WIRE_HEADER + count * SIZE_RECORD;
+    b->open = WIRE_SEALED;
+}
+
+//==============================================================================
+// DECODE SECTION
+//==============================================================================
+
+long wire_frame(const void* data, size_t len, struct wire_frame* f) {
+    const unsigned char* p = data;
+    if (len < WIRE_HEADER)
+        return 0;
+    if (get_u(&p, 2) != WIRE_MAGIC || *p++ != WIRE_VERSION)
+        return -1;
+
+    f->type = *p++;
+    uint64_t count = get_u(&p, 4),
+             length = get_u(&p, 4);
+    long size = record_size(f->type);
+    if (size < 0 || length > WIRE_MAX_FRAME || length != count * size ||
+        (!size && count != 1))
+        return -1;
+    if (len < WIRE_HEADER + length)
+        return 0;
+
+    f->count = count;
+    f->rec = p;
+    return WIRE_HEADER + length;
+}
+
+void wire_record(const struct wire_frame* f, unsigned i, struct net_msg* msg) {
+    const unsigned char* p = f->rec + i * record_size(f->type);
+    memset(msg, 0, sizeof(struct net_msg));
+    msg->type = f->type;
+
+    switch (f->type) {
+        case MSG_TASK:
+            msg->method = *p++;
+            msg->cores = get_u(&p, 4);
+            msg->steps = get_u(&p, 8);
+            msg->job = get_u(&p, 4);
+            msg->local_from = get_ldouble(&p);
+            msg->local_to = get_ldouble(&p);
+            msg->distance = get_ldouble(&p);
+            msg->dims = *p++;
+            msg->first = get_u(&p, 8);
+            msg->grid = get_u(&p, 8);
+            msg->seed = get_u(&p, 8);
+            break;
+        case MSG_HELLO:
+            msg->cores = get_u(&p, 4);
+            msg->placement.phys = get_u(&p, 4);
+            msg->placement.smt = get_u(&p, 4);
+            msg->placement.sockets = get_u(&p, 4);
+            msg->placement.nodes = get_u(&p, 4);
+            msg->rate = get_double(&p);
+            msg->width = get_u(&p, 4);
+            break;
+        case MSG_RESULT:
+            msg->node_sum.hi = get_double(&p);
+            msg->node_sum.lo = get_double(&p);
+            msg->node_error.hi = get_double(&p);
+            msg->node_error.lo = get_double(&p);
+            msg->distance = dsum_value(msg->node_sum);
+            msg->error = dsum_value(msg->node_error);
+            break;
+        case MSG_PORT:
+            msg->tcp_port = get_u(&p, 2);
+            break;
+        case MSG_CANCEL:
+            msg->job = get_u(&p, 4);
+            break;
+        case MSG_PROGRESS:
+            msg->steps = get_u(&p, 8);
+            msg->distance = get_ldouble(&p);
+            break;
+        case MSG_STATS:
+            msg->stats.thread = get_u(&p, 4);
+            msg->stats.steps = get_u(&p, 8);
+            msg->stats.evals = get_u(&p, 8);
+            msg->stats.busy = get_double(&p);
+            msg->stats.idle = get_double(&p);
+            break;
+        case MSG_VALUE:
+            msg->job = get_u(&p, 4);
+            msg->first = get_u(&p, 8);
+            msg->node_sum.hi = get_double(&p);
+            msg->node_sum.lo = get_double(&p);
+            break;
+        case MSG_FUNC:
+            msg->ops = f->count;
+            break;
+    }
+}
+
+int wire_func(const struct wire_frame* f, struct expr* e) {
+    const unsigned char* p = f->rec;
+    if (f->type != MSG_FUNC || f->count > EXPR_MAX_OPS)
+        return 0;
+
+    e->ops = f->count;
+    for (unsigned i = 0; i < e->ops; ++i) {
+        e->op[i].code = *p++;
+        e->op[i].value = get_double(&p);
+    }
+    return !e->ops || expr_check(e);
+}
+
+int wire_sweep(const struct wire_frame* f, struct sweep_record* records) {
+    const unsigned char* p = f->rec;
+    if (f->type != MSG_SWEEP || f->count > SWEEP_MAX_RECORDS)
+        return 0;
+
+    for (unsigned i = 0; i < f->count; ++i) {
+        records[i].from = get_ldouble(&p);
+        records[i].to = get_ldouble(&p);
+        records[i].param = get_double(&p);
+    }
+    return 1;
+}
@@ -0,0 +1,83 @@
+/* File:     wire.h
+ * Purpose:  Encoding of the messages into the frames sent over the network
+ * Note:
+ |    1.  A frame is the header and count records of its type:
+ |          u16 magic, u8 version, u8 type, u32 count, u32 length
+ |        length is the size of the records in bytes
+ |    2.  All the fields are little-endian and of the fixed width,
+ |        a long double goes as two doubles (the value and the rest),
+ |        so no bits of the 64-bit mantissa are lost. The sums of the
+ |        results are the double-doubles of reduce.h as they are
+ |    3.  The records of the same type written one after another share
+ |        one frame until the buffer is sealed, so many tasks or results
+ |        cost one header and one syscall
+ |    4.  MSG_FUNC is one frame of count expr ops, zero means the builtin
+ |        FUNCTION
+ |    5.  MSG_SWEEP is one frame of count records of the sweep
+ * Author: Nikolai Gaiduchenko, MIPT 2017, 513 group
+*/
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <stddef.h>
+
+#include "net_msg.h"
+#include "expr.h"
+#include "sweep.h"
+
+//==============================================================================
+// DEFINE SECTION
+//==============================================================================
+
+#define WIRE_MAGIC      0x494E      // "NI"
+#define WIRE_VERSION    8
+#define WIRE_HEADER     12          // bytes of the frame header
+#define WIRE_MAX_FRAME  (1 << 20)   // bytes of the records in one frame
+#define WIRE_SEALED     ((size_t)-1)
+
+//==============================================================================
+// WIRE STRUCTURE SECTION
+//==============================================================================
+
+struct wire_buf {
+    unsigned char* data;
+    size_t len, size,
+           open;        // offset of the frame to append to or WIRE_SEALED
+};
+
+struct wire_frame {
+    int type;
+    unsigned count;
+    const unsigned char* rec;   // the first record
+};
+
+//==============================================================================
+// FUNCTION PROTOTYPES SECTION
+//==============================================================================
+
+    void wire_put(struct wire_buf* b, const struct net_msg* msg);
+    // PURPOSE:     Append the message, to the open frame of its type if any
+    void wire_put_func(struct wire_buf* b, const struct expr* e);
+    // PURPOSE:     Append the MSG_FUNC frame of the integrand bytecode
+    void wire_put_sweep(struct wire_buf* b, const struct sweep_record* records, unsigned count);
+    // PURPOSE:     Append the MSG_SWEEP frame of the records
+    void wire_seal(struct wire_buf* b);
+    // PURPOSE:     Close the open frame, the next message starts a new one
+    void wire_consume(struct wire_buf* b, size_t bytes);
+    // PURPOSE:     Drop the bytes sent or decoded from the front
+    unsigned char* wire_space(struct wire_buf* b, size_t bytes);
+    // PURPOSE:     Grow the buffer for bytes more, returns the end of data
+    void wire_free(struct wire_buf* b);
+    // PURPOSE:     Free the buffer and make it empty
+    long wire_frame(const void* data, size_t len, struct wire_frame* f);
+    // PURPOSE:     Parse the frame at the front of data. Returns its size,
+    //              0 if it is not complete yet, -1 if it is broken
+    void wire_record(const struct wire_frame* f, unsigned i, struct net_msg* msg);
+    // PURPOSE:     Decode the record i of the frame
+    int wire_func(const struct wire_frame* f, struct expr* e);
+    // PURPOSE:     Decode the MSG_FUNC frame, 0 if the bytecode is broken
+    int wire_sweep(const struct wire_frame* f, struct sweep_record* records);
+    // PURPOSE:     Decode the MSG_SWEEP frame of at most SWEEP_MAX_RECORDS,
+    //              0 if there are more
+
+#endif // WIRE_H